@@ -10,6 +10,10 @@
 #include "esp_http_server.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
+#include "modbus_bridge.h"
+
+// 1 = RS-485 Modbus slave serving the sensor as input registers, no Wi-Fi/web page
+#define MODBUS_BRIDGE_MODE 0
 
 #ifndef APP_CPU_NUM
 #define APP_CPU_NUM PRO_CPU_NUM
@@ -29,17 +33,32 @@ void bmp280_test(void *pvParameters)
     bool bme280p = dev.id == BME280_CHIP_ID;
     printf("BMP280: found %s\n", bme280p ? "BME280" : "BMP280");
 
-    
+#if MODBUS_BRIDGE_MODE
+    ESP_ERROR_CHECK(modbus_bridge_start(dev.id));
+#endif
 
     while (1)
     {
+        int32_t temperature_fixed;
+        uint32_t pressure_fixed, humidity_fixed;
+
         vTaskDelay(pdMS_TO_TICKS(1000));
-        if (bmp280_read_float(&dev, &temperature, &pressure, &humidity) != ESP_OK)
+        if (bmp280_read_fixed(&dev, &temperature_fixed, &pressure_fixed, &humidity_fixed) != ESP_OK)
         {
             printf("Temperature/pressure reading failed\n");
+#if MODBUS_BRIDGE_MODE
+            modbus_bridge_read_failed();
+#endif
             continue;
         }
 
+#if MODBUS_BRIDGE_MODE
+        modbus_bridge_publish(temperature_fixed, pressure_fixed, humidity_fixed);
+#endif
+        temperature = (float)temperature_fixed / 100;
+        pressure = (float)pressure_fixed / 256;
+        humidity = (float)humidity_fixed / 1024;
+
         /* float is used in printf(). you need non-default configuration in
          * sdkconfig for ESP8266, which is enabled by default for this
          * example. see sdkconfig.defaults.esp8266
@@ -95,10 +114,12 @@ static void start_webserver(void)
 void app_main(void)
 {
     ESP_ERROR_CHECK(nvs_flash_init());
+#if !MODBUS_BRIDGE_MODE
     wifi_init();
     ESP_ERROR_CHECK(wifi_connect_sta("ssid", "password", 10000));
 
     start_webserver();
+#endif
     ESP_ERROR_CHECK(i2cdev_init());
     xTaskCreatePinnedToCore(bmp280_test, "bmp280_test", configMINIMAL_STACK_SIZE * 8, NULL, 5, NULL, APP_CPU_NUM);    
 }
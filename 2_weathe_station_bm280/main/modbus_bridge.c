@@ -0,0 +1,187 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "modbus_bridge.h"
+
+#define BRIDGE_UART_NUM         UART_NUM_1
+#define BRIDGE_TXD_PIN          4
+#define BRIDGE_RXD_PIN          3
+#define BRIDGE_RTS_PIN          10      // RS485 transceiver DE/~RE
+#define BRIDGE_BAUD_RATE        9600
+#define BRIDGE_SLAVE_ADDRESS    0x02
+#define BRIDGE_BUF_SIZE         256
+
+static const char *TAG = "modbus_bridge";
+
+// Register image of the latest sample, rebuilt by the sampling task so a request
+// only copies it out. Everything but the age register is filled at publish time.
+static uint16_t s_regs[BRIDGE_REG_COUNT];
+static int64_t s_sample_time_us;
+static uint32_t s_samples;
+static uint32_t s_read_errors;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void put_u32(uint16_t *regs, int index, uint32_t value)
+{
+    regs[index] = value >> 16;
+    regs[index + 1] = value & 0xFFFF;
+}
+
+void modbus_bridge_publish(int32_t temperature, uint32_t pressure, uint32_t humidity)
+{
+    int64_t now_us = esp_timer_get_time();
+    // pressure is Q24.8 Pa, humidity Q22.10 %RH
+    int32_t pressure_dpa = (int32_t)(((uint64_t)pressure * 10) >> 8);
+    int32_t humidity_c = (int32_t)(((uint64_t)humidity * 100) >> 10);
+
+    portENTER_CRITICAL(&s_lock);
+    s_samples++;
+    s_sample_time_us = now_us;
+    put_u32(s_regs, BRIDGE_REG_TEMPERATURE, (uint32_t)temperature);
+    put_u32(s_regs, BRIDGE_REG_PRESSURE, (uint32_t)pressure_dpa);
+    put_u32(s_regs, BRIDGE_REG_HUMIDITY, (uint32_t)humidity_c);
+    put_u32(s_regs, BRIDGE_REG_SAMPLES, s_samples);
+    put_u32(s_regs, BRIDGE_REG_TIMESTAMP, (uint32_t)(now_us / 1000));
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void modbus_bridge_read_failed(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_read_errors++;
+    s_regs[BRIDGE_REG_READ_ERRORS] = s_read_errors > 0xFFFF ? 0xFFFF : s_read_errors;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static uint16_t modbus_crc16(const uint8_t *buffer, uint16_t buffer_length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (uint16_t pos = 0; pos < buffer_length; pos++) {
+        crc ^= (uint16_t)buffer[pos];
+
+        for (int i = 8; i != 0; i--) {
+            if ((crc & 0x0001) != 0) {
+                crc >>= 1;
+                crc ^= 0xA001;
+            }
+            else
+                crc >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+static void handle_request(const uint8_t *request, int request_length)
+{
+    if (request_length < 8) {
+        return;
+    }
+
+    uint16_t crc = modbus_crc16(request, request_length - 2);
+    if (request[request_length - 2] != (crc & 0xFF) || request[request_length - 1] != (crc >> 8)) {
+        ESP_LOGW(TAG, "CRC error");
+        return;
+    }
+    // Reads only: no reply to broadcasts or other slaves
+    if (request[0] != BRIDGE_SLAVE_ADDRESS) {
+        return;
+    }
+
+    uint8_t function_code = request[1];
+    uint16_t start_address = (request[2] << 8) | request[3];
+    uint16_t quantity = (request[4] << 8) | request[5];
+    uint8_t response[5 + 2 * BRIDGE_REG_COUNT];
+    int response_length;
+
+    response[0] = BRIDGE_SLAVE_ADDRESS;
+    response[1] = function_code;
+
+    if (function_code != 0x04) {
+        response[1] |= 0x80;
+        response[2] = 0x01;  // Illegal function
+        response_length = 3;
+    } else if (quantity == 0 || start_address + quantity > BRIDGE_REG_COUNT) {
+        response[1] |= 0x80;
+        response[2] = 0x02;  // Illegal data address
+        response_length = 3;
+    } else {
+        uint16_t regs[BRIDGE_REG_COUNT];
+        int64_t sample_time_us;
+
+        portENTER_CRITICAL(&s_lock);
+        memcpy(regs, s_regs, sizeof(regs));
+        sample_time_us = s_sample_time_us;
+        portEXIT_CRITICAL(&s_lock);
+
+        put_u32(regs, BRIDGE_REG_AGE, sample_time_us ? (uint32_t)((esp_timer_get_time() - sample_time_us) / 1000) : 0xFFFFFFFF);
+
+        response[2] = quantity * 2;  // Byte count
+        for (int i = 0; i < quantity; i++) {
+            response[3 + 2 * i] = regs[start_address + i] >> 8;
+            response[4 + 2 * i] = regs[start_address + i] & 0xFF;
+        }
+        response_length = 3 + quantity * 2;
+    }
+
+    crc = modbus_crc16(response, response_length);
+    response[response_length] = crc & 0xFF;
+    response[response_length + 1] = crc >> 8;
+    uart_write_bytes(BRIDGE_UART_NUM, (const char *)response, response_length + 2);
+}
+
+static void modbus_bridge_task(void *pvParameters)
+{
+    uint8_t data[BRIDGE_BUF_SIZE];
+
+    while (1) {
+        int len = uart_read_bytes(BRIDGE_UART_NUM, data, sizeof(data), pdMS_TO_TICKS(20));
+        if (len > 0) {
+            handle_request(data, len);
+        }
+    }
+}
+
+esp_err_t modbus_bridge_start(uint8_t chip_id)
+{
+    uart_config_t uart_config = {
+        .baud_rate = BRIDGE_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_APB,
+    };
+
+    esp_err_t err = uart_driver_install(BRIDGE_UART_NUM, BRIDGE_BUF_SIZE * 2, 0, 0, NULL, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART driver install failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    err = uart_param_config(BRIDGE_UART_NUM, &uart_config);
+    if (err == ESP_OK) {
+        err = uart_set_pin(BRIDGE_UART_NUM, BRIDGE_TXD_PIN, BRIDGE_RXD_PIN, BRIDGE_RTS_PIN, UART_PIN_NO_CHANGE);
+    }
+    if (err == ESP_OK) {
+        err = uart_set_mode(BRIDGE_UART_NUM, UART_MODE_RS485_HALF_DUPLEX);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "UART setup failed: %s", esp_err_to_name(err));
+        uart_driver_delete(BRIDGE_UART_NUM);
+        return err;
+    }
+
+    s_regs[BRIDGE_REG_CHIP_ID] = chip_id;
+
+    if (xTaskCreate(modbus_bridge_task, "modbus_bridge", 3072, NULL, 10, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "No memory for the bridge task");
+        uart_driver_delete(BRIDGE_UART_NUM);
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Serving sensor input registers as slave 0x%02X", BRIDGE_SLAVE_ADDRESS);
+    return ESP_OK;
+}
@@ -0,0 +1,35 @@
+#ifndef MODBUS_BRIDGE_H
+#define MODBUS_BRIDGE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Modbus RTU slave that serves the latest sensor sample as input registers (FC 0x04).
+// Registers are 32-bit values, high word first:
+//   0-1   temperature, 0.01 degC (int32)
+//   2-3   pressure, 0.1 Pa (int32)
+//   4-5   humidity, 0.01 %RH (int32, 0 on BMP280)
+//   6-7   sample counter
+//   8-9   sample timestamp, ms since boot
+//   10-11 sample age at the time of the request, ms
+//   12    chip ID (0x58 BMP280, 0x60 BME280)
+//   13    failed sensor reads since boot
+#define BRIDGE_REG_TEMPERATURE  0
+#define BRIDGE_REG_PRESSURE     2
+#define BRIDGE_REG_HUMIDITY     4
+#define BRIDGE_REG_SAMPLES      6
+#define BRIDGE_REG_TIMESTAMP    8
+#define BRIDGE_REG_AGE          10
+#define BRIDGE_REG_CHIP_ID      12
+#define BRIDGE_REG_READ_ERRORS  13
+#define BRIDGE_REG_COUNT        14
+
+// Sets up the RS-485 UART and starts the slave task. Returns the UART driver's
+// error, or ESP_ERR_NO_MEM when the task cannot be created.
+esp_err_t modbus_bridge_start(uint8_t chip_id);
+
+// Called by the sampling task with the output of bmp280_read_fixed().
+void modbus_bridge_publish(int32_t temperature, uint32_t pressure, uint32_t humidity);
+void modbus_bridge_read_failed(void);
+
+#endif // MODBUS_BRIDGE_H
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "modbus.h"
+#include "coil_cache.h"
+
+static const char *TAG = "COIL CACHE";
+
+static coil_cache_entry_t s_entries[COIL_CACHE_MAX_SLAVES];
+static int s_count;
+static uint32_t s_writes[COIL_CACHE_MAX_SLAVES];   // coil_cache_note_write() calls per entry
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Reads `quantity` bits from `start` with FC 0x01 or 0x02 into `bits`
+static esp_err_t read_bits(uint8_t address, uint8_t function, uint16_t quantity, uint16_t *bits) {
+    modbus_transaction_t t = {
+        .address = address,
+        .pdu = { function, 0x00, 0x00, quantity >> 8, quantity & 0xFF },
+        .pdu_length = 5,
+    };
+
+    esp_err_t err = modbus_transact(&t);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // function, byte count, status bytes
+    if (t.pdu_length < 2 || t.pdu[1] != (quantity + 7) / 8 || t.pdu_length != 2 + t.pdu[1]) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    *bits = t.pdu[2] | (t.pdu[1] > 1 ? t.pdu[3] << 8 : 0);
+    return ESP_OK;
+}
+
+static void poll_slave(coil_cache_entry_t *entry) {
+    uint32_t *writes = &s_writes[entry - s_entries];
+    uint16_t coils = 0;
+    uint16_t inputs = 0;
+    int64_t inputs_at = 0;
+    esp_err_t inputs_err = ESP_OK;
+
+    portENTER_CRITICAL(&s_lock);
+    uint32_t writes_before = *writes;
+    portEXIT_CRITICAL(&s_lock);
+
+    // The coils go in before the inputs are read. A write noted since the read
+    // started is newer than what the slave reported, so the read is dropped then.
+    esp_err_t coils_err = read_bits(entry->address, 0x01, CONFIG_MODBUS_POLL_COILS, &coils);
+    portENTER_CRITICAL(&s_lock);
+    if (coils_err == ESP_OK && *writes == writes_before) {
+        entry->coils = coils;
+        entry->coils_at_us = esp_timer_get_time();
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    // A slave that did not answer the first read is not waited for twice per round
+    if (CONFIG_MODBUS_POLL_INPUTS > 0 && coils_err != ESP_ERR_TIMEOUT) {
+        inputs_err = read_bits(entry->address, 0x02, CONFIG_MODBUS_POLL_INPUTS, &inputs);
+        inputs_at = esp_timer_get_time();
+    }
+
+    portENTER_CRITICAL(&s_lock);
+    entry->polls++;
+    entry->last_err = coils_err != ESP_OK ? coils_err : inputs_err;
+    if (entry->last_err != ESP_OK) {
+        entry->failures++;
+    }
+    if (inputs_at != 0 && inputs_err == ESP_OK) {
+        entry->inputs = inputs;
+        entry->inputs_at_us = inputs_at;
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static void coil_cache_task(void *pvParameters) {
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        for (int i = 0; i < s_count; i++) {
+            poll_slave(&s_entries[i]);
+        }
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(CONFIG_MODBUS_POLL_INTERVAL_MS));
+    }
+}
+
+void coil_cache_init(void) {
+    const char *p = CONFIG_MODBUS_POLL_SLAVES;
+
+    while (*p && s_count < COIL_CACHE_MAX_SLAVES) {
+        char *end;
+        long address = strtol(p, &end, 10);
+        if (end == p) {
+            p++;
+            continue;
+        }
+        if (address >= 1 && address <= 247) {
+            s_entries[s_count].address = address;
+            s_entries[s_count].last_err = ESP_ERR_TIMEOUT;
+            s_count++;
+        } else {
+            ESP_LOGW(TAG, "Ignoring slave address %ld", address);
+        }
+        p = end;
+    }
+    if (s_count == 0) {
+        ESP_LOGW(TAG, "No slaves to poll");
+        return;
+    }
+    ESP_LOGI(TAG, "Polling %d slave(s) every %d ms", s_count, CONFIG_MODBUS_POLL_INTERVAL_MS);
+    xTaskCreate(coil_cache_task, "coil_cache", 3072, NULL, 4, NULL);
+}
+
+int coil_cache_count(void) {
+    return s_count;
+}
+
+bool coil_cache_get(int index, coil_cache_entry_t *entry) {
+    if (index < 0 || index >= s_count) {
+        return false;
+    }
+    portENTER_CRITICAL(&s_lock);
+    *entry = s_entries[index];
+    portEXIT_CRITICAL(&s_lock);
+    return true;
+}
+
+bool coil_cache_stale(int64_t at_us) {
+    return at_us == 0 || esp_timer_get_time() - at_us > CONFIG_MODBUS_POLL_STALE_MS * 1000LL;
+}
+
+void coil_cache_note_write(uint8_t address, uint8_t coil, uint8_t state) {
+    portENTER_CRITICAL(&s_lock);
+    for (int i = 0; i < s_count; i++) {
+        coil_cache_entry_t *entry = &s_entries[i];
+        if (entry->address == address) {
+            s_writes[i]++;
+        }
+        // Only into a fresh entry: the other coils of a stale one are not known to be right
+        if (entry->address == address && coil < 16 && !coil_cache_stale(entry->coils_at_us)) {
+            entry->coils = state ? entry->coils | (1 << coil) : entry->coils & ~(1 << coil);
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
@@ -0,0 +1,40 @@
+#ifndef COIL_CACHE_H
+#define COIL_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Coil and discrete input state of the CONFIG_MODBUS_POLL_SLAVES, read by a
+// background task with FC 0x01/0x02 every CONFIG_MODBUS_POLL_INTERVAL_MS. Readers
+// only ever get this table, so HTTP load never turns into bus load.
+
+#define COIL_CACHE_MAX_SLAVES   8
+
+typedef struct {
+    uint8_t address;
+    uint16_t coils;                 // bit n = coil n
+    uint16_t inputs;                // bit n = discrete input n
+    int64_t coils_at_us;            // esp_timer_get_time() of the last good read, 0 = never
+    int64_t inputs_at_us;
+    esp_err_t last_err;             // modbus_transact() result of the last poll
+    uint32_t polls;
+    uint32_t failures;
+} coil_cache_entry_t;
+
+// Starts the poll task; call after uart_init()
+void coil_cache_init(void);
+
+int coil_cache_count(void);
+
+// Copies the entry of the `index`th configured slave, false past the last one
+bool coil_cache_get(int index, coil_cache_entry_t *entry);
+
+// True when a read made at `at_us` is missing or older than CONFIG_MODBUS_POLL_STALE_MS
+bool coil_cache_stale(int64_t at_us);
+
+// Records a coil the slave just confirmed writing, so the next page view does not
+// show the old state until the following poll
+void coil_cache_note_write(uint8_t address, uint8_t coil, uint8_t state);
+
+#endif // COIL_CACHE_H
@@ -1,5 +1,10 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
 #include "modbus.h"
 #include "driver/gpio.h"
 
@@ -8,6 +13,15 @@
 #define RXD_PIN GPIO_NUM_7
 #define RTS_PIN GPIO_NUM_8
 #define BAUD_RATE 9600
+#define FRAME_MAX 256               // address + PDU + CRC
+#define CHAR_TIMEOUT_MS 20          // silence that ends a reply, one tick at 100 Hz plus margin
+// 3.5 characters of 11 bits between frames, fixed at 1750 us above 19200 baud
+#define FRAME_GAP_US (BAUD_RATE > 19200 ? 1750 : 38500000 / BAUD_RATE)
+
+static const char *TAG = "MODBUS";
+
+static SemaphoreHandle_t s_bus_lock;
+static int64_t s_bus_free_at;
 
 
 void uart_init() {
@@ -23,24 +37,167 @@ void uart_init() {
     uart_driver_install(UART_NUM, 256, 0, 0, NULL, 0);
     uart_param_config(UART_NUM, &uart_config);
     uart_set_pin(UART_NUM, TXD_PIN, RXD_PIN, RTS_PIN, UART_PIN_NO_CHANGE);
+    // RTS drives the transceiver's DE pin, released as soon as the frame is out
+    uart_set_mode(UART_NUM, UART_MODE_RS485_HALF_DUPLEX);
+
+    s_bus_lock = xSemaphoreCreateMutex();
+}
+
+// Length of a reply from its first bytes: 0 if more bytes are needed to tell,
+// -1 for function codes whose length is not known in advance.
+static int response_length(const uint8_t *frame, int length) {
+    if (length < 2) {
+        return 0;
+    }
+    if (frame[1] & 0x80) {
+        return 5;  // address, function code, exception code, CRC
+    }
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04:
+            return length < 3 ? 0 : 5 + frame[2];
+        case 0x05: case 0x06: case 0x0F: case 0x10:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+// Reads one reply: up to `timeout_ms` for the first byte, then until the predicted
+// length, or until the line goes quiet for function codes of unknown length.
+static int read_reply(uint8_t *frame, int timeout_ms) {
+    int got = uart_read_bytes(UART_NUM, frame, 1, pdMS_TO_TICKS(timeout_ms));
+    if (got <= 0) {
+        return 0;
+    }
+    while (got < FRAME_MAX) {
+        int expected = response_length(frame, got);
+        if (expected > FRAME_MAX) {
+            expected = -1;
+        }
+        if (expected > 0 && got >= expected) {
+            return expected;
+        }
+        int want = expected > 0 ? expected - got : expected == 0 ? 1 : FRAME_MAX - got;
+        int len = uart_read_bytes(UART_NUM, frame + got, want, pdMS_TO_TICKS(CHAR_TIMEOUT_MS));
+        if (len <= 0) {
+            break;
+        }
+        got += len;
+    }
+    return got;
+}
+
+// Checks a complete reply against the request it answers
+static esp_err_t check_reply(const modbus_transaction_t *t, const uint8_t *frame, int length) {
+    if (length < 4) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    uint16_t crc = calculate_crc((uint8_t *)frame, length - 2);
+    if (frame[length - 2] != (crc & 0xFF) || frame[length - 1] != (crc >> 8)) {
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (frame[0] != t->address || (frame[1] & 0x7F) != t->pdu[0]) {
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    if (frame[1] & 0x80) {
+        return MODBUS_ERR_EXCEPTION(frame[2]);
+    }
+    switch (frame[1]) {
+        case 0x05: case 0x06:
+            // The reply echoes the whole request
+            if (length != 8 || t->pdu_length != 5 || memcmp(frame + 1, t->pdu, 5) != 0) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            break;
+        case 0x0F: case 0x10:
+            // Starting address and quantity
+            if (length != 8 || t->pdu_length < 5 || memcmp(frame + 1, t->pdu, 5) != 0) {
+                return ESP_ERR_INVALID_RESPONSE;
+            }
+            break;
+    }
+    return ESP_OK;
+}
+
+esp_err_t modbus_transact(modbus_transaction_t *t) {
+    uint8_t frame[FRAME_MAX];
+    esp_err_t err = ESP_OK;
+
+    if (t->pdu_length == 0 || t->pdu_length > MODBUS_PDU_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    frame[0] = t->address;
+    memcpy(frame + 1, t->pdu, t->pdu_length);
+    uint16_t crc = calculate_crc(frame, 1 + t->pdu_length);
+    frame[1 + t->pdu_length] = crc & 0xFF;
+    frame[2 + t->pdu_length] = crc >> 8;
+
+    // Held until the reply is in or timed out, so no other request goes out meanwhile
+    xSemaphoreTake(s_bus_lock, portMAX_DELAY);
+
+    // Keep 3.5 character times of silence between frames on the bus
+    int64_t wait_us = s_bus_free_at - esp_timer_get_time();
+    if (wait_us > 0) {
+        esp_rom_delay_us(wait_us);
+    }
+    // A late reply to an earlier, timed out request must not be taken for this one
+    uart_flush_input(UART_NUM);
+    uart_write_bytes(UART_NUM, (const char *)frame, 3 + t->pdu_length);
+    uart_wait_tx_done(UART_NUM, pdMS_TO_TICKS(100));
+
+    if (t->address != 0) {
+        int length = read_reply(frame, t->timeout_ms ? t->timeout_ms : MODBUS_RESPONSE_TIMEOUT_MS);
+        err = length == 0 ? ESP_ERR_TIMEOUT : check_reply(t, frame, length);
+        if (err == ESP_OK) {
+            t->pdu_length = length - 3;
+            memcpy(t->pdu, frame + 1, t->pdu_length);
+        }
+    }
+    s_bus_free_at = esp_timer_get_time() + FRAME_GAP_US;
+    xSemaphoreGive(s_bus_lock);
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Slave %d, function 0x%02X: %s", t->address, t->pdu[0], modbus_err_to_name(err));
+    }
+    return err;
 }
 
-void modbus_send_command(uint8_t address, uint8_t function, uint16_t reg, uint16_t value) {
-    uint8_t request[8];
-    uint16_t crc;
+const char *modbus_err_to_name(esp_err_t err) {
+    switch (err) {
+        case ESP_OK: return "OK";
+        case ESP_ERR_TIMEOUT: return "slave did not respond";
+        case ESP_ERR_INVALID_CRC: return "corrupt reply";
+        case ESP_ERR_INVALID_RESPONSE: return "reply does not match the request";
+        case MODBUS_ERR_EXCEPTION(0x01): return "illegal function";
+        case MODBUS_ERR_EXCEPTION(0x02): return "illegal data address";
+        case MODBUS_ERR_EXCEPTION(0x03): return "illegal data value";
+        case MODBUS_ERR_EXCEPTION(0x04): return "slave device failure";
+        case MODBUS_ERR_EXCEPTION(0x05): return "acknowledge";
+        case MODBUS_ERR_EXCEPTION(0x06): return "slave device busy";
+        case MODBUS_ERR_EXCEPTION(0x08): return "memory parity error";
+        case MODBUS_ERR_EXCEPTION(0x0A): return "gateway path unavailable";
+        case MODBUS_ERR_EXCEPTION(0x0B): return "gateway target failed to respond";
+        default:
+            if (err > MODBUS_ERR_EXCEPTION_BASE && err <= MODBUS_ERR_EXCEPTION(0xFF)) {
+                return "unknown exception";
+            }
+            return esp_err_to_name(err);
+    }
+}
 
-    request[0] = address;
-    request[1] = function;
-    request[2] = (reg >> 8) & 0xFF;
-    request[3] = reg & 0xFF;
-    request[4] = (value >> 8) & 0xFF;
-    request[5] = value & 0xFF;
+esp_err_t modbus_send_command(uint8_t address, uint8_t function, uint16_t reg, uint16_t value) {
+    modbus_transaction_t t = {
+        .address = address,
+        .pdu_length = 5,
+    };
 
-    crc = calculate_crc(request, 6);
-    request[6] = crc & 0xFF;
-    request[7] = (crc >> 8) & 0xFF;
+    t.pdu[0] = function;
+    t.pdu[1] = (reg >> 8) & 0xFF;
+    t.pdu[2] = reg & 0xFF;
+    t.pdu[3] = (value >> 8) & 0xFF;
+    t.pdu[4] = value & 0xFF;
 
-    uart_write_bytes(UART_NUM, (const char *)request, 8);
+    return modbus_transact(&t);
 }
 
 uint16_t calculate_crc(uint8_t *data, uint16_t length) {
@@ -59,10 +216,12 @@ uint16_t calculate_crc(uint8_t *data, uint16_t length) {
     return crc;
 }
 
-void relay_control(uint8_t relay, uint8_t state) {
+esp_err_t relay_control(uint8_t relay, uint8_t state) {
     uint16_t reg = 0x0000 + relay;
     uint16_t value = state ? 0xFF00 : 0x0000;
-    modbus_send_command(1, 0x05, reg, value);
+    esp_err_t err = modbus_send_command(1, 0x05, reg, value);
     // print modbus command send value  to the console
-    ESP_LOGI("MODBUS COMMAND", "Address: 1, Function: 0x05, Register: 0x%04X, Value: 0x%04X", reg, value);
+    ESP_LOGI("MODBUS COMMAND", "Address: 1, Function: 0x05, Register: 0x%04X, Value: 0x%04X: %s",
+             reg, value, modbus_err_to_name(err));
+    return err;
 }
\ No newline at end of file
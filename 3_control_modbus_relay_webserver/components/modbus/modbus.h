@@ -4,9 +4,36 @@
 #include <stdint.h>
 #include "esp_err.h"
 
+#define MODBUS_PDU_MAX              253
+#define MODBUS_RESPONSE_TIMEOUT_MS  200     // default wait for the first byte of a reply
+
+// A slave's exception reply comes back as this base plus the exception code
+#define MODBUS_ERR_EXCEPTION_BASE   0x10E00
+#define MODBUS_ERR_EXCEPTION(code)  (MODBUS_ERR_EXCEPTION_BASE + (code))
+
+// One request/response exchange. The request PDU in `pdu` is replaced by the
+// response PDU when the transaction succeeds.
+typedef struct {
+    uint8_t address;                // 0 = broadcast, no reply is read
+    uint8_t pdu[MODBUS_PDU_MAX];
+    uint16_t pdu_length;
+    uint16_t timeout_ms;            // 0 = MODBUS_RESPONSE_TIMEOUT_MS
+} modbus_transaction_t;
+
 void uart_init(void);
-void modbus_send_command(uint8_t address, uint8_t function, uint16_t reg, uint16_t value);
+
+// Sends the request and reads the slave's reply, CRC checked and matched to the
+// request. Calls from any task are serialised, so the bus is never driven while a
+// reply is pending. Returns ESP_OK, ESP_ERR_TIMEOUT when the slave did not answer,
+// ESP_ERR_INVALID_CRC for a corrupt reply, ESP_ERR_INVALID_RESPONSE for a reply
+// that does not belong to the request, or MODBUS_ERR_EXCEPTION(code).
+esp_err_t modbus_transact(modbus_transaction_t *transaction);
+
+// Text for a modbus_transact() result, exception codes included
+const char *modbus_err_to_name(esp_err_t err);
+
+esp_err_t modbus_send_command(uint8_t address, uint8_t function, uint16_t reg, uint16_t value);
 uint16_t calculate_crc(uint8_t *data, uint16_t length);
-void relay_control(uint8_t relay, uint8_t state);
+esp_err_t relay_control(uint8_t relay, uint8_t state);
 
 #endif // MODBUS_H
@@ -0,0 +1,118 @@
+#include <string.h>
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "modbus.h"
+#include "coil_cache.h"
+#include "relay_queue.h"
+
+static const char *TAG = "RELAY QUEUE";
+
+static relay_cmd_t s_waiting[RELAY_COUNT];     // status RELAY_CMD_QUEUED while a command waits
+static relay_cmd_t s_running;
+static relay_cmd_t s_history[RELAY_CMD_HISTORY];
+static int s_history_next;
+static uint32_t s_next_id = 1;
+static QueueHandle_t s_queue;                   // relays with a waiting command, in submit order
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Called with s_lock held
+static void remember(const relay_cmd_t *cmd) {
+    s_history[s_history_next] = *cmd;
+    s_history_next = (s_history_next + 1) % RELAY_CMD_HISTORY;
+}
+
+static void relay_queue_task(void *pvParameters) {
+    uint8_t relay;
+
+    while (1) {
+        xQueueReceive(s_queue, &relay, portMAX_DELAY);
+
+        portENTER_CRITICAL(&s_lock);
+        s_running = s_waiting[relay];
+        s_running.status = RELAY_CMD_RUNNING;
+        s_waiting[relay].status = RELAY_CMD_UNKNOWN;
+        portEXIT_CRITICAL(&s_lock);
+
+        esp_err_t err = relay_control(relay, s_running.state);
+        if (err == ESP_OK) {
+            coil_cache_note_write(1, relay, s_running.state);
+        }
+
+        portENTER_CRITICAL(&s_lock);
+        s_running.err = err;
+        s_running.status = err == ESP_OK ? RELAY_CMD_DONE : RELAY_CMD_FAILED;
+        remember(&s_running);
+        s_running.status = RELAY_CMD_UNKNOWN;
+        portEXIT_CRITICAL(&s_lock);
+    }
+}
+
+void relay_queue_init(void) {
+    // One entry per relay is enough: a relay is only queued when it has no waiting command
+    s_queue = xQueueCreate(RELAY_COUNT, sizeof(uint8_t));
+    xTaskCreate(relay_queue_task, "relay_queue", 3072, NULL, 5, NULL);
+}
+
+uint32_t relay_queue_submit(uint8_t relay, uint8_t state) {
+    bool enqueue;
+
+    portENTER_CRITICAL(&s_lock);
+    relay_cmd_t *cmd = &s_waiting[relay];
+    enqueue = cmd->status != RELAY_CMD_QUEUED;
+    if (!enqueue) {
+        cmd->status = RELAY_CMD_SUPERSEDED;
+        remember(cmd);
+    }
+    cmd->id = s_next_id++;
+    if (s_next_id == 0) {
+        s_next_id = 1;
+    }
+    cmd->relay = relay;
+    cmd->state = state;
+    cmd->status = RELAY_CMD_QUEUED;
+    cmd->err = ESP_OK;
+    uint32_t id = cmd->id;
+    portEXIT_CRITICAL(&s_lock);
+
+    if (enqueue) {
+        xQueueSend(s_queue, &relay, 0);
+    } else {
+        ESP_LOGI(TAG, "Relay %d: command %" PRIu32 " replaces the one still waiting", relay + 1, id);
+    }
+    return id;
+}
+
+relay_cmd_state_t relay_queue_status(uint32_t id, relay_cmd_t *cmd) {
+    memset(cmd, 0, sizeof(*cmd));
+
+    portENTER_CRITICAL(&s_lock);
+    if (id != 0 && s_running.status == RELAY_CMD_RUNNING && s_running.id == id) {
+        *cmd = s_running;
+    }
+    for (int i = 0; id != 0 && i < RELAY_COUNT; i++) {
+        if (s_waiting[i].status == RELAY_CMD_QUEUED && s_waiting[i].id == id) {
+            *cmd = s_waiting[i];
+        }
+    }
+    for (int i = 0; id != 0 && i < RELAY_CMD_HISTORY; i++) {
+        if (s_history[i].status != RELAY_CMD_UNKNOWN && s_history[i].id == id) {
+            *cmd = s_history[i];
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return cmd->status;
+}
+
+const char *relay_cmd_state_name(relay_cmd_state_t status) {
+    switch (status) {
+        case RELAY_CMD_QUEUED: return "queued";
+        case RELAY_CMD_RUNNING: return "running";
+        case RELAY_CMD_DONE: return "done";
+        case RELAY_CMD_FAILED: return "failed";
+        case RELAY_CMD_SUPERSEDED: return "superseded";
+        default: return "unknown";
+    }
+}
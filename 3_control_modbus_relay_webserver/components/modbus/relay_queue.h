@@ -0,0 +1,43 @@
+#ifndef RELAY_QUEUE_H
+#define RELAY_QUEUE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Relay commands from the web server, carried out one at a time by a bus task so
+// no HTTP handler waits on the RS-485 line. A command for a relay that already has
+// one waiting replaces it (latest state wins), so the queue never holds more than
+// one command per relay.
+
+#define RELAY_COUNT         4
+#define RELAY_CMD_HISTORY   16      // finished commands kept for status queries
+
+typedef enum {
+    RELAY_CMD_UNKNOWN,              // never issued, or too old to be remembered
+    RELAY_CMD_QUEUED,
+    RELAY_CMD_RUNNING,
+    RELAY_CMD_DONE,                 // the slave confirmed the write
+    RELAY_CMD_FAILED,               // see `err`
+    RELAY_CMD_SUPERSEDED,           // replaced by a later command for the same relay before it ran
+} relay_cmd_state_t;
+
+typedef struct {
+    uint32_t id;
+    uint8_t relay;
+    uint8_t state;
+    relay_cmd_state_t status;
+    esp_err_t err;                  // modbus_transact() result for RELAY_CMD_DONE / RELAY_CMD_FAILED
+} relay_cmd_t;
+
+// Starts the bus task; call after uart_init()
+void relay_queue_init(void);
+
+// Queues a relay state, returns the command ID (never 0)
+uint32_t relay_queue_submit(uint8_t relay, uint8_t state);
+
+// Fills `cmd` with what became of command `id`, returns its status
+relay_cmd_state_t relay_queue_status(uint32_t id, relay_cmd_t *cmd);
+
+const char *relay_cmd_state_name(relay_cmd_state_t status);
+
+#endif // RELAY_QUEUE_H
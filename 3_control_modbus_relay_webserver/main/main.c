@@ -1,25 +1,62 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_http_server.h"
 #include "nvs_flash.h"
 #include "connect.h"
 #include "modbus.h"
+#include "relay_queue.h"
+#include "coil_cache.h"
 
 static const char *TAG = "WEBSERVER";
 
-esp_err_t relay_on_handler(httpd_req_t *req, uint8_t relay) {
-    relay_control(relay, 1);
-    httpd_resp_send(req, "Relay is ON", HTTPD_RESP_USE_STRLEN);
+// The bus task switches the relay; the reply carries the command ID to ask
+// /command?id=N what the slave answered
+static esp_err_t queue_relay_command(httpd_req_t *req, uint8_t relay, uint8_t state) {
+    char msg[80];
+    uint32_t id = relay_queue_submit(relay, state);
+    snprintf(msg, sizeof(msg), "Relay %d %s: command %" PRIu32 " queued, see /command?id=%" PRIu32,
+             relay + 1, state ? "ON" : "OFF", id, id);
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
+esp_err_t relay_on_handler(httpd_req_t *req, uint8_t relay) {
+    return queue_relay_command(req, relay, 1);
+}
+
 esp_err_t relay_off_handler(httpd_req_t *req, uint8_t relay) {
-    relay_control(relay, 0);
-    httpd_resp_send(req, "Relay is OFF", HTTPD_RESP_USE_STRLEN);
+    return queue_relay_command(req, relay, 0);
+}
+
+esp_err_t command_handler(httpd_req_t *req) {
+    char query[32];
+    char value[12];
+    uint32_t id = 0;
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+            httpd_query_key_value(query, "id", value, sizeof(value)) == ESP_OK) {
+        id = strtoul(value, NULL, 10);
+    }
+
+    relay_cmd_t cmd;
+    relay_cmd_state_t status = relay_queue_status(id, &cmd);
+    if (status == RELAY_CMD_UNKNOWN) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown command");
+        return ESP_OK;
+    }
+    char json[128];
+    snprintf(json, sizeof(json), "{\"id\":%" PRIu32 ",\"relay\":%d,\"state\":\"%s\",\"status\":\"%s\",\"result\":\"%s\"}",
+             cmd.id, cmd.relay + 1, cmd.state ? "on" : "off", relay_cmd_state_name(status),
+             status == RELAY_CMD_DONE || status == RELAY_CMD_FAILED ? modbus_err_to_name(cmd.err) : "");
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
     return ESP_OK;
 }
 
@@ -32,45 +69,98 @@ esp_err_t relay3_off_handler(httpd_req_t *req) { return relay_off_handler(req, 2
 esp_err_t relay4_on_handler(httpd_req_t *req) { return relay_on_handler(req, 3); }
 esp_err_t relay4_off_handler(httpd_req_t *req) { return relay_off_handler(req, 3); }
 
+// Relay page, with the state the poller last read from slave 1: page views
+// never go to the bus themselves
 esp_err_t get_handler(httpd_req_t *req) {
-    const char *resp_str = "<!DOCTYPE html>"
-                           "<html>"
-                           "<head>"
-                           "<style>"
-                           "body { font-family: Arial, sans-serif; }"
-                           "h1 { text-align: center; }"
-                           ".relay { display: flex; justify-content: space-around; margin: 20px; }"
-                           ".button { padding: 10px 20px; font-size: 16px; }"
-                           "</style>"
-                           "</head>"
-                           "<body>"
-                           "<h1>ESP32 Modbus Relay Control</h1>"
-                           "<div class='relay'>"
-                           "<div>"
-                           "<h2>Relay 1</h2>"
-                           "<button class='button' onclick=\"location.href='/relay1/on'\" type=\"button\">ON</button>"
-                           "<button class='button' onclick=\"location.href='/relay1/off'\" type=\"button\">OFF</button>"
-                           "</div>"
-                           "<div>"
-                           "<h2>Relay 2</h2>"
-                           "<button class='button' onclick=\"location.href='/relay2/on'\" type=\"button\">ON</button>"
-                           "<button class='button' onclick=\"location.href='/relay2/off'\" type=\"button\">OFF</button>"
-                           "</div>"
-                           "<div>"
-                           "<h2>Relay 3</h2>"
-                           "<button class='button' onclick=\"location.href='/relay3/on'\" type=\"button\">ON</button>"
-                           "<button class='button' onclick=\"location.href='/relay3/off'\" type=\"button\">OFF</button>"
-                           "</div>"
-                           "<div>"
-                           "<h2>Relay 4</h2>"
-                           "<button class='button' onclick=\"location.href='/relay4/on'\" type=\"button\">ON</button>"
-                           "<button class='button' onclick=\"location.href='/relay4/off'\" type=\"button\">OFF</button>"
-                           "</div>"
-                           "</div>"
-                           "</body>"
-                           "</html>";
-    httpd_resp_send(req, resp_str, HTTPD_RESP_USE_STRLEN);
-    return ESP_OK;
+    const char *head = "<!DOCTYPE html>"
+                       "<html>"
+                       "<head>"
+                       "<style>"
+                       "body { font-family: Arial, sans-serif; }"
+                       "h1 { text-align: center; }"
+                       ".relay { display: flex; justify-content: space-around; margin: 20px; }"
+                       ".button { padding: 10px 20px; font-size: 16px; }"
+                       ".stale { color: gray; }"
+                       "</style>"
+                       "</head>"
+                       "<body>"
+                       "<h1>ESP32 Modbus Relay Control</h1>"
+                       "<div class='relay'>";
+    const char *tail = "</div>"
+                       "</body>"
+                       "</html>";
+    char chunk[320];
+    coil_cache_entry_t entry;
+    uint16_t coils = 0;
+    int64_t coils_at = 0;
+
+    for (int i = 0; coil_cache_get(i, &entry); i++) {
+        if (entry.address == 1) {
+            coils = entry.coils;
+            coils_at = entry.coils_at_us;
+            break;
+        }
+    }
+    bool stale = coil_cache_stale(coils_at);
+
+    httpd_resp_send_chunk(req, head, HTTPD_RESP_USE_STRLEN);
+    for (int relay = 1; relay <= RELAY_COUNT; relay++) {
+        const char *state = coils_at == 0 ? "unknown" : coils & (1 << (relay - 1)) ? "ON" : "OFF";
+        snprintf(chunk, sizeof(chunk),
+                 "<div>"
+                 "<h2>Relay %d</h2>"
+                 "<p class='%s'>%s%s</p>"
+                 "<button class='button' onclick=\"location.href='/relay%d/on'\" type=\"button\">ON</button>"
+                 "<button class='button' onclick=\"location.href='/relay%d/off'\" type=\"button\">OFF</button>"
+                 "</div>",
+                 relay, stale ? "stale" : "", state, coils_at != 0 && stale ? " (stale)" : "", relay, relay);
+        httpd_resp_send_chunk(req, chunk, HTTPD_RESP_USE_STRLEN);
+    }
+    httpd_resp_send_chunk(req, tail, HTTPD_RESP_USE_STRLEN);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+// Formats `count` bits of `bits` as a JSON array; `out` holds at least 2 * count + 2
+static void format_bits(char *out, uint16_t bits, int count) {
+    int len = 0;
+    out[len++] = '[';
+    for (int i = 0; i < count; i++) {
+        if (i) {
+            out[len++] = ',';
+        }
+        out[len++] = '0' + ((bits >> i) & 1);
+    }
+    out[len++] = ']';
+    out[len] = '\0';
+}
+
+// Cached state of every polled slave as JSON, ages in ms
+esp_err_t state_handler(httpd_req_t *req) {
+    char chunk[256];
+    char coils[40];
+    char inputs[40];
+    coil_cache_entry_t entry;
+    int64_t now = esp_timer_get_time();
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_send_chunk(req, "[", 1);
+    for (int i = 0; coil_cache_get(i, &entry); i++) {
+        format_bits(coils, entry.coils, CONFIG_MODBUS_POLL_COILS);
+        format_bits(inputs, entry.inputs, CONFIG_MODBUS_POLL_INPUTS);
+        snprintf(chunk, sizeof(chunk),
+                 "%s{\"address\":%d,\"coils\":%s,\"coils_age_ms\":%lld,\"coils_stale\":%s,"
+                 "\"inputs\":%s,\"inputs_age_ms\":%lld,\"inputs_stale\":%s,"
+                 "\"polls\":%" PRIu32 ",\"failures\":%" PRIu32 ",\"last_result\":\"%s\"}",
+                 i ? "," : "", entry.address,
+                 coils, entry.coils_at_us ? (now - entry.coils_at_us) / 1000 : -1LL,
+                 coil_cache_stale(entry.coils_at_us) ? "true" : "false",
+                 inputs, entry.inputs_at_us ? (now - entry.inputs_at_us) / 1000 : -1LL,
+                 coil_cache_stale(entry.inputs_at_us) ? "true" : "false",
+                 entry.polls, entry.failures, modbus_err_to_name(entry.last_err));
+        httpd_resp_send_chunk(req, chunk, HTTPD_RESP_USE_STRLEN);
+    }
+    httpd_resp_send_chunk(req, "]", 1);
+    return httpd_resp_send_chunk(req, NULL, 0);
 }
 
 void start_webserver(void) {
@@ -154,6 +244,22 @@ void start_webserver(void) {
             .user_ctx = NULL
         };
         httpd_register_uri_handler(server, &relay4_off);
+
+        httpd_uri_t command = {
+            .uri      = "/command",
+            .method   = HTTP_GET,
+            .handler  = command_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &command);
+
+        httpd_uri_t state = {
+            .uri      = "/state",
+            .method   = HTTP_GET,
+            .handler  = state_handler,
+            .user_ctx = NULL
+        };
+        httpd_register_uri_handler(server, &state);
     }
     if (server == NULL) {
         ESP_LOGE(TAG, "Failed to start the server");
@@ -166,5 +272,7 @@ void app_main(void) {
     ESP_ERROR_CHECK(wifi_connect_sta("yourssid", "yourpass", 10000));
 
     uart_init();
+    relay_queue_init();
+    coil_cache_init();
     start_webserver();
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#ifndef RELAY_REGMAP_H
+#define RELAY_REGMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Register map of the 4-relay Modbus module, shared by the slave firmware
+// (4_ESP32_as_modbus_4_relay_module) and the master
+// (mb_master_control_relay_module_esp_modbus). Edit the map here only.
+//
+// X(name, key, units, reg_type, start, size, data_type, data_size, min, max, step, access)
+//   reg_type   HOLDING, INPUT, COIL or DISCRETE
+//   start/size first register and register (or bit) count
+//   data_type  esp-modbus PARAM_TYPE_* suffix, data_size in bytes
+//   access     esp-modbus PAR_PERMS_* suffix
+// The slave also accepts 0xFF for DEV_ADDR, the factory default address.
+#define RELAY_REGMAP(X) \
+    X(DEV_ADDR,     "DEV_ADDR",     "ADDR",   HOLDING,  0x0000, 1, U16,   2, 1, 247, 1, READ_WRITE_TRIGGER) \
+    X(RELAY1_FLASH, "RELAY1_FLASH", "MODE",   HOLDING,  0x0003, 2, U32,   4, 0, 0,   0, WRITE_TRIGGER) \
+    X(RELAY2_FLASH, "RELAY2_FLASH", "MODE",   HOLDING,  0x0008, 2, U32,   4, 0, 0,   0, WRITE_TRIGGER) \
+    X(RELAY3_FLASH, "RELAY3_FLASH", "MODE",   HOLDING,  0x000D, 2, U32,   4, 0, 0,   0, WRITE_TRIGGER) \
+    X(RELAY4_FLASH, "RELAY4_FLASH", "MODE",   HOLDING,  0x0012, 2, U32,   4, 0, 0,   0, WRITE_TRIGGER) \
+    X(HARDWARE_VER, "HARDWARE_VER", "VER",    HOLDING,  0x0020, 1, U16,   2, 0, 0,   0, READ) \
+    X(SOFTWARE_VER, "SOFTWARE_VER", "VER",    HOLDING,  0x0021, 4, ASCII, 8, 0, 0,   0, READ) \
+    X(BAUD_RATE,    "BAUD_RATE",    "CODE",   HOLDING,  0x03E9, 1, U16,   2, 3, 4,   1, WRITE_TRIGGER) \
+    X(RELAY0,       "RELAY0",       "ON/OFF", COIL,     0x0000, 1, U8,    1, 0, 1,   0, READ_WRITE_TRIGGER) \
+    X(RELAY1,       "RELAY1",       "ON/OFF", COIL,     0x0001, 1, U8,    1, 0, 1,   0, READ_WRITE_TRIGGER) \
+    X(RELAY2,       "RELAY2",       "ON/OFF", COIL,     0x0002, 1, U8,    1, 0, 1,   0, READ_WRITE_TRIGGER) \
+    X(RELAY3,       "RELAY3",       "ON/OFF", COIL,     0x0003, 1, U8,    1, 0, 1,   0, READ_WRITE_TRIGGER) \
+    X(INPUT1,       "INPUT1",       "ON/OFF", DISCRETE, 0x0000, 1, U8,    1, 0, 1,   0, READ) \
+    X(INPUT2,       "INPUT2",       "ON/OFF", DISCRETE, 0x0001, 1, U8,    1, 0, 1,   0, READ) \
+    X(INPUT3,       "INPUT3",       "ON/OFF", DISCRETE, 0x0002, 1, U8,    1, 0, 1,   0, READ) \
+    X(INPUT4,       "INPUT4",       "ON/OFF", DISCRETE, 0x0003, 1, U8,    1, 0, 1,   0, READ) \
+    X(RELAY1_SWITCHES, "RELAY1_SWITCHES", "COUNT", INPUT, 0x0000, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY2_SWITCHES, "RELAY2_SWITCHES", "COUNT", INPUT, 0x0002, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY3_SWITCHES, "RELAY3_SWITCHES", "COUNT", INPUT, 0x0004, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY4_SWITCHES, "RELAY4_SWITCHES", "COUNT", INPUT, 0x0006, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY1_ON_TIME,  "RELAY1_ON_TIME",  "S",     INPUT, 0x0008, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY2_ON_TIME,  "RELAY2_ON_TIME",  "S",     INPUT, 0x000A, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY3_ON_TIME,  "RELAY3_ON_TIME",  "S",     INPUT, 0x000C, 2, U32, 4, 0, 0, 0, READ) \
+    X(RELAY4_ON_TIME,  "RELAY4_ON_TIME",  "S",     INPUT, 0x000E, 2, U32, 4, 0, 0, 0, READ)
+
+#define RELAY_MODULE_HARDWARE_VER   100         // V1.00
+#define RELAY_MODULE_SOFTWARE_VER   "V1.1.0"    // padded with NULs to 8 bytes
+
+// Characteristic IDs, in map order: RELAY_CID_DEV_ADDR, RELAY_CID_RELAY0, ...
+#define RELAY_REGMAP_CID(name, ...) RELAY_CID_##name,
+enum {
+    RELAY_REGMAP(RELAY_REGMAP_CID)
+    RELAY_CID_COUNT
+};
+
+// Parameter storage for the master, one byte array per characteristic.
+#define RELAY_REGMAP_FIELD(name, key, units, reg_type, start, size, data_type, data_size, ...) \
+    uint8_t name[data_size];
+typedef struct {
+    RELAY_REGMAP(RELAY_REGMAP_FIELD)
+} relay_regmap_values_t;
+
+// esp-modbus instance offsets are 1-based, 0 means "no instance".
+#define RELAY_REGMAP_OFFSET(name) ((uint16_t)(offsetof(relay_regmap_values_t, name) + 1))
+
+// Expands to one mb_parameter_descriptor_t initializer; needs mbcontroller.h.
+#define RELAY_REGMAP_DESCRIPTOR(slave_addr, name, key, units, reg_type, start, size, \
+                                data_type, data_size, min, max, step, access) \
+    { RELAY_CID_##name, key, units, slave_addr, MB_PARAM_##reg_type, start, size, \
+      RELAY_REGMAP_OFFSET(name), PARAM_TYPE_##data_type, data_size, OPTS(min, max, step), \
+      PAR_PERMS_##access },
+
+// Slave lookup tables. RELAY_REGMAP_ENTRY_<TYPE> expands only the rows of that type:
+//   static const relay_regmap_entry_t holding[] = { RELAY_REGMAP(RELAY_REGMAP_ENTRY_HOLDING) };
+#define RELAY_REGMAP_ACCESS_READ    0x01
+#define RELAY_REGMAP_ACCESS_WRITE   0x02
+
+typedef struct {
+    uint16_t start;
+    uint16_t size;
+    uint16_t min;       // accepted write values; min == max means no range
+    uint16_t max;
+    uint8_t cid;
+    uint8_t access;     // RELAY_REGMAP_ACCESS_*
+} relay_regmap_entry_t;
+
+#define RELAY_REGMAP_BITS_READ                  RELAY_REGMAP_ACCESS_READ
+#define RELAY_REGMAP_BITS_WRITE_TRIGGER         RELAY_REGMAP_ACCESS_WRITE
+#define RELAY_REGMAP_BITS_READ_WRITE_TRIGGER    (RELAY_REGMAP_ACCESS_READ | RELAY_REGMAP_ACCESS_WRITE)
+
+#define RELAY_REGMAP_ROW(name, start, size, min, max, access) \
+    { start, size, min, max, RELAY_CID_##name, RELAY_REGMAP_BITS_##access },
+#define RELAY_REGMAP_SKIP(name, start, size, min, max, access)
+
+#define RELAY_REGMAP_SELECT_HOLDING_HOLDING     RELAY_REGMAP_ROW
+#define RELAY_REGMAP_SELECT_HOLDING_INPUT       RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_HOLDING_COIL        RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_HOLDING_DISCRETE    RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_INPUT_HOLDING       RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_INPUT_INPUT         RELAY_REGMAP_ROW
+#define RELAY_REGMAP_SELECT_INPUT_COIL          RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_INPUT_DISCRETE      RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_COIL_HOLDING        RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_COIL_INPUT          RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_COIL_COIL           RELAY_REGMAP_ROW
+#define RELAY_REGMAP_SELECT_COIL_DISCRETE       RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_DISCRETE_HOLDING    RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_DISCRETE_INPUT      RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_DISCRETE_COIL       RELAY_REGMAP_SKIP
+#define RELAY_REGMAP_SELECT_DISCRETE_DISCRETE   RELAY_REGMAP_ROW
+
+#define RELAY_REGMAP_ENTRY_HOLDING(name, key, units, reg_type, start, size, \
+                                   data_type, data_size, min, max, step, access) \
+    RELAY_REGMAP_SELECT_HOLDING_##reg_type(name, start, size, min, max, access)
+#define RELAY_REGMAP_ENTRY_INPUT(name, key, units, reg_type, start, size, \
+                                   data_type, data_size, min, max, step, access) \
+    RELAY_REGMAP_SELECT_INPUT_##reg_type(name, start, size, min, max, access)
+#define RELAY_REGMAP_ENTRY_COIL(name, key, units, reg_type, start, size, \
+                                   data_type, data_size, min, max, step, access) \
+    RELAY_REGMAP_SELECT_COIL_##reg_type(name, start, size, min, max, access)
+#define RELAY_REGMAP_ENTRY_DISCRETE(name, key, units, reg_type, start, size, \
+                                   data_type, data_size, min, max, step, access) \
+    RELAY_REGMAP_SELECT_DISCRETE_##reg_type(name, start, size, min, max, access)
+
+// Number of coils and discrete inputs, for range checks
+#define RELAY_REGMAP_COUNT_COIL(name, key, units, reg_type, start, size, ...) \
+    + (RELAY_REGMAP_IS_##reg_type##_COIL * (size))
+#define RELAY_REGMAP_COUNT_DISCRETE(name, key, units, reg_type, start, size, ...) \
+    + (RELAY_REGMAP_IS_##reg_type##_DISCRETE * (size))
+#define RELAY_REGMAP_IS_HOLDING_COIL        0
+#define RELAY_REGMAP_IS_INPUT_COIL          0
+#define RELAY_REGMAP_IS_COIL_COIL           1
+#define RELAY_REGMAP_IS_DISCRETE_COIL       0
+#define RELAY_REGMAP_IS_HOLDING_DISCRETE    0
+#define RELAY_REGMAP_IS_INPUT_DISCRETE      0
+#define RELAY_REGMAP_IS_COIL_DISCRETE       0
+#define RELAY_REGMAP_IS_DISCRETE_DISCRETE   1
+
+#define RELAY_REGMAP_NUM_COILS      (0 RELAY_REGMAP(RELAY_REGMAP_COUNT_COIL))
+#define RELAY_REGMAP_NUM_DISCRETE   (0 RELAY_REGMAP(RELAY_REGMAP_COUNT_DISCRETE))
+
+#endif // RELAY_REGMAP_H
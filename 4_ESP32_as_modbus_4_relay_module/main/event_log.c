@@ -0,0 +1,116 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "event_log.h"
+
+typedef struct {
+    uint16_t seq;
+    uint8_t type;
+    uint8_t source;
+    uint16_t value;
+    uint32_t timestamp_ms;
+} EventRecord;
+
+static EventRecord s_events[EVENT_LOG_CAPACITY];
+static uint16_t s_oldest;       // ring index of the oldest retained event
+static uint16_t s_count;
+static uint16_t s_next_seq;
+static uint16_t s_lost;         // events overwritten before they were acknowledged
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void event_log_add(uint8_t type, uint8_t source, uint16_t value)
+{
+    uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+
+    // Called from the Modbus task, timer callbacks and the input poller.
+    portENTER_CRITICAL(&s_lock);
+    if (s_count == EVENT_LOG_CAPACITY) {
+        s_oldest = (s_oldest + 1) % EVENT_LOG_CAPACITY;
+        s_count--;
+        s_lost++;
+    }
+    EventRecord *ev = &s_events[(s_oldest + s_count) % EVENT_LOG_CAPACITY];
+    ev->seq = s_next_seq++;
+    // Skip the clear-all code, so acknowledging the last event never wipes newer ones
+    if (s_next_seq == EVENT_LOG_CLEAR_ALL) {
+        s_next_seq = 0;
+    }
+    ev->type = type;
+    ev->source = source;
+    ev->value = value;
+    ev->timestamp_ms = now_ms;
+    s_count++;
+    portEXIT_CRITICAL(&s_lock);
+}
+
+static uint16_t event_register(const EventRecord *ev, int reg)
+{
+    switch (reg) {
+        case 0: return ev->seq;
+        case 1: return (ev->type << 8) | ev->source;
+        case 2: return ev->value;
+        case 3: return ev->timestamp_ms >> 16;
+        default: return ev->timestamp_ms & 0xFFFF;
+    }
+}
+
+uint8_t event_log_read_file(uint16_t file, uint16_t record, uint16_t length, uint8_t *out)
+{
+    uint8_t exception = 0;
+
+    portENTER_CRITICAL(&s_lock);
+    if (file == EVENT_LOG_FILE_EVENTS) {
+        if ((uint32_t)record + length > (uint32_t)s_count * EVENT_LOG_RECORD_REGS) {
+            exception = 0x02;  // Illegal data address
+        } else {
+            for (uint16_t i = 0; i < length; i++) {
+                uint16_t reg = record + i;
+                const EventRecord *ev = &s_events[(s_oldest + reg / EVENT_LOG_RECORD_REGS) % EVENT_LOG_CAPACITY];
+                uint16_t value = event_register(ev, reg % EVENT_LOG_RECORD_REGS);
+                out[2 * i] = value >> 8;
+                out[2 * i + 1] = value & 0xFF;
+            }
+        }
+    } else if (file == EVENT_LOG_FILE_CONTROL) {
+        uint16_t control[4] = {
+            s_count,
+            s_count ? s_events[s_oldest].seq : s_next_seq,
+            s_lost,
+            EVENT_LOG_CAPACITY,
+        };
+        if ((uint32_t)record + length > 4) {
+            exception = 0x02;
+        } else {
+            for (uint16_t i = 0; i < length; i++) {
+                out[2 * i] = control[record + i] >> 8;
+                out[2 * i + 1] = control[record + i] & 0xFF;
+            }
+        }
+    } else {
+        exception = 0x02;
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return exception;
+}
+
+uint8_t event_log_write_file(uint16_t file, uint16_t record, uint16_t length, const uint8_t *data)
+{
+    if (file != EVENT_LOG_FILE_CONTROL || record != 0 || length != 1) {
+        return 0x02;  // Illegal data address
+    }
+    uint16_t ack_seq = (data[0] << 8) | data[1];
+
+    portENTER_CRITICAL(&s_lock);
+    if (ack_seq == EVENT_LOG_CLEAR_ALL) {
+        s_count = 0;
+        s_lost = 0;
+    } else {
+        // Sequence numbers wrap, so compare by signed distance.
+        while (s_count > 0 && (int16_t)(s_events[s_oldest].seq - ack_seq) <= 0) {
+            s_oldest = (s_oldest + 1) % EVENT_LOG_CAPACITY;
+            s_count--;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+    return 0;
+}
@@ -0,0 +1,43 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <stdint.h>
+
+// RAM ring of the most recent device events, readable over Modbus as file records.
+//
+// File 1 (events): each event is EVENT_LOG_RECORD_REGS registers, oldest retained event
+// first, so record number N is register N of that stream:
+//   reg 0   sequence number, 0 to 0xFFFE and around again (0xFFFF is never used)
+//   reg 1   type << 8 | source
+//   reg 2   value
+//   reg 3-4 timestamp, ms since boot
+//
+// File 2 (control), registers 0-3: retained count, oldest sequence number, events lost
+// to overwrite, capacity. Writing register 0 acknowledges every event up to and
+// including that sequence number; writing 0xFFFF clears the log.
+
+#define EVENT_LOG_FILE_EVENTS   1
+#define EVENT_LOG_FILE_CONTROL  2
+#define EVENT_LOG_RECORD_REGS   5
+#define EVENT_LOG_CAPACITY      256
+#define EVENT_LOG_CLEAR_ALL     0xFFFF
+
+// Event types, the source byte identifies the relay/input/error
+#define EVENT_BOOT              0x01
+#define EVENT_RELAY             0x02    // source = relay 1-4, value = 0/1
+#define EVENT_RELAY_FLASH       0x03    // source = relay 1-4, value = flash period in 0.1 s
+#define EVENT_INPUT             0x04    // source = input 1-4, value = 0/1
+#define EVENT_ERROR             0x05    // source = EVENT_ERR_*, value = detail
+
+#define EVENT_ERR_CRC           0x01
+#define EVENT_ERR_SHORT_FRAME   0x02
+#define EVENT_ERR_EXCEPTION     0x03    // value = function code << 8 | exception code
+
+void event_log_add(uint8_t type, uint8_t source, uint16_t value);
+
+// File record access, both return 0 or a Modbus exception code.
+// `out` receives `length` big-endian registers.
+uint8_t event_log_read_file(uint16_t file, uint16_t record, uint16_t length, uint8_t *out);
+uint8_t event_log_write_file(uint16_t file, uint16_t record, uint16_t length, const uint8_t *data);
+
+#endif // EVENT_LOG_H
@@ -6,14 +6,22 @@
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "esp_log.h"
+#include "esp_system.h"
 #include "nvs_flash.h"
 #include "nvs.h"
+#include "modbus_slave.h"
+#include "sniffer.h"
+#include "event_log.h"
+#include "relay_regmap.h"
+#include "relay_stats.h"
+#include "rs485_ota.h"
 
 #define MODBUS_UART_NUM UART_NUM_1
 #define MODBUS_TXD_PIN 6
 #define MODBUS_RXD_PIN 7
 //#define MODBUS_RTS_PIN 9
 #define MODBUS_SLAVE_ADDRESS 0xFF  // Default address, changed to 0xFF
+#define MODBUS_SNIFFER_MODE 0      // 1 = listen-only bus monitor, never transmits on RS485
 
 #define RELAY_1_PIN 2
 #define RELAY_2_PIN 3
@@ -26,22 +34,16 @@
 #define OPTOCOUPLER_4_PIN 13
 
 #define UART_BUF_SIZE 1024
+// Driver RX buffer: a whole firmware update window arrives back to back, and the
+// task may be held up by a flash sector erase while it does
+#define UART_RX_BUF_SIZE 8192
+_Static_assert(UART_RX_BUF_SIZE >= RS485_OTA_MAX_WINDOW * RS485_OTA_MAX_FRAME + 16,
+               "RX buffer too small for a firmware update window and its STATUS request");
+#define FILE_RECORD_REF_TYPE 0x06
+#define FILE_RECORD_MAX_DATA 0xF5  // Largest FC 0x14 response data length
 
 static const char *TAG = "modbus_slave";
 
-// Function prototypes
-void modbus_init(void);
-void modbus_task(void *pvParameters);
-uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length);
-void handle_modbus_request(uint8_t *request, int request_length);
-void set_relay(int relay_num, bool state);
-uint8_t read_relay_status(int relay_num);
-void set_device_address(uint8_t new_address);
-uint8_t get_device_address(void);
-uint8_t read_optocoupler_status(void);
-void set_baud_rate(uint8_t baud_rate_code);
-void set_relay_flashing_mode(uint8_t relay_num, uint16_t mode, uint16_t delay_time);
-
 // Global variables
 static uint8_t g_device_address = MODBUS_SLAVE_ADDRESS;
 static TimerHandle_t relay_timers[4] = {NULL};
@@ -51,9 +53,89 @@ typedef struct {
     bool flash_state;
 } RelayTimerParams;
 
+// Register layout comes from the shared schema in components/relay_regmap
+static const relay_regmap_entry_t holding_map[] = { RELAY_REGMAP(RELAY_REGMAP_ENTRY_HOLDING) };
+static const relay_regmap_entry_t input_map[] = { RELAY_REGMAP(RELAY_REGMAP_ENTRY_INPUT) };
+
+// FC 0x01/0x02 answer up to 8 bits, as the 8-channel firmware did; the unmapped ones read 0
+#define LEGACY_READ_BITS            8
+
+_Static_assert(RELAY_REGMAP_NUM_COILS == 4, "one coil per relay");
+_Static_assert(RELAY_REGMAP_NUM_DISCRETE == 4, "one discrete input per optocoupler");
+
+static const relay_regmap_entry_t *find_register(const relay_regmap_entry_t *map, int count, uint16_t address)
+{
+    for (int i = 0; i < count; i++) {
+        if (address >= map[i].start && address < map[i].start + map[i].size) {
+            return &map[i];
+        }
+    }
+    return NULL;
+}
+
+static const relay_regmap_entry_t *find_holding_register(uint16_t address)
+{
+    return find_register(holding_map, sizeof(holding_map) / sizeof(holding_map[0]), address);
+}
+
+static const relay_regmap_entry_t *find_input_register(uint16_t address)
+{
+    return find_register(input_map, sizeof(input_map) / sizeof(input_map[0]), address);
+}
+
+// Write values the map allows. DEV_ADDR also takes the factory default address,
+// so a master can reset a module to it.
+static bool holding_value_valid(uint8_t cid, uint16_t value)
+{
+    if (cid == RELAY_CID_DEV_ADDR && value == MODBUS_SLAVE_ADDRESS) {
+        return true;
+    }
+    for (int i = 0; i < sizeof(holding_map) / sizeof(holding_map[0]); i++) {
+        const relay_regmap_entry_t *entry = &holding_map[i];
+        if (entry->cid == cid) {
+            return entry->min == entry->max || (value >= entry->min && value <= entry->max);
+        }
+    }
+    return false;
+}
+
+static uint16_t read_holding_register(uint8_t cid, uint16_t offset)
+{
+    static const char software_ver[8] = RELAY_MODULE_SOFTWARE_VER;
+
+    switch (cid) {
+        case RELAY_CID_DEV_ADDR:
+            return g_device_address;
+        case RELAY_CID_HARDWARE_VER:
+            return RELAY_MODULE_HARDWARE_VER;
+        case RELAY_CID_SOFTWARE_VER:
+            return (software_ver[2 * offset] << 8) | software_ver[2 * offset + 1];
+        default:
+            return 0;
+    }
+}
+
+// Relay statistics, 32-bit values high word first
+static uint16_t read_input_register(uint8_t cid, uint16_t offset)
+{
+    uint32_t switch_count, on_time_s, value;
+
+    if (cid >= RELAY_CID_RELAY1_SWITCHES && cid <= RELAY_CID_RELAY4_SWITCHES) {
+        relay_stats_get(cid - RELAY_CID_RELAY1_SWITCHES + 1, &switch_count, &on_time_s);
+        value = switch_count;
+    } else if (cid >= RELAY_CID_RELAY1_ON_TIME && cid <= RELAY_CID_RELAY4_ON_TIME) {
+        relay_stats_get(cid - RELAY_CID_RELAY1_ON_TIME + 1, &switch_count, &on_time_s);
+        value = on_time_s;
+    } else {
+        return 0;
+    }
+    return offset == 0 ? value >> 16 : value & 0xFFFF;
+}
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "Starting Modbus Slave application");
+    event_log_add(EVENT_BOOT, esp_reset_reason(), 0);
 
     // Initialize NVS
     esp_err_t ret = nvs_flash_init();
@@ -63,6 +145,9 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    // Before the relay GPIOs are touched, so no transition goes uncounted
+    ESP_ERROR_CHECK(relay_stats_init());
+
     // Load device address and baud rate from NVS
     nvs_handle_t my_handle;
     ret = nvs_open("storage", NVS_READWRITE, &my_handle);
@@ -100,6 +185,17 @@ void app_main(void)
 
     ESP_LOGI(TAG, "GPIO pins initialized for relays and optocouplers");
 
+#if MODBUS_SNIFFER_MODE
+    uint32_t sniff_baud_rate = 9600;
+    ret = nvs_open("storage", NVS_READONLY, &my_handle);
+    if (ret == ESP_OK) {
+        nvs_get_u32(my_handle, "baud_rate", &sniff_baud_rate);
+        nvs_close(my_handle);
+    }
+    ESP_ERROR_CHECK(sniffer_start(MODBUS_UART_NUM, MODBUS_RXD_PIN, sniff_baud_rate));
+    return;
+#endif
+
     // Initialize Modbus
     modbus_init();
 
@@ -119,7 +215,7 @@ void modbus_init(void)
         .source_clk = UART_SCLK_APB,
     };
 
-    ESP_ERROR_CHECK(uart_driver_install(MODBUS_UART_NUM, UART_BUF_SIZE * 2, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(MODBUS_UART_NUM, UART_RX_BUF_SIZE, 0, 0, NULL, 0));
     ESP_ERROR_CHECK(uart_param_config(MODBUS_UART_NUM, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(MODBUS_UART_NUM, MODBUS_TXD_PIN, MODBUS_RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
@@ -129,19 +225,119 @@ void modbus_init(void)
     ESP_LOGI(TAG, "Modbus UART initialized");
 }
 
+// Expected RTU request length from its first bytes: 0 = need more bytes, -1 = unknown
+static int predict_frame_length(const uint8_t *frame, int length)
+{
+    if (length < 2) {
+        return 0;
+    }
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+            return 8;
+        case 0x0F: case 0x10:
+            return length < 7 ? 0 : 9 + frame[6];
+        case 0x14: case 0x15:
+            return length < 3 ? 0 : 5 + frame[2];
+        case RS485_OTA_FUNCTION_CODE:
+            return rs485_ota_frame_length(frame, length);
+        default:
+            return -1;
+    }
+}
+
+// The same for another slave's reply to the master
+static int predict_reply_length(const uint8_t *frame, int length)
+{
+    if (length < 3) {
+        return 0;
+    }
+    if (frame[1] & 0x80) {
+        return 5;  // Exception
+    }
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x14: case 0x15:
+            return 5 + frame[2];
+        case 0x05: case 0x06: case 0x0F: case 0x10:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+static bool frame_crc_ok(uint8_t *frame, int length)
+{
+    return length >= 4 && modbus_crc16(frame, length - 2) == ((frame[length - 2] << 8) | frame[length - 1]);
+}
+
 void modbus_task(void *pvParameters)
 {
     uint8_t* data = (uint8_t*) malloc(UART_BUF_SIZE);
+    int buffered = 0;
+    uint8_t reply_from = 0;     // slave whose reply to the master comes next, 0 = none
+    uint8_t last_inputs = read_optocoupler_status();
 
     ESP_LOGI(TAG, "Modbus task started");
 
     while (1) {
-        int len = uart_read_bytes(MODBUS_UART_NUM, data, UART_BUF_SIZE, 20 / portTICK_RATE_MS);
+        int len = uart_read_bytes(MODBUS_UART_NUM, data + buffered, UART_BUF_SIZE - buffered, 20 / portTICK_RATE_MS);
         if (len > 0) {
-            ESP_LOGI(TAG, "Received %d bytes", len);
-            ESP_LOG_BUFFER_HEX(TAG, data, len);
-            handle_modbus_request(data, len);
+            buffered += len;
         }
+
+        // Split the buffer by predicted frame length, so frames streamed back to back
+        // (firmware update chunks) do not need an inter-frame gap. Anything that cannot
+        // be predicted is handed over as one frame once the line goes idle.
+        // A request to another slave is followed by that slave's reply, which has a
+        // layout of its own; the CRC tells when the reply never came.
+        bool idle = len <= 0 || buffered == UART_BUF_SIZE;
+        int consumed = 0;
+        while (consumed < buffered) {
+            uint8_t *frame = data + consumed;
+            int available = buffered - consumed;
+            int frame_length = -1;
+            if (reply_from != 0 && frame[0] == reply_from) {
+                int reply_length = predict_reply_length(frame, available);
+                if (reply_length > 0 && reply_length <= available && frame_crc_ok(frame, reply_length)) {
+                    reply_from = 0;
+                    consumed += reply_length;
+                    continue;
+                }
+                if (!idle && (reply_length == 0 || reply_length > available)) {
+                    break;
+                }
+            }
+            reply_from = 0;
+            frame_length = predict_frame_length(frame, available);
+            if (frame_length <= 0 || frame_length > 256 || frame_length > available) {
+                if (!idle) {
+                    break;
+                }
+                frame_length = buffered - consumed;
+            }
+            if (data[consumed + 1] != RS485_OTA_FUNCTION_CODE) {
+                ESP_LOGI(TAG, "Received %d bytes", frame_length);
+                ESP_LOG_BUFFER_HEX(TAG, data + consumed, frame_length);
+            }
+            if (frame[0] != 0x00 && frame[0] != g_device_address) {
+                reply_from = frame[0];
+            }
+            handle_modbus_request(data + consumed, frame_length);
+            consumed += frame_length;
+        }
+        if (consumed > 0) {
+            buffered -= consumed;
+            memmove(data, data + consumed, buffered);
+        }
+
+        // Log optocoupler edges, sampled at the read timeout rate
+        uint8_t inputs = read_optocoupler_status();
+        uint8_t changed = inputs ^ last_inputs;
+        for (int i = 0; i < 4; i++) {
+            if (changed & (1 << i)) {
+                event_log_add(EVENT_INPUT, i + 1, (inputs >> i) & 1);
+            }
+        }
+        last_inputs = inputs;
     }
     free(data);
 }
@@ -168,8 +364,10 @@ uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length)
 
 void handle_modbus_request(uint8_t *request, int request_length)
 {
-    if (request_length < 8) {
+    // Firmware update status/abort frames are the only ones shorter than 8 bytes
+    if (request_length < 5 || (request[1] != RS485_OTA_FUNCTION_CODE && request_length < 8)) {
         ESP_LOGW(TAG, "Received frame too short");
+        event_log_add(EVENT_ERROR, EVENT_ERR_SHORT_FRAME, request_length);
         return;
     }
 
@@ -180,11 +378,14 @@ void handle_modbus_request(uint8_t *request, int request_length)
 
     uint16_t calculated_crc = modbus_crc16(request, request_length - 2);
 
-    ESP_LOGI(TAG, "Slave Address: 0x%02X, Function Code: 0x%02X, Start Address: %d", slave_address, function_code, start_address);
-    ESP_LOGI(TAG, "Received CRC: 0x%04X, Calculated CRC: 0x%04X", received_crc, calculated_crc);
+    if (function_code != RS485_OTA_FUNCTION_CODE) {
+        ESP_LOGI(TAG, "Slave Address: 0x%02X, Function Code: 0x%02X, Start Address: %d", slave_address, function_code, start_address);
+        ESP_LOGI(TAG, "Received CRC: 0x%04X, Calculated CRC: 0x%04X", received_crc, calculated_crc);
+    }
 
     if (received_crc != calculated_crc) {
         ESP_LOGW(TAG, "CRC error");
+        event_log_add(EVENT_ERROR, EVENT_ERR_CRC, function_code);
         return;
     }
 
@@ -204,15 +405,15 @@ void handle_modbus_request(uint8_t *request, int request_length)
         case 0x01:  // Read Coils (Read relay status)
             {
                 uint16_t quantity = (request[4] << 8) | request[5];
-                if (start_address + quantity > 8) {
+                if (quantity == 0 || start_address + quantity > LEGACY_READ_BITS) {
                     response[1] |= 0x80;
                     response[2] = 0x02;  // Illegal data address
                     response_length = 3;
                 } else {
                     response[2] = 1;  // Byte count
                     response[3] = 0;
-                    for (int i = 0; i < 8; i++) {
-                        if (read_relay_status(i)) {
+                    for (int i = 0; i < quantity && start_address + i < RELAY_REGMAP_NUM_COILS; i++) {
+                        if (read_relay_status(start_address + i)) {
                             response[3] |= (1 << i);
                         }
                     }
@@ -224,35 +425,76 @@ void handle_modbus_request(uint8_t *request, int request_length)
         case 0x02:  // Read Discrete Inputs (Read optocoupler input status)
             {
                 uint16_t quantity = (request[4] << 8) | request[5];
-                if (start_address + quantity > 8) {
+                if (quantity == 0 || start_address + quantity > LEGACY_READ_BITS) {
                     response[1] |= 0x80;
                     response[2] = 0x02;  // Illegal data address
                     response_length = 3;
                 } else {
                     response[2] = 1;  // Byte count
-                    response[3] = read_optocoupler_status();
+                    response[3] = (read_optocoupler_status() >> start_address) & ((1 << quantity) - 1);
                     response_length = 4;
                 }
             }
             break;
 
-        case 0x03:  // Read Holding Registers (Read device address)
-            if (start_address == 0x0000 && ((request[4] << 8) | request[5]) == 0x0001) {
-                response[2] = 2;  // Byte count
-                response[3] = 0x00;
-                response[4] = g_device_address;
-                response_length = 5;
-            } else {
-                response[1] |= 0x80;
-                response[2] = 0x02;  // Illegal data address
-                response_length = 3;
+        case 0x03:  // Read Holding Registers (Device address, versions)
+            {
+                uint16_t quantity = (request[4] << 8) | request[5];
+                if (quantity == 0 || quantity > 125) {
+                    response[1] |= 0x80;
+                    response[2] = 0x03;  // Illegal data value
+                    response_length = 3;
+                    break;
+                }
+                response[2] = quantity * 2;  // Byte count
+                response_length = 3 + quantity * 2;
+                for (int i = 0; i < quantity; i++) {
+                    uint16_t address = start_address + i;
+                    const relay_regmap_entry_t *entry = find_holding_register(address);
+                    if (entry == NULL || !(entry->access & RELAY_REGMAP_ACCESS_READ)) {
+                        response[1] |= 0x80;
+                        response[2] = 0x02;  // Illegal data address
+                        response_length = 3;
+                        break;
+                    }
+                    uint16_t value = read_holding_register(entry->cid, address - entry->start);
+                    response[3 + 2 * i] = value >> 8;
+                    response[4 + 2 * i] = value & 0xFF;
+                }
+            }
+            break;
+
+        case 0x04:  // Read Input Registers (Relay statistics)
+            {
+                uint16_t quantity = (request[4] << 8) | request[5];
+                if (quantity == 0 || quantity > 125) {
+                    response[1] |= 0x80;
+                    response[2] = 0x03;  // Illegal data value
+                    response_length = 3;
+                    break;
+                }
+                response[2] = quantity * 2;  // Byte count
+                response_length = 3 + quantity * 2;
+                for (int i = 0; i < quantity; i++) {
+                    uint16_t address = start_address + i;
+                    const relay_regmap_entry_t *entry = find_input_register(address);
+                    if (entry == NULL) {
+                        response[1] |= 0x80;
+                        response[2] = 0x02;  // Illegal data address
+                        response_length = 3;
+                        break;
+                    }
+                    uint16_t value = read_input_register(entry->cid, address - entry->start);
+                    response[3 + 2 * i] = value >> 8;
+                    response[4 + 2 * i] = value & 0xFF;
+                }
             }
             break;
 
         case 0x05:  // Write Single Coil (Control single relay)
             {
                 uint16_t coil_value = (request[4] << 8) | request[5];
-                if (start_address <= 3) {
+                if (start_address < RELAY_REGMAP_NUM_COILS) {
                     if (coil_value == 0xFF00) {
                         set_relay(start_address + 1, true);
                     } else if (coil_value == 0x0000) {
@@ -280,9 +522,12 @@ void handle_modbus_request(uint8_t *request, int request_length)
                 uint8_t byte_count = request[6];
                 uint8_t coil_value = request[7];
 
-                if (start_coil == 0 && quantity == 8 && byte_count == 1) {
-                    for (int i = 0; i < 4; i++) {
-                        set_relay(i + 1, coil_value & (1 << i));
+                // Quantity 8 from coil 0 is kept for masters written for the 8-channel module.
+                bool legacy_all = start_coil == 0 && quantity == 8;
+                if (byte_count == 1 && quantity > 0 &&
+                    (legacy_all || start_coil + quantity <= RELAY_REGMAP_NUM_COILS)) {
+                    for (int i = 0; i < quantity && start_coil + i < RELAY_REGMAP_NUM_COILS; i++) {
+                        set_relay(start_coil + i + 1, coil_value & (1 << i));
                     }
                     memcpy(response + 2, request + 2, 4);  // Echo back start address and quantity
                     response_length = 6;
@@ -299,33 +544,142 @@ void handle_modbus_request(uint8_t *request, int request_length)
                 uint16_t start_register = (request[2] << 8) | request[3];
                 uint16_t quantity = (request[4] << 8) | request[5];
                 uint8_t byte_count = request[6];
+                const relay_regmap_entry_t *entry = find_holding_register(start_register);
 
-                if (start_register == 0x0000 && quantity == 0x0001 && byte_count == 0x02) {
-                    // Set device address
-                    uint8_t new_address = request[8];
-                    set_device_address(new_address);
-                    memcpy(response + 2, request + 2, 4);  // Echo back start address and quantity
-                    response_length = 6;
-                } else if (start_register == 0x03E9 && quantity == 0x0001 && byte_count == 0x02) {
-                    // Set baud rate
-                    uint8_t baud_rate_code = request[8];
-                    set_baud_rate(baud_rate_code);
-                    memcpy(response + 2, request + 2, 4);  // Echo back start address and quantity
-                    response_length = 6;
-                } else if ((start_register == 0x0003 || start_register == 0x0008 || 
-                            start_register == 0x000D || start_register == 0x0012) && 
-                           quantity == 0x0002 && byte_count == 0x04) {
-                    // Set relay flashing mode
-                    uint8_t relay_num = (start_register - 0x0003) / 5 + 1;
-                    uint16_t mode = (request[7] << 8) | request[8];
-                    uint16_t delay_time = (request[9] << 8) | request[10];
-                    set_relay_flashing_mode(relay_num, mode, delay_time);                    
-                    memcpy(response + 2, request + 2, 4);  // Echo back start address and quantity
-                    response_length = 6;
-                } else {
+                if (entry == NULL || entry->start != start_register || entry->size != quantity ||
+                    !(entry->access & RELAY_REGMAP_ACCESS_WRITE) || byte_count != quantity * 2 ||
+                    7 + byte_count + 2 > request_length) {
                     response[1] |= 0x80;
                     response[2] = 0x02;  // Illegal data address
                     response_length = 3;
+                    break;
+                }
+                uint16_t value = (request[7] << 8) | request[8];
+                if (!holding_value_valid(entry->cid, value)) {
+                    response[1] |= 0x80;
+                    response[2] = 0x03;  // Illegal data value
+                    response_length = 3;
+                    break;
+                }
+
+                switch (entry->cid) {
+                    case RELAY_CID_DEV_ADDR:
+                        set_device_address(request[8]);
+                        break;
+                    case RELAY_CID_BAUD_RATE:
+                        set_baud_rate(request[8]);
+                        break;
+                    case RELAY_CID_RELAY1_FLASH:
+                    case RELAY_CID_RELAY2_FLASH:
+                    case RELAY_CID_RELAY3_FLASH:
+                    case RELAY_CID_RELAY4_FLASH:
+                        {
+                            uint8_t relay_num = entry->cid - RELAY_CID_RELAY1_FLASH + 1;
+                            uint16_t mode = (request[7] << 8) | request[8];
+                            uint16_t delay_time = (request[9] << 8) | request[10];
+                            set_relay_flashing_mode(relay_num, mode, delay_time);
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                memcpy(response + 2, request + 2, 4);  // Echo back start address and quantity
+                response_length = 6;
+            }
+            break;
+
+        case 0x14:  // Read File Record (Event log)
+            {
+                uint8_t byte_count = request[2];
+                int resp_data_len = 0;
+
+                if (byte_count < 7 || byte_count % 7 != 0 || 3 + byte_count + 2 > request_length) {
+                    response[1] |= 0x80;
+                    response[2] = 0x03;  // Illegal data value
+                    response_length = 3;
+                    break;
+                }
+                for (int i = 0; i < byte_count; i += 7) {
+                    const uint8_t *sub = request + 3 + i;
+                    uint16_t file_number = (sub[1] << 8) | sub[2];
+                    uint16_t record_number = (sub[3] << 8) | sub[4];
+                    uint16_t record_length = (sub[5] << 8) | sub[6];
+                    uint8_t exception = 0;
+
+                    if (sub[0] != FILE_RECORD_REF_TYPE || record_length == 0 ||
+                        resp_data_len + 2 + record_length * 2 > FILE_RECORD_MAX_DATA) {
+                        exception = 0x02;
+                    } else {
+                        exception = event_log_read_file(file_number, record_number, record_length,
+                                                        response + 3 + resp_data_len + 2);
+                    }
+                    if (exception) {
+                        response[1] |= 0x80;
+                        response[2] = exception;
+                        response_length = 3;
+                        break;
+                    }
+                    response[3 + resp_data_len] = 1 + record_length * 2;  // File response length
+                    response[3 + resp_data_len + 1] = FILE_RECORD_REF_TYPE;
+                    resp_data_len += 2 + record_length * 2;
+                }
+                if (response_length == 0) {
+                    response[2] = resp_data_len;
+                    response_length = 3 + resp_data_len;
+                }
+            }
+            break;
+
+        case 0x15:  // Write File Record (Event log acknowledge/clear)
+            {
+                uint8_t data_len = request[2];
+                int offset = 0;
+
+                if (data_len < 9 || data_len > 0xFB || 3 + data_len + 2 > request_length) {
+                    response[1] |= 0x80;
+                    response[2] = 0x03;  // Illegal data value
+                    response_length = 3;
+                    break;
+                }
+                while (offset < data_len) {
+                    const uint8_t *sub = request + 3 + offset;
+                    uint16_t file_number = (sub[1] << 8) | sub[2];
+                    uint16_t record_number = (sub[3] << 8) | sub[4];
+                    uint16_t record_length = (sub[5] << 8) | sub[6];
+                    uint8_t exception = 0;
+
+                    if (sub[0] != FILE_RECORD_REF_TYPE || offset + 7 + record_length * 2 > data_len) {
+                        exception = 0x03;
+                    } else {
+                        exception = event_log_write_file(file_number, record_number, record_length, sub + 7);
+                    }
+                    if (exception) {
+                        response[1] |= 0x80;
+                        response[2] = exception;
+                        response_length = 3;
+                        break;
+                    }
+                    offset += 7 + record_length * 2;
+                }
+                if (response_length == 0) {
+                    memcpy(response + 2, request + 2, 1 + data_len);  // Echo the request
+                    response_length = 3 + data_len;
+                }
+            }
+            break;
+
+        case RS485_OTA_FUNCTION_CODE:  // Firmware update
+            {
+                int data_length = 0;
+                uint8_t exception = rs485_ota_request(request + 2, request_length - 4, response + 2, &data_length);
+                if (exception) {
+                    response[1] |= 0x80;
+                    response[2] = exception;
+                    response_length = 3;
+                } else if (data_length == 0) {
+                    return;  // Streamed chunk, never answered
+                } else {
+                    response_length = 2 + data_length;
                 }
             }
             break;
@@ -338,6 +692,10 @@ void handle_modbus_request(uint8_t *request, int request_length)
             break;
     }
 
+    if (response[1] & 0x80) {
+        event_log_add(EVENT_ERROR, EVENT_ERR_EXCEPTION, (function_code << 8) | response[2]);
+    }
+
   
     uint16_t response_crc = modbus_crc16(response, response_length);
     response[response_length] = response_crc >> 8;
@@ -349,22 +707,31 @@ void handle_modbus_request(uint8_t *request, int request_length)
     
 }
 
-void set_relay(int relay_num, bool state)
+// Drives the relay output only. Flashing timers use this directly so that
+// every blink does not end up in the event log.
+static void drive_relay(int relay_num, bool state)
 {
-    if (relay_num < 1 || relay_num > 4) {
-        ESP_LOGW(TAG, "Invalid relay number: %d", relay_num);
-        return;
-    }
-
     gpio_num_t relay_pin;
     switch (relay_num) {
         case 1: relay_pin = RELAY_1_PIN; break;
         case 2: relay_pin = RELAY_2_PIN; break;
         case 3: relay_pin = RELAY_3_PIN; break;
         case 4: relay_pin = RELAY_4_PIN; break;
-        default: return;  // This should never happen due to the check above
+        default: return;
     }
     gpio_set_level(relay_pin, state ? 1 : 0);
+    relay_stats_relay_driven(relay_num, state);
+}
+
+void set_relay(int relay_num, bool state)
+{
+    if (relay_num < 1 || relay_num > 4) {
+        ESP_LOGW(TAG, "Invalid relay number: %d", relay_num);
+        return;
+    }
+
+    drive_relay(relay_num, state);
+    event_log_add(EVENT_RELAY, relay_num, state ? 1 : 0);
     ESP_LOGI(TAG, "Relay %d set to %s", relay_num, state ? "ON" : "OFF");
 }
 
@@ -388,7 +755,7 @@ uint8_t read_relay_status(int relay_num)
 
 void set_device_address(uint8_t new_address)
 {
-    if ((new_address >= 1 && new_address <= 247) || new_address == 0xFF) {
+    if (holding_value_valid(RELAY_CID_DEV_ADDR, new_address)) {
         g_device_address = new_address;
         
         // Save the new address to NVS
@@ -464,7 +831,7 @@ void relay_timer_callback(TimerHandle_t xTimer)
 {
     RelayTimerParams *params = (RelayTimerParams*)pvTimerGetTimerID(xTimer);
     params->flash_state = !params->flash_state;
-    set_relay(params->relay_num, params->flash_state);
+    drive_relay(params->relay_num, params->flash_state);
     ESP_LOGI(TAG, "Relay %d set to %s", params->relay_num, params->flash_state ? "ON" : "OFF");
 }
 
@@ -509,6 +876,7 @@ void set_relay_flashing_mode(uint8_t relay_num, uint16_t mode, uint16_t delay_ti
     
     // Set initial state based on mode
     set_relay(relay_num, params->flash_state);
+    event_log_add(EVENT_RELAY_FLASH, relay_num, delay_time);
     
     if (xTimerStart(relay_timers[relay_num - 1], 0) != pdPASS) {
         ESP_LOGE(TAG, "Failed to start timer for relay %d", relay_num);
@@ -0,0 +1,66 @@
+#ifndef MB_CAPTURE_H
+#define MB_CAPTURE_H
+
+#include <stdint.h>
+
+// Compact binary capture stream written by the bus sniffer.
+// Every record is a fixed 14-byte header followed by `length` payload bytes.
+// All multi-byte fields are little-endian.
+//
+// A capture file is an mb_capture_file_header_t followed by records, appended in
+// time order. The live sniffer stream carries records only; the host prepends the
+// file header when it saves the stream (tools/mbcap.py).
+
+#define MB_CAPTURE_SYNC             0xA5
+#define MB_CAPTURE_VERSION          1
+#define MB_CAPTURE_MAGIC            "MBCP"
+
+// Record types
+#define MB_CAPTURE_TYPE_FRAME       0x00    // payload is the raw ADU (RTU with CRC, or MBAP for TCP)
+#define MB_CAPTURE_TYPE_STATS       0x01    // payload is mb_capture_bus_stats_t + N x mb_capture_slave_stats_t
+
+// Frame flags
+#define MB_CAPTURE_FLAG_RESPONSE    0x01    // slave -> master direction, reply to the previous request
+#define MB_CAPTURE_FLAG_CRC_ERROR   0x02
+#define MB_CAPTURE_FLAG_EXCEPTION   0x04    // function code has bit 7 set
+#define MB_CAPTURE_FLAG_TRUNCATED   0x08    // frame exceeded the maximum ADU size
+#define MB_CAPTURE_FLAG_TCP         0x10    // payload is an MBAP-framed Modbus TCP ADU
+
+typedef struct __attribute__((packed)) {
+    char     magic[4];      // MB_CAPTURE_MAGIC
+    uint8_t  version;       // MB_CAPTURE_VERSION
+    uint8_t  reserved[3];
+} mb_capture_file_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  sync;          // MB_CAPTURE_SYNC
+    uint8_t  type;          // MB_CAPTURE_TYPE_*
+    uint8_t  flags;         // MB_CAPTURE_FLAG_*
+    uint8_t  unit_id;       // RTU address or MBAP unit ID, 0 for stats records
+    uint16_t length;        // payload bytes following this header
+    uint32_t timestamp_us;  // end of frame on the wire, low 32 bits of esp_timer
+    uint32_t gap_us;        // bus idle time before the first byte of this frame
+} mb_capture_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t period_ms;     // length of the statistics window
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t busy_us;       // time the line carried data in this window
+    uint32_t crc_errors;    // frames that could not be attributed to a slave
+    uint32_t dropped;       // capture records lost because the stream was full
+} mb_capture_bus_stats_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  unit_id;
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t exceptions;
+    uint32_t timeouts;
+    uint32_t crc_errors;
+    uint32_t rt_min_us;     // response time: end of request to start of response
+    uint32_t rt_max_us;
+    uint32_t rt_avg_us;
+} mb_capture_slave_stats_t;
+
+#endif // MB_CAPTURE_H
@@ -0,0 +1,20 @@
+#ifndef MODBUS_SLAVE_H
+#define MODBUS_SLAVE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Functions implemented in main.c and shared with the other modules of the slave.
+void modbus_init(void);
+void modbus_task(void *pvParameters);
+uint16_t modbus_crc16(uint8_t *buffer, uint16_t buffer_length);
+void handle_modbus_request(uint8_t *request, int request_length);
+void set_relay(int relay_num, bool state);
+uint8_t read_relay_status(int relay_num);
+void set_device_address(uint8_t new_address);
+uint8_t get_device_address(void);
+uint8_t read_optocoupler_status(void);
+void set_baud_rate(uint8_t baud_rate_code);
+void set_relay_flashing_mode(uint8_t relay_num, uint16_t mode, uint16_t delay_time);
+
+#endif // MODBUS_SLAVE_H
@@ -0,0 +1,269 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "relay_stats.h"
+
+#define JOURNAL_PARTITION_LABEL "relaystat"
+#define JOURNAL_PARTITION_SUBTYPE 0x40
+#define JOURNAL_SECTOR_SIZE     4096
+#define JOURNAL_MAGIC           0x52535431  // "RST1"
+#define RTC_MAGIC               0x52535452  // "RSTR"
+
+static const char *TAG = "relay_stats";
+
+typedef struct {
+    uint32_t switch_count[RELAY_STATS_NUM_RELAYS];
+    uint64_t on_time_ms[RELAY_STATS_NUM_RELAYS];
+} RelayCounters;
+
+// One journal slot, 64 bytes so that a sector holds a whole number of entries.
+// An erased slot reads back as all 0xFF, which never matches JOURNAL_MAGIC.
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    RelayCounters counters;
+    uint8_t reserved[64 - 8 - sizeof(RelayCounters) - 4];
+    uint32_t crc;
+} JournalEntry;
+
+_Static_assert(sizeof(JournalEntry) == 64, "journal entry must stay 64 bytes");
+_Static_assert(JOURNAL_SECTOR_SIZE % sizeof(JournalEntry) == 0, "entries must not span sectors");
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;               // journal sequence the counters were last saved under
+    RelayCounters counters;
+    uint32_t crc;
+} RtcState;
+
+// Survives software resets and panics, garbage after power-up (caught by the CRC)
+static RTC_NOINIT_ATTR RtcState s_rtc;
+
+static int64_t s_on_since_us[RELAY_STATS_NUM_RELAYS];     // 0 = relay off
+static bool s_dirty;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const esp_partition_t *s_partition;
+static uint32_t s_next_slot;    // slot index the next entry goes to
+static uint32_t s_num_slots;
+static uint32_t s_seq;
+
+static uint32_t rtc_crc(void)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)&s_rtc, offsetof(RtcState, crc));
+}
+
+static uint32_t entry_crc(const JournalEntry *entry)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)entry, offsetof(JournalEntry, crc));
+}
+
+// Folds the running on periods into the counters. Caller holds s_lock.
+static void accumulate_on_time(int64_t now_us)
+{
+    for (int i = 0; i < RELAY_STATS_NUM_RELAYS; i++) {
+        if (s_on_since_us[i]) {
+            s_rtc.counters.on_time_ms[i] += (now_us - s_on_since_us[i]) / 1000;
+            s_on_since_us[i] = now_us - (now_us - s_on_since_us[i]) % 1000;
+        }
+    }
+}
+
+// Finds the newest valid entry and the slot after it.
+static bool journal_scan(JournalEntry *latest)
+{
+    bool found = false;
+    uint32_t latest_slot = 0;
+    JournalEntry entry;
+
+    for (uint32_t slot = 0; slot < s_num_slots; slot++) {
+        if (esp_partition_read(s_partition, slot * sizeof(entry), &entry, sizeof(entry)) != ESP_OK) {
+            continue;
+        }
+        if (entry.magic != JOURNAL_MAGIC || entry.crc != entry_crc(&entry)) {
+            continue;
+        }
+        if (!found || (int32_t)(entry.seq - latest->seq) > 0) {
+            *latest = entry;
+            latest_slot = slot;
+            found = true;
+        }
+    }
+    s_next_slot = found ? (latest_slot + 1) % s_num_slots : 0;
+    return found;
+}
+
+static bool slot_is_blank(uint32_t slot)
+{
+    uint32_t words[sizeof(JournalEntry) / 4];
+
+    if (esp_partition_read(s_partition, slot * sizeof(JournalEntry), words, sizeof(words)) != ESP_OK) {
+        return false;
+    }
+    for (int i = 0; i < sizeof(words) / 4; i++) {
+        if (words[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static esp_err_t journal_append(const RelayCounters *counters, uint32_t seq)
+{
+    JournalEntry entry;
+
+    // A write torn by a power loss leaves a programmed but invalid slot behind;
+    // skip to the next sector rather than program over it.
+    while ((s_next_slot * sizeof(entry)) % JOURNAL_SECTOR_SIZE != 0 && !slot_is_blank(s_next_slot)) {
+        s_next_slot = (s_next_slot + 1) % s_num_slots;
+    }
+    uint32_t offset = s_next_slot * sizeof(entry);
+
+    // Entering a sector: erase it first. The previous sectors keep older entries,
+    // so an interrupted erase or write never loses the last good snapshot.
+    if (offset % JOURNAL_SECTOR_SIZE == 0) {
+        esp_err_t err = esp_partition_erase_range(s_partition, offset, JOURNAL_SECTOR_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    entry.magic = JOURNAL_MAGIC;
+    entry.seq = seq;
+    entry.counters = *counters;
+    entry.crc = entry_crc(&entry);
+
+    esp_err_t err = esp_partition_write(s_partition, offset, &entry, sizeof(entry));
+    if (err == ESP_OK) {
+        s_next_slot = (s_next_slot + 1) % s_num_slots;
+    }
+    return err;
+}
+
+static void relay_stats_task(void *pvParameters)
+{
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(RELAY_STATS_JOURNAL_INTERVAL_S * 1000));
+
+        RelayCounters snapshot;
+        bool changed;
+        uint32_t seq;
+
+        portENTER_CRITICAL(&s_lock);
+        accumulate_on_time(esp_timer_get_time());
+        changed = s_dirty;
+        for (int i = 0; i < RELAY_STATS_NUM_RELAYS; i++) {
+            changed |= s_on_since_us[i] != 0;
+        }
+        s_dirty = false;
+        snapshot = s_rtc.counters;
+        seq = s_seq + 1;
+        portEXIT_CRITICAL(&s_lock);
+
+        if (!changed) {
+            continue;
+        }
+
+        esp_err_t err = journal_append(&snapshot, seq);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Journal write failed: %s", esp_err_to_name(err));
+            portENTER_CRITICAL(&s_lock);
+            s_dirty = true;
+            portEXIT_CRITICAL(&s_lock);
+            continue;
+        }
+
+        portENTER_CRITICAL(&s_lock);
+        s_seq = seq;
+        s_rtc.seq = seq;
+        s_rtc.crc = rtc_crc();
+        portEXIT_CRITICAL(&s_lock);
+    }
+}
+
+esp_err_t relay_stats_init(void)
+{
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE,
+                                           JOURNAL_PARTITION_LABEL);
+    if (s_partition == NULL) {
+        ESP_LOGE(TAG, "No \"%s\" partition, counters will not survive a power loss", JOURNAL_PARTITION_LABEL);
+    } else {
+        s_num_slots = (s_partition->size / JOURNAL_SECTOR_SIZE) * (JOURNAL_SECTOR_SIZE / sizeof(JournalEntry));
+    }
+
+    JournalEntry latest;
+    bool journal_valid = s_partition != NULL && journal_scan(&latest);
+    bool rtc_valid = s_rtc.magic == RTC_MAGIC && s_rtc.crc == rtc_crc();
+
+    // RAM is at least as new as the journal unless a power cycle wiped it.
+    if (rtc_valid && (!journal_valid || (int32_t)(s_rtc.seq - latest.seq) >= 0)) {
+        s_seq = s_rtc.seq;
+        s_dirty = true;
+        ESP_LOGI(TAG, "Counters restored from RTC memory");
+    } else if (journal_valid) {
+        s_rtc.counters = latest.counters;
+        s_seq = latest.seq;
+        ESP_LOGI(TAG, "Counters restored from journal entry %u", latest.seq);
+    } else {
+        memset(&s_rtc.counters, 0, sizeof(s_rtc.counters));
+        s_seq = 0;
+        ESP_LOGI(TAG, "Counters start from zero");
+    }
+    s_rtc.magic = RTC_MAGIC;
+    s_rtc.seq = s_seq;
+    s_rtc.crc = rtc_crc();
+
+    if (s_partition != NULL) {
+        xTaskCreate(relay_stats_task, "relay_stats", 3072, NULL, 3, NULL);
+    }
+    return ESP_OK;
+}
+
+void relay_stats_relay_driven(int relay_num, bool state)
+{
+    if (relay_num < 1 || relay_num > RELAY_STATS_NUM_RELAYS) {
+        return;
+    }
+    int i = relay_num - 1;
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    if (state && !s_on_since_us[i]) {
+        s_rtc.counters.switch_count[i]++;
+        s_on_since_us[i] = now_us;
+        s_dirty = true;
+    } else if (!state && s_on_since_us[i]) {
+        s_rtc.counters.on_time_ms[i] += (now_us - s_on_since_us[i]) / 1000;
+        s_on_since_us[i] = 0;
+        s_dirty = true;
+    }
+    s_rtc.crc = rtc_crc();
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void relay_stats_get(int relay_num, uint32_t *switch_count, uint32_t *on_time_s)
+{
+    if (relay_num < 1 || relay_num > RELAY_STATS_NUM_RELAYS) {
+        *switch_count = 0;
+        *on_time_s = 0;
+        return;
+    }
+    int i = relay_num - 1;
+    int64_t now_us = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    uint64_t on_time_ms = s_rtc.counters.on_time_ms[i];
+    if (s_on_since_us[i]) {
+        on_time_ms += (now_us - s_on_since_us[i]) / 1000;
+    }
+    *switch_count = s_rtc.counters.switch_count[i];
+    portEXIT_CRITICAL(&s_lock);
+
+    *on_time_s = (uint32_t)(on_time_ms / 1000);
+}
@@ -0,0 +1,30 @@
+#ifndef RELAY_STATS_H
+#define RELAY_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Per-relay switch counts and cumulative on-time.
+//
+// The live counters sit in RTC_NOINIT RAM, so a software reset keeps them as is.
+// A snapshot is appended to a journal on the "relaystat" data partition every
+// RELAY_STATS_JOURNAL_INTERVAL_S while anything changed, so a power loss costs at
+// most one interval. The journal is a ring of fixed-size entries across all sectors
+// of the partition: a sector is erased only when the write position enters it,
+// which spreads the erase cycles evenly.
+
+#define RELAY_STATS_NUM_RELAYS          4
+#define RELAY_STATS_JOURNAL_INTERVAL_S  300
+
+// Restores the counters and starts the journal task. Call before any relay is driven.
+esp_err_t relay_stats_init(void);
+
+// Called on every relay output write, relay_num 1-4. Only state changes count;
+// a switch operation is an off -> on transition.
+void relay_stats_relay_driven(int relay_num, bool state);
+
+// relay_num 1-4, on-time includes the current on period.
+void relay_stats_get(int relay_num, uint32_t *switch_count, uint32_t *on_time_s);
+
+#endif // RELAY_STATS_H
@@ -0,0 +1,268 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "mbedtls/sha256.h"
+#include "rs485_ota.h"
+
+#define OTA_RESTART_DELAY_MS    500     // lets the END response leave the UART
+
+static const char *TAG = "rs485_ota";
+
+static uint8_t s_state = RS485_OTA_STATE_IDLE;
+static uint8_t s_error;
+static const esp_partition_t *s_partition;
+static esp_ota_handle_t s_handle;
+static mbedtls_sha256_context s_sha;
+
+static uint32_t s_image_size;
+static uint16_t s_chunk_size;
+static uint8_t s_window;
+static uint16_t s_chunk_count;
+static uint16_t s_next_chunk;       // first chunk not yet written to flash
+
+// Window slots, chunk i lives in slot i % s_window
+static uint8_t s_slots[RS485_OTA_MAX_WINDOW][RS485_OTA_MAX_CHUNK];
+static uint8_t s_slot_length[RS485_OTA_MAX_WINDOW];
+static uint32_t s_received;         // bit i = chunk s_next_chunk + i is buffered
+
+static void restart_callback(TimerHandle_t timer)
+{
+    esp_restart();
+}
+
+static void ota_fail(uint8_t error)
+{
+    if (s_state == RS485_OTA_STATE_RECEIVING) {
+        esp_ota_abort(s_handle);
+        mbedtls_sha256_free(&s_sha);
+    }
+    s_state = RS485_OTA_STATE_ERROR;
+    s_error = error;
+}
+
+static void put_u16(uint8_t *out, uint16_t value)
+{
+    out[0] = value >> 8;
+    out[1] = value & 0xFF;
+}
+
+static void put_u32(uint8_t *out, uint32_t value)
+{
+    put_u16(out, value >> 16);
+    put_u16(out + 2, value & 0xFFFF);
+}
+
+int rs485_ota_frame_length(const uint8_t *frame, int length)
+{
+    // address, function code, subcommand, ..., CRC
+    if (length < 3) {
+        return 0;
+    }
+    switch (frame[2]) {
+        case RS485_OTA_BEGIN:  return 3 + 7 + 2;
+        case RS485_OTA_DATA:   return length < 6 ? 0 : 3 + 3 + frame[5] + 2;
+        case RS485_OTA_STATUS: return 3 + 2;
+        case RS485_OTA_END:    return 3 + 32 + 2;
+        case RS485_OTA_ABORT:  return 3 + 2;
+        default:               return -1;
+    }
+}
+
+static uint8_t ota_begin(const uint8_t *data, int length, uint8_t *out, int *out_length)
+{
+    if (length != 8) {
+        return 0x03;  // Illegal data value
+    }
+    uint32_t image_size = (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4];
+    uint16_t chunk_size = (data[5] << 8) | data[6];
+    uint8_t window = data[7];
+
+    if (chunk_size == 0 || window == 0 || image_size == 0) {
+        return 0x03;
+    }
+    if (chunk_size > RS485_OTA_MAX_CHUNK) {
+        chunk_size = RS485_OTA_MAX_CHUNK;
+    }
+    if (window > RS485_OTA_MAX_WINDOW) {
+        window = RS485_OTA_MAX_WINDOW;
+    }
+
+    // A new BEGIN restarts any transfer in progress
+    if (s_state == RS485_OTA_STATE_RECEIVING) {
+        esp_ota_abort(s_handle);
+        mbedtls_sha256_free(&s_sha);
+        s_state = RS485_OTA_STATE_IDLE;
+    }
+
+    s_partition = esp_ota_get_next_update_partition(NULL);
+    if (s_partition == NULL || image_size > s_partition->size) {
+        ESP_LOGE(TAG, "No OTA partition for a %u byte image", image_size);
+        return 0x03;
+    }
+    if ((image_size + chunk_size - 1) / chunk_size > 0xFFFF) {
+        return 0x03;
+    }
+
+    // Sectors are erased as the writes reach them, so BEGIN does not hold up the
+    // Modbus task for the seconds a whole image takes; the RX buffer covers each erase
+    esp_err_t err = esp_ota_begin(s_partition, OTA_WITH_SEQUENTIAL_WRITES, &s_handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "esp_ota_begin failed: %s", esp_err_to_name(err));
+        s_state = RS485_OTA_STATE_ERROR;
+        s_error = RS485_OTA_ERR_FLASH;
+        return 0x04;  // Slave device failure
+    }
+    mbedtls_sha256_init(&s_sha);
+    mbedtls_sha256_starts_ret(&s_sha, 0);
+
+    s_image_size = image_size;
+    s_chunk_size = chunk_size;
+    s_window = window;
+    s_chunk_count = (image_size + chunk_size - 1) / chunk_size;
+    s_next_chunk = 0;
+    s_received = 0;
+    s_state = RS485_OTA_STATE_RECEIVING;
+    s_error = RS485_OTA_OK;
+
+    ESP_LOGI(TAG, "Receiving %u bytes into %s, %u chunks of %u, window %u",
+             image_size, s_partition->label, s_chunk_count, chunk_size, window);
+
+    out[0] = RS485_OTA_BEGIN;
+    put_u16(out + 1, chunk_size);
+    out[3] = window;
+    *out_length = 4;
+    return 0;
+}
+
+static void ota_data(const uint8_t *data, int length)
+{
+    if (s_state != RS485_OTA_STATE_RECEIVING || length < 4 || length != 4 + data[3]) {
+        return;
+    }
+    uint16_t chunk = (data[1] << 8) | data[2];
+    uint8_t chunk_length = data[3];
+
+    // Outside the window, or a resend of something already held
+    uint16_t offset = chunk - s_next_chunk;
+    if (chunk < s_next_chunk || offset >= s_window || chunk >= s_chunk_count || (s_received & (1u << offset))) {
+        return;
+    }
+    uint32_t expected = chunk == s_chunk_count - 1 ? s_image_size - (uint32_t)chunk * s_chunk_size : s_chunk_size;
+    if (chunk_length != expected) {
+        return;
+    }
+
+    memcpy(s_slots[chunk % s_window], data + 4, chunk_length);
+    s_slot_length[chunk % s_window] = chunk_length;
+    s_received |= 1u << offset;
+
+    // Write out the in-order run at the start of the window
+    while (s_received & 1) {
+        uint8_t slot = s_next_chunk % s_window;
+        esp_err_t err = esp_ota_write(s_handle, s_slots[slot], s_slot_length[slot]);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "esp_ota_write failed at chunk %u: %s", s_next_chunk, esp_err_to_name(err));
+            ota_fail(RS485_OTA_ERR_FLASH);
+            return;
+        }
+        mbedtls_sha256_update_ret(&s_sha, s_slots[slot], s_slot_length[slot]);
+        s_next_chunk++;
+        s_received >>= 1;
+    }
+}
+
+static uint8_t ota_end(const uint8_t *data, int length, uint8_t *out, int *out_length)
+{
+    if (length != 33) {
+        return 0x03;
+    }
+    if (s_state != RS485_OTA_STATE_RECEIVING) {
+        return 0x04;
+    }
+
+    out[0] = RS485_OTA_END;
+    *out_length = 2;
+
+    if (s_next_chunk != s_chunk_count) {
+        out[1] = RS485_OTA_ERR_INCOMPLETE;  // keep receiving, the sender may resend
+        return 0;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish_ret(&s_sha, digest);
+    if (memcmp(digest, data + 1, sizeof(digest)) != 0) {
+        ESP_LOGE(TAG, "SHA-256 mismatch");
+        ota_fail(RS485_OTA_ERR_SHA256);
+        out[1] = s_error;
+        return 0;
+    }
+    mbedtls_sha256_free(&s_sha);
+
+    s_state = RS485_OTA_STATE_ERROR;
+    s_error = RS485_OTA_ERR_IMAGE;
+    esp_err_t err = esp_ota_end(s_handle);
+    if (err == ESP_OK) {
+        err = esp_ota_set_boot_partition(s_partition);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Image rejected: %s", esp_err_to_name(err));
+        out[1] = s_error;
+        return 0;
+    }
+
+    s_state = RS485_OTA_STATE_DONE;
+    s_error = RS485_OTA_OK;
+    out[1] = RS485_OTA_OK;
+    ESP_LOGI(TAG, "Update complete, restarting from %s", s_partition->label);
+
+    TimerHandle_t timer = xTimerCreate("ota_restart", pdMS_TO_TICKS(OTA_RESTART_DELAY_MS), pdFALSE, NULL, restart_callback);
+    if (timer == NULL || xTimerStart(timer, 0) != pdPASS) {
+        esp_restart();
+    }
+    return 0;
+}
+
+uint8_t rs485_ota_request(const uint8_t *data, int length, uint8_t *out, int *out_length)
+{
+    *out_length = 0;
+    if (length < 1) {
+        return 0x03;
+    }
+
+    switch (data[0]) {
+        case RS485_OTA_BEGIN:
+            return ota_begin(data, length, out, out_length);
+
+        case RS485_OTA_DATA:
+            ota_data(data, length);
+            return 0;
+
+        case RS485_OTA_STATUS:
+            out[0] = RS485_OTA_STATUS;
+            out[1] = s_state;
+            put_u16(out + 2, s_next_chunk);
+            put_u32(out + 4, s_received);
+            out[8] = s_error;
+            *out_length = 9;
+            return 0;
+
+        case RS485_OTA_END:
+            return ota_end(data, length, out, out_length);
+
+        case RS485_OTA_ABORT:
+            if (s_state == RS485_OTA_STATE_RECEIVING) {
+                ota_fail(RS485_OTA_OK);
+            }
+            s_state = RS485_OTA_STATE_IDLE;
+            out[0] = RS485_OTA_ABORT;
+            out[1] = s_state;
+            *out_length = 2;
+            return 0;
+
+        default:
+            return 0x01;  // Illegal function
+    }
+}
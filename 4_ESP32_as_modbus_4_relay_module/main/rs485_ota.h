@@ -0,0 +1,54 @@
+#ifndef RS485_OTA_H
+#define RS485_OTA_H
+
+#include <stdint.h>
+
+// Firmware update over the Modbus RTU link, vendor function code 0x41.
+// Request data after the function code starts with a subcommand byte:
+//
+//   0x01 BEGIN   u32 image size, u16 chunk size, u8 window
+//                -> sub, u16 chunk size, u8 window actually used
+//   0x02 DATA    u16 chunk index, u8 length, data         (never answered)
+//   0x03 STATUS  -> sub, state, u16 next chunk, u32 window bitmap, u8 error
+//   0x04 END     32-byte SHA-256 of the whole image       -> sub, result
+//   0x05 ABORT   -> sub, state
+//
+// BEGIN answers at once: the target area is erased sector by sector as the image
+// is written. DATA frames are streamed without waiting for replies. Chunks inside the window
+// [next chunk, next chunk + window) are buffered in any order and written to the
+// inactive OTA partition in sequence; bit i of the STATUS bitmap is set when chunk
+// next + i is held. A chunk that fails the frame CRC is simply dropped and shows up
+// as a clear bit, so the sender resends it. All values big-endian.
+
+#define RS485_OTA_FUNCTION_CODE     0x41
+
+#define RS485_OTA_BEGIN             0x01
+#define RS485_OTA_DATA              0x02
+#define RS485_OTA_STATUS            0x03
+#define RS485_OTA_END               0x04
+#define RS485_OTA_ABORT             0x05
+
+#define RS485_OTA_MAX_CHUNK         240     // fits one 256-byte RTU frame
+#define RS485_OTA_MAX_WINDOW        32
+#define RS485_OTA_MAX_FRAME         (RS485_OTA_MAX_CHUNK + 8)   // DATA frame, address to CRC
+
+#define RS485_OTA_STATE_IDLE        0
+#define RS485_OTA_STATE_RECEIVING   1
+#define RS485_OTA_STATE_DONE        2       // image accepted, rebooting
+#define RS485_OTA_STATE_ERROR       3
+
+#define RS485_OTA_OK                0
+#define RS485_OTA_ERR_INCOMPLETE    1
+#define RS485_OTA_ERR_SHA256        2
+#define RS485_OTA_ERR_IMAGE         3       // rejected by esp_ota_end()
+#define RS485_OTA_ERR_FLASH         4
+
+// Frame length from the first bytes of a 0x41 request, 0 if more bytes are needed,
+// -1 if the subcommand is unknown.
+int rs485_ota_frame_length(const uint8_t *frame, int length);
+
+// `data` points past the function code. Returns 0 or a Modbus exception code;
+// `out_length` is 0 when no response is to be sent.
+uint8_t rs485_ota_request(const uint8_t *data, int length, uint8_t *out, int *out_length);
+
+#endif // RS485_OTA_H
@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/ringbuf.h"
+#include "driver/uart.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "modbus_slave.h"
+#include "mb_capture.h"
+#include "sniffer.h"
+
+#define SNIFFER_STREAM_UART         UART_NUM_0
+#define SNIFFER_STREAM_BAUD         921600
+#define SNIFFER_STREAM_BUF_SIZE     8192        // capture records waiting for the stream UART
+#define SNIFFER_RX_BUF_SIZE         2048
+#define SNIFFER_EVENT_QUEUE_LEN     32
+#define SNIFFER_RX_TIMEOUT_SYMBOLS  3           // idle symbols that end a frame (~t3.5)
+#define SNIFFER_MAX_ADU             256
+#define SNIFFER_RESPONSE_TIMEOUT_MS 1000        // request without reply counts as a timeout
+#define SNIFFER_STATS_PERIOD_MS     5000
+#define SNIFFER_MAX_UNITS           256         // every address, reserved 248..255 included (0xFF is common)
+
+static const char *TAG = "sniffer";
+
+typedef struct {
+    uint32_t requests;
+    uint32_t responses;
+    uint32_t exceptions;
+    uint32_t timeouts;
+    uint32_t crc_errors;
+    uint32_t rt_min_us;
+    uint32_t rt_max_us;
+    uint64_t rt_sum_us;
+} SlaveStats;
+
+typedef struct {
+    bool pending;
+    uint8_t unit_id;
+    uint8_t function_code;
+    int64_t end_us;
+} PendingRequest;
+
+static uart_port_t s_bus_uart;
+static uint32_t s_char_us;          // time of one 10-bit character on the wire
+static QueueHandle_t s_uart_queue;
+static RingbufHandle_t s_stream;
+
+// Slave counters are cumulative since boot, bus counters cover one stats window.
+static SlaveStats s_slaves[SNIFFER_MAX_UNITS];
+static mb_capture_bus_stats_t s_bus;
+static PendingRequest s_pending;
+static int64_t s_last_frame_end_us;
+
+static void stream_record(uint8_t type, uint8_t flags, uint8_t unit_id,
+                          int64_t end_us, uint32_t gap_us,
+                          const void *payload, uint16_t length)
+{
+    uint8_t record[sizeof(mb_capture_record_t) + SNIFFER_MAX_ADU];
+    mb_capture_record_t *hdr = (mb_capture_record_t *)record;
+
+    if (length > SNIFFER_MAX_ADU) {
+        length = SNIFFER_MAX_ADU;
+    }
+    hdr->sync = MB_CAPTURE_SYNC;
+    hdr->type = type;
+    hdr->flags = flags;
+    hdr->unit_id = unit_id;
+    hdr->length = length;
+    hdr->timestamp_us = (uint32_t)end_us;
+    hdr->gap_us = gap_us;
+    memcpy(record + sizeof(mb_capture_record_t), payload, length);
+
+    // Never block the framing path: if the host reads too slowly, drop and count.
+    if (xRingbufferSend(s_stream, record, sizeof(mb_capture_record_t) + length, 0) != pdTRUE) {
+        s_bus.dropped++;
+    }
+}
+
+static void stream_writer_task(void *pvParameters)
+{
+    while (1) {
+        size_t size;
+        uint8_t *item = (uint8_t *)xRingbufferReceive(s_stream, &size, portMAX_DELAY);
+        if (item != NULL) {
+            uart_write_bytes(SNIFFER_STREAM_UART, (const char *)item, size);
+            vRingbufferReturnItem(s_stream, item);
+        }
+    }
+}
+
+static void record_timeout(void)
+{
+    if (s_pending.pending) {
+        s_slaves[s_pending.unit_id].timeouts++;
+        s_pending.pending = false;
+    }
+}
+
+static void process_frame(const uint8_t *frame, int length, bool truncated, int64_t end_us)
+{
+    uint32_t duration_us = length * s_char_us;
+    int64_t start_us = end_us - duration_us;
+    uint32_t gap_us = s_last_frame_end_us ? (uint32_t)(start_us - s_last_frame_end_us) : 0;
+    uint8_t flags = truncated ? MB_CAPTURE_FLAG_TRUNCATED : 0;
+    uint8_t unit_id = frame[0];
+
+    s_last_frame_end_us = end_us;
+    s_bus.frames++;
+    s_bus.bytes += length;
+    s_bus.busy_us += duration_us;
+
+    if (s_pending.pending && end_us - s_pending.end_us > SNIFFER_RESPONSE_TIMEOUT_MS * 1000LL) {
+        record_timeout();
+    }
+
+    bool crc_ok = !truncated && length >= 4 &&
+                  modbus_crc16((uint8_t *)frame, length - 2) == ((frame[length - 2] << 8) | frame[length - 1]);
+
+    if (!crc_ok) {
+        flags |= MB_CAPTURE_FLAG_CRC_ERROR;
+        if (s_pending.pending) {
+            // A garbled frame right after a request is most likely its reply.
+            s_slaves[s_pending.unit_id].crc_errors++;
+            s_pending.pending = false;
+        } else if (length > 0) {
+            s_slaves[unit_id].crc_errors++;
+        } else {
+            s_bus.crc_errors++;
+        }
+    } else {
+        uint8_t function_code = frame[1];
+        SlaveStats *slave = &s_slaves[unit_id];
+
+        if (s_pending.pending && s_pending.unit_id == unit_id &&
+            s_pending.function_code == (function_code & 0x7F)) {
+            uint32_t rt_us = (uint32_t)(start_us - s_pending.end_us);
+            flags |= MB_CAPTURE_FLAG_RESPONSE;
+            slave->responses++;
+            slave->rt_sum_us += rt_us;
+            if (slave->rt_min_us == 0 || rt_us < slave->rt_min_us) {
+                slave->rt_min_us = rt_us;
+            }
+            if (rt_us > slave->rt_max_us) {
+                slave->rt_max_us = rt_us;
+            }
+            if (function_code & 0x80) {
+                flags |= MB_CAPTURE_FLAG_EXCEPTION;
+                slave->exceptions++;
+            }
+            s_pending.pending = false;
+        } else {
+            // Anything that is not the expected reply starts a new transaction.
+            record_timeout();
+            slave->requests++;
+            if (unit_id != 0x00) {
+                s_pending.pending = true;
+                s_pending.unit_id = unit_id;
+                s_pending.function_code = function_code;
+                s_pending.end_us = end_us;
+            }
+        }
+    }
+
+    stream_record(MB_CAPTURE_TYPE_FRAME, flags, unit_id, end_us, gap_us, frame, length);
+}
+
+static void emit_stats(int64_t now_us, uint32_t period_ms)
+{
+    uint8_t payload[SNIFFER_MAX_ADU];
+    size_t offset = sizeof(mb_capture_bus_stats_t);
+
+    s_bus.period_ms = period_ms;
+    memcpy(payload, &s_bus, sizeof(s_bus));
+
+    // Slaves that do not fit in one record go into the next one.
+    for (int unit = 0; unit < SNIFFER_MAX_UNITS; unit++) {
+        SlaveStats *slave = &s_slaves[unit];
+        if (slave->requests == 0 && slave->crc_errors == 0) {
+            continue;
+        }
+        if (offset + sizeof(mb_capture_slave_stats_t) > sizeof(payload)) {
+            stream_record(MB_CAPTURE_TYPE_STATS, 0, 0, now_us, 0, payload, offset);
+            offset = sizeof(mb_capture_bus_stats_t);
+        }
+        mb_capture_slave_stats_t entry = {
+            .unit_id = unit,
+            .requests = slave->requests,
+            .responses = slave->responses,
+            .exceptions = slave->exceptions,
+            .timeouts = slave->timeouts,
+            .crc_errors = slave->crc_errors,
+            .rt_min_us = slave->rt_min_us,
+            .rt_max_us = slave->rt_max_us,
+            .rt_avg_us = slave->responses ? (uint32_t)(slave->rt_sum_us / slave->responses) : 0,
+        };
+        memcpy(payload + offset, &entry, sizeof(entry));
+        offset += sizeof(entry);
+    }
+    stream_record(MB_CAPTURE_TYPE_STATS, 0, 0, now_us, 0, payload, offset);
+
+    memset(&s_bus, 0, sizeof(s_bus));
+}
+
+static void sniffer_task(void *pvParameters)
+{
+    uint8_t *frame = (uint8_t *)pvParameters;
+    int frame_len = 0;
+    bool truncated = false;
+    int64_t stats_start_us = esp_timer_get_time();
+    uart_event_t event;
+
+    while (1) {
+        if (xQueueReceive(s_uart_queue, &event, pdMS_TO_TICKS(100))) {
+            int64_t now_us = esp_timer_get_time();
+
+            if (event.type == UART_DATA) {
+                uint8_t chunk[128];
+                size_t remaining = event.size;
+                while (remaining > 0) {
+                    int len = uart_read_bytes(s_bus_uart, chunk,
+                                              remaining < sizeof(chunk) ? remaining : sizeof(chunk), 0);
+                    if (len <= 0) {
+                        break;
+                    }
+                    int room = SNIFFER_MAX_ADU - frame_len;
+                    if (len > room) {
+                        truncated = true;
+                    }
+                    memcpy(frame + frame_len, chunk, len < room ? len : room);
+                    frame_len += len < room ? len : room;
+                    remaining -= len;
+                }
+
+                // The RX timeout interrupt fires once the line has been idle for
+                // SNIFFER_RX_TIMEOUT_SYMBOLS characters: that is the frame boundary.
+                if (event.timeout_flag && frame_len > 0) {
+                    int64_t end_us = now_us - SNIFFER_RX_TIMEOUT_SYMBOLS * s_char_us;
+                    process_frame(frame, frame_len, truncated, end_us);
+                    frame_len = 0;
+                    truncated = false;
+                }
+            } else if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+                uart_flush_input(s_bus_uart);
+                xQueueReset(s_uart_queue);
+                s_bus.dropped++;
+                frame_len = 0;
+                truncated = false;
+            }
+        }
+
+        int64_t now_us = esp_timer_get_time();
+        if (s_pending.pending && now_us - s_pending.end_us > SNIFFER_RESPONSE_TIMEOUT_MS * 1000LL) {
+            record_timeout();
+        }
+        if (now_us - stats_start_us >= SNIFFER_STATS_PERIOD_MS * 1000LL) {
+            emit_stats(now_us, (uint32_t)((now_us - stats_start_us) / 1000));
+            stats_start_us = now_us;
+        }
+    }
+    free(frame);
+}
+
+esp_err_t sniffer_start(uart_port_t bus_uart, int rxd_pin, uint32_t baud_rate)
+{
+    uart_config_t uart_config = {
+        .baud_rate = baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_APB,
+    };
+
+    s_bus_uart = bus_uart;
+    s_char_us = 10 * 1000000 / baud_rate;
+
+    // Receive only: no TX pin, no RS485 direction control, no TX buffer.
+    ESP_ERROR_CHECK(uart_driver_install(bus_uart, SNIFFER_RX_BUF_SIZE, 0,
+                                        SNIFFER_EVENT_QUEUE_LEN, &s_uart_queue, 0));
+    ESP_ERROR_CHECK(uart_param_config(bus_uart, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(bus_uart, UART_PIN_NO_CHANGE, rxd_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_set_rx_timeout(bus_uart, SNIFFER_RX_TIMEOUT_SYMBOLS));
+
+    s_stream = xRingbufferCreate(SNIFFER_STREAM_BUF_SIZE, RINGBUF_TYPE_NOSPLIT);
+    if (s_stream == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate capture stream buffer");
+        return ESP_ERR_NO_MEM;
+    }
+    // Allocated here, while errors can still be logged; sniffer_task owns it
+    uint8_t *frame = (uint8_t *)malloc(SNIFFER_MAX_ADU);
+    if (frame == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate frame buffer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Sniffing UART%d at %d baud, capture stream on UART%d at %d baud",
+             bus_uart, baud_rate, SNIFFER_STREAM_UART, SNIFFER_STREAM_BAUD);
+
+    // From here on the console carries binary capture records only.
+    esp_log_level_set("*", ESP_LOG_NONE);
+    uart_config.baud_rate = SNIFFER_STREAM_BAUD;
+    ESP_ERROR_CHECK(uart_driver_install(SNIFFER_STREAM_UART, 256, SNIFFER_STREAM_BUF_SIZE, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(SNIFFER_STREAM_UART, &uart_config));
+
+    xTaskCreate(stream_writer_task, "sniffer_stream", 2048, NULL, 5, NULL);
+    xTaskCreate(sniffer_task, "sniffer_task", 4096, frame, 12, NULL);
+    return ESP_OK;
+}
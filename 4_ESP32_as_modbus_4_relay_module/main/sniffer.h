@@ -0,0 +1,14 @@
+#ifndef SNIFFER_H
+#define SNIFFER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/uart.h"
+
+// Listen-only Modbus RTU bus monitor.
+// The RS-485 port is opened receive-only and never transmits. Frames are split on
+// inter-frame gaps, matched request -> response, and streamed as mb_capture records
+// on the stream UART together with periodic per-slave statistics.
+esp_err_t sniffer_start(uart_port_t bus_uart, int rxd_pin, uint32_t baud_rate);
+
+#endif // SNIFFER_H
@@ -101,7 +101,11 @@ esp_err_t ethernet (int timeout)
      * an event is triggered to notify the application. 
      * The default event loop manages these events, ensuring they are processed appropriately without blocking other tasks.
      */
-    ESP_ERROR_CHECK(esp_event_loop_create_default());   
+    // Wi-Fi may have created it already when the two interfaces run together
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
 
 
     /*
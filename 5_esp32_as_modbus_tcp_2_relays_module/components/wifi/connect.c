@@ -129,9 +129,13 @@ void event_handler(void* event_handler_arg, esp_event_base_t event_base, int32_t
 
 void wifi_init(void) 
 {
-    // Initialize the default event loop for the network interface
+    // Initialize the default event loop for the network interface. Ethernet may
+    // have done both already when the two interfaces run together.
     ESP_ERROR_CHECK(esp_netif_init());
-    ESP_ERROR_CHECK(esp_event_loop_create_default());//tell network interface use event loop
+    esp_err_t err = esp_event_loop_create_default();//tell network interface use event loop
+    if (err != ESP_ERR_INVALID_STATE) {
+        ESP_ERROR_CHECK(err);
+    }
     // Configure the default WiFi initialization parameters
     wifi_init_config_t wifi_init_config = WIFI_INIT_CONFIG_DEFAULT();
     // Initialize the WiFi driver with the default configuration
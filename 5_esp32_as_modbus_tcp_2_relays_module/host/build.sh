@@ -0,0 +1,35 @@
+#!/bin/sh
+# Builds the Modbus TCP slave of main/ as a Linux program, for load tests with
+# tools/mb_loadgen.py. Sockets are the host's; GPIO, NVS and the RS-485 port are
+# simulated in host_port.c.
+#
+#   host/build.sh                                       -> host/slave, port 1502
+#   MB_TCP_PORT=5020 host/build.sh
+#   HOST_WIFI_IP=127.0.0.2 host/slave                   -> clients of 127.0.0.2 count as Wi-Fi
+#   DEFS="-DCONFIG_MB_CACHE_ENABLE=1 -DCONFIG_MB_CACHE_MAX_AGE_MS=50 -DCONFIG_MB_CACHE_ENTRIES=8" host/build.sh
+#
+# The defaults mirror sdkconfig except for the port, which needs no root on the
+# host, and the per-connection rate limits, which would cap a load test.
+
+set -e
+HOST=$(cd "$(dirname "$0")" && pwd)
+MAIN=$HOST/../main
+
+${CC:-cc} -O2 -g -std=gnu11 -Wall -pthread -D_GNU_SOURCE \
+    -include "$HOST/include/host_port.h" -I"$HOST/include" -I"$MAIN" \
+    -DCONFIG_MB_TCP_PORT=${MB_TCP_PORT:-1502} \
+    -DCONFIG_MB_TCP_MAX_CONNECTIONS=${MB_TCP_MAX_CONNECTIONS:-8} \
+    -DCONFIG_MB_TCP_IDLE_TIMEOUT=${MB_TCP_IDLE_TIMEOUT:-60} \
+    -DCONFIG_MB_TCP_KEEPALIVE_IDLE=5 \
+    -DCONFIG_MB_TCP_KEEPALIVE_INTERVAL=5 \
+    -DCONFIG_MB_TCP_KEEPALIVE_COUNT=3 \
+    -DCONFIG_MB_TCP_READ_RATE=${MB_TCP_READ_RATE:-0} \
+    -DCONFIG_MB_TCP_READ_BURST=${MB_TCP_READ_BURST:-50} \
+    -DCONFIG_MB_TCP_WRITE_RATE=${MB_TCP_WRITE_RATE:-0} \
+    -DCONFIG_MB_TCP_WRITE_BURST=${MB_TCP_WRITE_BURST:-10} \
+    -DCONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ=160 \
+    -DCONFIG_MB_NET_ETHERNET=1 \
+    -DCONFIG_MB_NET_WIFI=1 \
+    -DCONFIG_MB_WIFI_MAX_CONNECTIONS=${MB_WIFI_MAX_CONNECTIONS:-2} \
+    $DEFS \
+    "$MAIN"/*.c "$HOST/host_port.c" -o "$HOST/slave"
@@ -0,0 +1,609 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "nvs_flash.h"
+#include "connect.h"
+#include "lan8720.h"
+#include "esp_netif.h"
+#include "esp_http_server.h"
+#include "lwip/sockets.h"
+
+int host_log_level = 2;
+
+static pthread_mutex_t s_critical;
+
+void app_main(void);
+
+// Time
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return esp_timer_get_time() / (portTICK_PERIOD_MS * 1000);
+}
+
+void vTaskDelay(TickType_t ticks_to_delay)
+{
+    usleep(ticks_to_delay * portTICK_PERIOD_MS * 1000);
+}
+
+void esp_rom_delay_us(uint32_t us)
+{
+    usleep(us);
+}
+
+// Absolute CLOCK_REALTIME deadline for pthread_cond_timedwait
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t ns = ts.tv_nsec + (int64_t)ticks * portTICK_PERIOD_MS * 1000000LL;
+    ts.tv_sec += ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    return ts;
+}
+
+// Tasks and critical sections
+
+typedef struct {
+    TaskFunction_t task_code;
+    void *parameters;
+} task_start_t;
+
+static void *task_thread(void *arg)
+{
+    task_start_t start = *(task_start_t *)arg;
+    free(arg);
+    start.task_code(start.parameters);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task)
+{
+    pthread_t thread;
+    task_start_t *start = malloc(sizeof(task_start_t));
+    start->task_code = task_code;
+    start->parameters = parameters;
+    if (pthread_create(&thread, NULL, task_thread, start) != 0) {
+        free(start);
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    if (created_task) {
+        *created_task = (TaskHandle_t)thread;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL) {
+        pthread_exit(NULL);
+    }
+}
+
+// Thread stacks are not watched on the host
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 0;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&s_critical);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_unlock(&s_critical);
+}
+
+// Notification counters, one per waiting task
+#define HOST_NOTIFY_SLOTS 8
+
+static pthread_mutex_t s_notify_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_notify_cond = PTHREAD_COND_INITIALIZER;
+static struct {
+    pthread_t thread;
+    uint32_t count;
+} s_notify[HOST_NOTIFY_SLOTS];
+static int s_notify_used;
+
+// Called with s_notify_lock held
+static uint32_t *notify_count(pthread_t thread)
+{
+    for (int i = 0; i < s_notify_used; i++) {
+        if (pthread_equal(s_notify[i].thread, thread)) {
+            return &s_notify[i].count;
+        }
+    }
+    if (s_notify_used == HOST_NOTIFY_SLOTS) {
+        abort();
+    }
+    s_notify[s_notify_used].thread = thread;
+    return &s_notify[s_notify_used++].count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&s_notify_lock);
+    (*notify_count((pthread_t)task))++;
+    pthread_cond_broadcast(&s_notify_cond);
+    pthread_mutex_unlock(&s_notify_lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken)
+{
+    xTaskNotifyGive(task);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&s_notify_lock);
+    uint32_t *pending = notify_count(pthread_self());
+    while (*pending == 0) {
+        if (ticks_to_wait == portMAX_DELAY) {
+            pthread_cond_wait(&s_notify_cond, &s_notify_lock);
+        } else if (pthread_cond_timedwait(&s_notify_cond, &s_notify_lock, &deadline) != 0) {
+            break;
+        }
+    }
+    uint32_t count = *pending;
+    if (count) {
+        *pending = clear_count_on_exit ? 0 : count - 1;
+    }
+    pthread_mutex_unlock(&s_notify_lock);
+    return count;
+}
+
+// Queues and mutexes
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+} host_queue_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    host_queue_t *queue = calloc(1, sizeof(host_queue_t) + length * item_size);
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t ticks_to_wait)
+{
+    host_queue_t *queue = handle;
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (ticks_to_wait == 0 ||
+            (ticks_to_wait != portMAX_DELAY && pthread_cond_timedwait(&queue->changed, &queue->lock, &deadline) != 0) ||
+            (ticks_to_wait == portMAX_DELAY && pthread_cond_wait(&queue->changed, &queue->lock) != 0)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    queue->count++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+static BaseType_t queue_get(host_queue_t *queue, void *buffer, TickType_t ticks_to_wait, bool remove)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (ticks_to_wait == 0 ||
+            (ticks_to_wait != portMAX_DELAY && pthread_cond_timedwait(&queue->changed, &queue->lock, &deadline) != 0) ||
+            (ticks_to_wait == portMAX_DELAY && pthread_cond_wait(&queue->changed, &queue->lock) != 0)) {
+            pthread_mutex_unlock(&queue->lock);
+            return pdFALSE;
+        }
+    }
+    memcpy(buffer, queue->items + queue->head * queue->item_size, queue->item_size);
+    if (remove) {
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_get(queue, buffer, ticks_to_wait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    return queue_get(queue, buffer, ticks_to_wait, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+    pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait)
+{
+    return pthread_mutex_lock(semaphore) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    return pthread_mutex_unlock(semaphore) == 0 ? pdTRUE : pdFALSE;
+}
+
+// Software timers: a thread per started timer, which frees the timer once deleted
+
+typedef struct {
+    TickType_t period;
+    void *timer_id;
+    TimerCallbackFunction_t callback;
+    volatile bool deleted;
+    bool started;
+} host_timer_t;
+
+static void *timer_thread(void *arg)
+{
+    host_timer_t *timer = arg;
+
+    while (1) {
+        vTaskDelay(timer->period ? timer->period : 1);
+        if (timer->deleted) {
+            break;
+        }
+        timer->callback(timer);
+    }
+    free(timer);
+    return NULL;
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload,
+                           void *timer_id, TimerCallbackFunction_t callback)
+{
+    host_timer_t *timer = calloc(1, sizeof(host_timer_t));
+    timer->period = period;
+    timer->timer_id = timer_id;
+    timer->callback = callback;
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t handle, TickType_t ticks_to_wait)
+{
+    host_timer_t *timer = handle;
+    pthread_t thread;
+
+    if (timer->started) {
+        return pdPASS;
+    }
+    if (pthread_create(&thread, NULL, timer_thread, timer) != 0) {
+        return pdFALSE;
+    }
+    pthread_detach(thread);
+    timer->started = true;
+    return pdPASS;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t handle, TickType_t ticks_to_wait)
+{
+    host_timer_t *timer = handle;
+
+    if (timer->started) {
+        timer->deleted = true;
+    } else {
+        free(timer);
+    }
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return ((host_timer_t *)timer)->timer_id;
+}
+
+// GPIO, NVS, UART and network bring-up
+
+static uint32_t s_gpio_levels[40];
+
+void gpio_pad_select_gpio(uint8_t gpio_num)
+{
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    s_gpio_levels[gpio_num] = level;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return s_gpio_levels[gpio_num];
+}
+
+// No input edges on the host; the handlers are accepted and never called
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    *out_handle = 1;
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    return ESP_FAIL;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size,
+                              int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_set_mode(uart_port_t uart_num, uart_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    return ESP_OK;
+}
+
+int uart_write_bytes(uart_port_t uart_num, const void *src, size_t size)
+{
+    return size;
+}
+
+esp_err_t uart_wait_tx_done(uart_port_t uart_num, TickType_t ticks_to_wait)
+{
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    vTaskDelay(ticks_to_wait);
+    return 0;
+}
+
+void wifi_init(void)
+{
+}
+
+esp_err_t wifi_connect_sta(const char *ssid, const char *pass, int timeout_ms)
+{
+    return ESP_OK;
+}
+
+esp_err_t ethernet(int timeout)
+{
+    return ESP_OK;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key)
+{
+    static int s_wifi_sta;
+    if (strcmp(if_key, "WIFI_STA_DEF") != 0 || getenv("HOST_WIFI_IP") == NULL) {
+        return NULL;
+    }
+    return (esp_netif_t *)&s_wifi_sta;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info)
+{
+    memset(ip_info, 0, sizeof(*ip_info));
+    ip_info->ip.addr = inet_addr(getenv("HOST_WIFI_IP"));
+    return ESP_OK;
+}
+
+// HTTP server
+
+#define HOST_HTTPD_HANDLERS 4
+
+typedef struct {
+    int listen_sock;
+    httpd_uri_t handlers[HOST_HTTPD_HANDLERS];
+    int handler_count;
+} host_httpd_t;
+
+static void *httpd_thread(void *arg)
+{
+    host_httpd_t *server = arg;
+
+    while (1) {
+        int sock = accept(server->listen_sock, NULL, NULL);
+        if (sock < 0) {
+            continue;
+        }
+        char request[512];
+        char uri[256] = "";
+        int len = recv(sock, request, sizeof(request) - 1, 0);
+        if (len > 0) {
+            request[len] = '\0';
+            sscanf(request, "GET %255s", uri);
+        }
+        httpd_req_t req = { .sock = sock, .uri = uri };
+        int i;
+        for (i = 0; i < server->handler_count; i++) {
+            if (strcmp(server->handlers[i].uri, uri) == 0) {
+                server->handlers[i].handler(&req);
+                break;
+            }
+        }
+        if (i == server->handler_count) {
+            const char *not_found = "HTTP/1.0 404 Not Found\r\n\r\n";
+            send(sock, not_found, strlen(not_found), 0);
+        }
+        close(sock);
+    }
+    return NULL;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(config->server_port),
+    };
+    host_httpd_t *server = calloc(1, sizeof(host_httpd_t));
+    int opt = 1;
+    pthread_t thread;
+
+    server->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(server->listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(server->listen_sock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_sock, 1) != 0) {
+        close(server->listen_sock);
+        free(server);
+        return ESP_FAIL;
+    }
+    pthread_create(&thread, NULL, httpd_thread, server);
+    pthread_detach(thread);
+    *handle = server;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    host_httpd_t *server = handle;
+    if (server->handler_count == HOST_HTTPD_HANDLERS) {
+        return ESP_FAIL;
+    }
+    server->handlers[server->handler_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type)
+{
+    char header[128];
+    int len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n\r\n", type);
+    send(req->sock, header, len, 0);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t buf_len)
+{
+    if (buf_len > 0) {
+        send(req->sock, buf, buf_len, 0);
+    }
+    return ESP_OK;
+}
+
+// usage: slave [log level 0-4]
+int main(int argc, char **argv)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&s_critical, &attr);
+
+    // A client that resets its connection must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if (argc > 1) {
+        host_log_level = atoi(argv[1]);
+    }
+
+    app_main();
+    while (1) {
+        pause();
+    }
+}
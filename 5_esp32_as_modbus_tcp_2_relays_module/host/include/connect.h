@@ -0,0 +1,9 @@
+#ifndef CONNECT_H
+#define CONNECT_H
+
+// The host is already on the network: these return at once
+
+void wifi_init(void);
+esp_err_t wifi_connect_sta(const char *ssid, const char *pass, int timeout_ms);
+
+#endif // CONNECT_H
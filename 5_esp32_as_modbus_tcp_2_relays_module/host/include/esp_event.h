@@ -0,0 +1,6 @@
+#ifndef ESP_EVENT_H
+#define ESP_EVENT_H
+
+// Not needed on the host
+
+#endif // ESP_EVENT_H
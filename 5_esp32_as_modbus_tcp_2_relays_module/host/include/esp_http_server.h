@@ -0,0 +1,37 @@
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+// One thread serving GET requests one at a time over HTTP/1.0; a chunked
+// response is sent as plain body and ends with the connection.
+
+typedef void *httpd_handle_t;
+typedef enum { HTTP_GET } httpd_method_t;
+
+typedef struct {
+    int sock;
+    const char *uri;
+} httpd_req_t;
+
+typedef struct {
+    uint16_t server_port;
+    uint16_t ctrl_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { .server_port = 80, .ctrl_port = 32768, \
+                                 .max_open_sockets = 7, .max_uri_handlers = 8 }
+
+typedef struct {
+    const char *uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t *req);
+    void *user_ctx;
+} httpd_uri_t;
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler);
+esp_err_t httpd_resp_set_type(httpd_req_t *req, const char *type);
+esp_err_t httpd_resp_send_chunk(httpd_req_t *req, const char *buf, ssize_t buf_len);
+
+#endif // ESP_HTTP_SERVER_H
@@ -0,0 +1,16 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+// Set from the command line of the host slave: 0 none .. 4 debug
+extern int host_log_level;
+
+#define ESP_LOGE(tag, fmt, ...) do { if (host_log_level >= 1) printf("E %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGW(tag, fmt, ...) do { if (host_log_level >= 2) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI(tag, fmt, ...) do { if (host_log_level >= 3) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { if (host_log_level >= 4) printf("D %s: " fmt "\n", tag, ##__VA_ARGS__); } while (0)
+
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, length, level) (void)(buffer)
+
+#endif // ESP_LOG_H
@@ -0,0 +1,22 @@
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+// Only the Wi-Fi station's address, to tell its clients apart: set HOST_WIFI_IP
+// (e.g. 127.0.0.2) and clients that connect to that address count as Wi-Fi ones
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    uint32_t addr;                  // network byte order
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key);
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info);
+
+#endif // ESP_NETIF_H
@@ -0,0 +1,6 @@
+#ifndef ESP_ROM_SYS_H
+#define ESP_ROM_SYS_H
+
+void esp_rom_delay_us(uint32_t us);
+
+#endif // ESP_ROM_SYS_H
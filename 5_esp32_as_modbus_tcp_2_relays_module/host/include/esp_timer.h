@@ -0,0 +1,6 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+int64_t esp_timer_get_time(void);
+
+#endif // ESP_TIMER_H
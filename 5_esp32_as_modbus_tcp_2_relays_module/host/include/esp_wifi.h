@@ -0,0 +1,6 @@
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+
+// Not needed on the host
+
+#endif // ESP_WIFI_H
@@ -0,0 +1,34 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+// Tick rate of the firmware (CONFIG_FREERTOS_HZ=100)
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define portMAX_DELAY       ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS  10
+#define portNUM_PROCESSORS  2
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms) / portTICK_PERIOD_MS)
+
+// Critical sections share one recursive mutex
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux)     vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux)      vPortExitCritical(mux)
+
+#define IRAM_ATTR
+#define portYIELD_FROM_ISR()
+
+#endif // FREERTOS_H
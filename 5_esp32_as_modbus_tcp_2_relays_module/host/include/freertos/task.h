@@ -0,0 +1,31 @@
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+// Tasks are detached threads; priorities and stack sizes are ignored
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t task_code, const char *name, uint32_t stack_depth,
+                       void *parameters, UBaseType_t priority, TaskHandle_t *created_task);
+// The core is ignored as well
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char *name,
+                                                 uint32_t stack_depth, void *parameters,
+                                                 UBaseType_t priority, TaskHandle_t *created_task,
+                                                 BaseType_t core_id)
+{
+    return xTaskCreate(task_code, name, stack_depth, parameters, priority, created_task);
+}
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks_to_delay);
+TickType_t xTaskGetTickCount(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+// A notification counter per task
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+#endif // FREERTOS_TASK_H
@@ -0,0 +1,17 @@
+#ifndef FREERTOS_TIMERS_H
+#define FREERTOS_TIMERS_H
+
+#include "FreeRTOS.h"
+
+// Auto-reload software timers, one thread each
+
+typedef void *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t auto_reload,
+                           void *timer_id, TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif // FREERTOS_TIMERS_H
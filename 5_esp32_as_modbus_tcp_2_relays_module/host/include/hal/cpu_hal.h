@@ -0,0 +1,14 @@
+#ifndef HAL_CPU_HAL_H
+#define HAL_CPU_HAL_H
+
+#include <time.h>
+
+// Cycle counter of a CPU at CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ, from the monotonic clock
+static inline uint32_t cpu_hal_get_cycle_count(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000000000ULL + ts.tv_nsec) * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
+
+#endif // HAL_CPU_HAL_H
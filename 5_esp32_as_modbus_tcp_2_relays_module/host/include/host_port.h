@@ -0,0 +1,24 @@
+#ifndef HOST_PORT_H
+#define HOST_PORT_H
+
+// Minimal ESP-IDF surface for running the slave on Linux: just what main/ uses,
+// mapped onto POSIX threads and sockets. Force-included ahead of every source.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <errno.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK                          0
+#define ESP_FAIL                        -1
+#define ESP_ERR_NVS_NO_FREE_PAGES       0x1100
+#define ESP_ERR_NVS_NEW_VERSION_FOUND   0x1101
+
+#define ESP_ERROR_CHECK(x)              (void)(x)
+
+const char *esp_err_to_name(esp_err_t code);
+
+#endif // HOST_PORT_H
@@ -0,0 +1,8 @@
+#ifndef LAN8720_H
+#define LAN8720_H
+
+// The host is already on the network: this returns at once
+
+esp_err_t ethernet(int timeout);
+
+#endif // LAN8720_H
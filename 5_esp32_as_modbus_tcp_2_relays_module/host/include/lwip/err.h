@@ -0,0 +1,6 @@
+#ifndef LWIP_ERR_H
+#define LWIP_ERR_H
+
+// Not needed on the host
+
+#endif // LWIP_ERR_H
@@ -0,0 +1,18 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+// The lwIP socket API is the BSD one, apart from inet_ntoa_r
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define inet_ntoa_r(addr, buf, buflen) strncpy((buf), inet_ntoa(addr), (buflen))
+
+#endif // LWIP_SOCKETS_H
@@ -0,0 +1,6 @@
+#ifndef LWIP_SYS_H
+#define LWIP_SYS_H
+
+// Not needed on the host
+
+#endif // LWIP_SYS_H
@@ -0,0 +1 @@
+// Options come from -D flags in host/build.sh
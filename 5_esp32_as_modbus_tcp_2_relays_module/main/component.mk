@@ -2,3 +2,7 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
+
+ifdef CONFIG_MB_TLS_ENABLE
+COMPONENT_EMBED_TXTFILES := certs/ca.crt certs/server.crt certs/server.key
+endif
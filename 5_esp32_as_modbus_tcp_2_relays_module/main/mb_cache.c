@@ -0,0 +1,164 @@
+#include "sdkconfig.h"
+
+#if CONFIG_MB_CACHE_ENABLE
+
+#include <string.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "mb_cache.h"
+
+#define CACHE_ADU_MAX   32      // responses of the cached reads are a few bytes
+
+typedef struct {
+    bool valid;
+    uint8_t unit_id;
+    uint8_t function_code;
+    uint16_t start;
+    uint16_t quantity;
+    int64_t stored_at;          // us since boot
+    uint8_t length;
+    uint8_t adu[CACHE_ADU_MAX];
+} cache_entry_t;
+
+static cache_entry_t s_entries[CONFIG_MB_CACHE_ENTRIES];
+static uint32_t s_hits;
+static uint32_t s_misses;
+static uint32_t s_invalidations;
+static uint32_t s_generation;   // mb_cache_invalidate() calls, matching or not
+// Lookups come from the server task, invalidations also from the relay timers
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool cacheable(uint8_t function_code)
+{
+    return function_code == 0x01 || function_code == 0x02 || function_code == 0x03;
+}
+
+static cache_entry_t *find(const uint8_t *request)
+{
+    uint16_t start = (request[8] << 8) | request[9];
+    uint16_t quantity = (request[10] << 8) | request[11];
+
+    for (int i = 0; i < CONFIG_MB_CACHE_ENTRIES; i++) {
+        cache_entry_t *entry = &s_entries[i];
+        if (entry->valid && entry->unit_id == request[6] && entry->function_code == request[7] &&
+            entry->start == start && entry->quantity == quantity) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int mb_cache_lookup(const uint8_t *request, uint8_t *response)
+{
+    int length = 0;
+
+    if (!cacheable(request[7])) {
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    cache_entry_t *entry = find(request);
+    if (entry && now - entry->stored_at <= CONFIG_MB_CACHE_MAX_AGE_MS * 1000LL) {
+        length = entry->length;
+        memcpy(response, entry->adu, length);
+        s_hits++;
+    } else {
+        s_misses++;
+    }
+    portEXIT_CRITICAL(&s_lock);
+
+    if (length) {
+        response[0] = request[0];  // Transaction ID of this request
+        response[1] = request[1];
+    }
+    return length;
+}
+
+uint32_t mb_cache_generation(void)
+{
+    portENTER_CRITICAL(&s_lock);
+    uint32_t generation = s_generation;
+    portEXIT_CRITICAL(&s_lock);
+    return generation;
+}
+
+void mb_cache_store(const uint8_t *request, const uint8_t *response, int response_length, uint32_t generation)
+{
+    if (!cacheable(request[7]) || response[7] != request[7] || response_length > CACHE_ADU_MAX) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&s_lock);
+    // A relay timer switched something while the response was built; it found
+    // nothing to drop then, so the response must not be kept now
+    if (s_generation != generation) {
+        portEXIT_CRITICAL(&s_lock);
+        return;
+    }
+    // Refresh the entry for this request, else take a free or the oldest one
+    cache_entry_t *entry = find(request);
+    for (int i = 0; entry == NULL && i < CONFIG_MB_CACHE_ENTRIES; i++) {
+        if (!s_entries[i].valid) {
+            entry = &s_entries[i];
+        }
+    }
+    for (int i = 0; entry == NULL && i < CONFIG_MB_CACHE_ENTRIES; i++) {
+        if (i == 0 || s_entries[i].stored_at < entry->stored_at) {
+            entry = &s_entries[i];
+        }
+    }
+    entry->valid = true;
+    entry->unit_id = request[6];
+    entry->function_code = request[7];
+    entry->start = (request[8] << 8) | request[9];
+    entry->quantity = (request[10] << 8) | request[11];
+    entry->stored_at = now;
+    entry->length = response_length;
+    memcpy(entry->adu, response, response_length);
+    portEXIT_CRITICAL(&s_lock);
+}
+
+void mb_cache_invalidate(uint8_t function_code, uint16_t start, uint16_t quantity)
+{
+    portENTER_CRITICAL(&s_lock);
+    s_generation++;
+    for (int i = 0; i < CONFIG_MB_CACHE_ENTRIES; i++) {
+        cache_entry_t *entry = &s_entries[i];
+        if (entry->valid && entry->function_code == function_code &&
+            start < entry->start + entry->quantity && entry->start < start + quantity) {
+            entry->valid = false;
+            s_invalidations++;
+        }
+    }
+    portEXIT_CRITICAL(&s_lock);
+}
+
+uint8_t mb_cache_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_CACHE_REG_END - MB_CACHE_REG_BASE];
+
+    if (quantity == 0 || start < MB_CACHE_REG_BASE || start + quantity > MB_CACHE_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    portENTER_CRITICAL(&s_lock);
+    const uint32_t counters[] = { s_hits, s_misses, s_invalidations };
+    uint32_t lookups = s_hits + s_misses;
+    portEXIT_CRITICAL(&s_lock);
+
+    for (int i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        regs[2 * i] = counters[i] >> 16;
+        regs[2 * i + 1] = counters[i] & 0xFFFF;
+    }
+    regs[MB_CACHE_REG_HIT_RATE - MB_CACHE_REG_BASE] = lookups ? (uint64_t)counters[0] * 10000 / lookups : 0;
+
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start - MB_CACHE_REG_BASE + i] >> 8;
+        out[2 * i + 1] = regs[start - MB_CACHE_REG_BASE + i] & 0xFF;
+    }
+    return 0;
+}
+
+#endif // CONFIG_MB_CACHE_ENABLE
@@ -0,0 +1,39 @@
+#ifndef MB_CACHE_H
+#define MB_CACHE_H
+
+#include <stdint.h>
+
+// Response cache for repeated reads (CONFIG_MB_CACHE_ENABLE). Successful responses
+// to Read Coils, Read Discrete Inputs and Read Holding Registers are kept, keyed by
+// unit ID, function code, start address and quantity, for up to
+// CONFIG_MB_CACHE_MAX_AGE_MS. An identical poll inside that window is answered by
+// copying the stored ADU and patching in its transaction ID.
+//
+// Writes drop every entry of the same table whose range overlaps the written one.
+// Discrete inputs have no writes: they can lag the optocouplers by the max age.
+
+// Cache statistics as input registers (FC 0x04), 32-bit counters high word first
+#define MB_CACHE_REG_BASE           0x0030
+#define MB_CACHE_REG_HITS           0x0030
+#define MB_CACHE_REG_MISSES         0x0032
+#define MB_CACHE_REG_INVALIDATIONS  0x0034  // entries dropped by writes
+#define MB_CACHE_REG_HIT_RATE       0x0036  // 16 bit, 0.01 % of cacheable reads
+#define MB_CACHE_REG_END            0x0037
+
+// Copies a cached response for `request` into `response`; returns its length, 0 on a miss.
+int mb_cache_lookup(const uint8_t *request, uint8_t *response);
+
+// Counts invalidations. Take it before building a response to pass to mb_cache_store().
+uint32_t mb_cache_generation(void);
+
+// Keeps `response` if the request is a cacheable read and the response is not an
+// exception, unless an invalidation since `generation` may have made it stale.
+void mb_cache_store(const uint8_t *request, const uint8_t *response, int response_length, uint32_t generation);
+
+// Drops the entries read with `function_code` that overlap start..start+quantity-1.
+void mb_cache_invalidate(uint8_t function_code, uint16_t start, uint16_t quantity);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_cache_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+#endif // MB_CACHE_H
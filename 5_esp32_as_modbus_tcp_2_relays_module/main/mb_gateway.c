@@ -0,0 +1,392 @@
+#include "sdkconfig.h"
+
+#if CONFIG_MB_GATEWAY_ENABLE
+
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "modbus_tcp.h"
+#include "mb_server.h"
+#include "mb_rtu.h"
+#include "mb_gateway.h"
+
+#define GW_UART_BUF_SIZE        512
+#define GW_MAX_UNIT             247
+#define GW_CHAR_TIMEOUT_MS      20      // silence that ends a reply, one tick at 100 Hz plus margin
+#define GW_NONE                 -1
+#define GW_MAX_TIMINGS          8       // entries of CONFIG_MB_GATEWAY_UNIT_TIMING
+#define GW_MAX_TURNAROUND_US    100000
+
+static const char *TAG = "mb_gateway";
+
+typedef struct {
+    int next;                       // next request of the same slave, next completed one or next free entry
+    int conn;
+    uint32_t conn_id;
+    uint16_t transaction_id;
+    uint8_t unit_id;
+    uint8_t pdu_length;
+    uint8_t pdu[MB_TCP_ADU_MAX - MB_TCP_MBAP_SIZE];
+    uint8_t exception;              // set instead of a response PDU
+} gw_request_t;
+
+// A slave that answers or recovers more slowly than the rest
+typedef struct {
+    uint8_t unit_id;
+    uint16_t timeout_ms;            // first byte of the reply
+    uint32_t turnaround_us;         // bus silence after the exchange, at least the frame gap
+} gw_timing_t;
+
+static gw_request_t s_pool[CONFIG_MB_GATEWAY_MAX_PENDING];
+static int s_free;
+static int s_head[GW_MAX_UNIT + 1];
+static int s_tail[GW_MAX_UNIT + 1];
+static uint8_t s_depth[GW_MAX_UNIT + 1];
+static int s_pending;
+static uint8_t s_next_unit = 1;     // round robin position of the bus task
+
+static int s_done_head;             // completed requests, oldest first
+static int s_done_tail;
+
+static SemaphoreHandle_t s_lock;
+static TaskHandle_t s_bus_task;
+static int64_t s_bus_free_at;       // end of the inter-frame silence after the last frame
+static uint32_t s_frame_gap_us;
+static gw_timing_t s_timings[GW_MAX_TIMINGS];
+static int s_timing_count;
+
+static struct {
+    uint32_t forwarded;
+    uint32_t responses;
+    uint32_t timeouts;
+    uint32_t bad_frames;
+    uint32_t rejected;
+} s_stats;
+
+bool mb_gateway_forwards(uint8_t unit_id)
+{
+    return unit_id != 0x00 && unit_id <= GW_MAX_UNIT && unit_id != get_device_address();
+}
+
+uint8_t mb_gateway_submit(int conn, uint32_t conn_id, const uint8_t *adu, int adu_length)
+{
+    uint8_t unit_id = adu[6];
+    uint8_t exception = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_free == GW_NONE || s_depth[unit_id] >= CONFIG_MB_GATEWAY_QUEUE_DEPTH) {
+        s_stats.rejected++;
+        exception = 0x0A;  // Gateway path unavailable
+    } else {
+        int index = s_free;
+        gw_request_t *req = &s_pool[index];
+        s_free = req->next;
+
+        req->next = GW_NONE;
+        req->conn = conn;
+        req->conn_id = conn_id;
+        req->transaction_id = (adu[0] << 8) | adu[1];
+        req->unit_id = unit_id;
+        req->pdu_length = adu_length - MB_TCP_MBAP_SIZE;
+        memcpy(req->pdu, adu + MB_TCP_MBAP_SIZE, req->pdu_length);
+        req->exception = 0;
+
+        if (s_tail[unit_id] == GW_NONE) {
+            s_head[unit_id] = index;
+        } else {
+            s_pool[s_tail[unit_id]].next = index;
+        }
+        s_tail[unit_id] = index;
+        s_depth[unit_id]++;
+        s_pending++;
+    }
+    xSemaphoreGive(s_lock);
+
+    if (!exception) {
+        xTaskNotifyGive(s_bus_task);
+    }
+    return exception;
+}
+
+// Oldest request of the next slave in round robin order, GW_NONE if all queues are empty.
+static int next_request(void)
+{
+    int index = GW_NONE;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int n = 0; n < GW_MAX_UNIT; n++) {
+        uint8_t unit = s_next_unit;
+        s_next_unit = s_next_unit == GW_MAX_UNIT ? 1 : s_next_unit + 1;
+        if (s_head[unit] != GW_NONE) {
+            index = s_head[unit];
+            s_head[unit] = s_pool[index].next;
+            if (s_head[unit] == GW_NONE) {
+                s_tail[unit] = GW_NONE;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    return index;
+}
+
+// The timing of `unit_id`, the configured defaults unless CONFIG_MB_GATEWAY_UNIT_TIMING lists it
+static gw_timing_t unit_timing(uint8_t unit_id)
+{
+    for (int i = 0; i < s_timing_count; i++) {
+        if (s_timings[i].unit_id == unit_id) {
+            return s_timings[i];
+        }
+    }
+    return (gw_timing_t) {
+        .unit_id = unit_id,
+        .timeout_ms = CONFIG_MB_GATEWAY_RESPONSE_TIMEOUT_MS,
+        .turnaround_us = s_frame_gap_us,
+    };
+}
+
+// Reads one reply: up to `timeout_ms` for the first byte, then until the predicted
+// length, or until the line goes quiet for function codes of unknown length.
+static int read_reply(uint8_t *frame, uint16_t timeout_ms)
+{
+    int got = uart_read_bytes(CONFIG_MB_GATEWAY_UART_NUM, frame, 1, pdMS_TO_TICKS(timeout_ms));
+    if (got <= 0) {
+        return 0;
+    }
+    while (got < MB_RTU_FRAME_MAX) {
+        int expected = mb_rtu_response_length(frame, got);
+        if (expected > MB_RTU_FRAME_MAX) {
+            expected = -1;
+        }
+        if (expected > 0 && got >= expected) {
+            return expected;
+        }
+        int want = expected > 0 ? expected - got : expected == 0 ? 1 : MB_RTU_FRAME_MAX - got;
+        int len = uart_read_bytes(CONFIG_MB_GATEWAY_UART_NUM, frame + got, want, pdMS_TO_TICKS(GW_CHAR_TIMEOUT_MS));
+        if (len <= 0) {
+            break;
+        }
+        got += len;
+    }
+    return got;
+}
+
+static void transact(gw_request_t *req)
+{
+    uint8_t frame[MB_RTU_FRAME_MAX];
+    int length = mb_rtu_build_frame(req->unit_id, req->pdu, req->pdu_length, frame);
+    gw_timing_t timing = unit_timing(req->unit_id);
+
+    // Keep 3.5 character times of silence between frames on the bus. Whole ticks
+    // are slept, only the rest is spun, so a long turnaround of a slow slave does
+    // not keep this task above the server task busy.
+    int64_t wait_us = s_bus_free_at - esp_timer_get_time();
+    if (wait_us >= portTICK_PERIOD_MS * 1000) {
+        vTaskDelay(wait_us / (portTICK_PERIOD_MS * 1000));
+        wait_us = s_bus_free_at - esp_timer_get_time();
+    }
+    if (wait_us > 0) {
+        esp_rom_delay_us(wait_us);
+    }
+    // A late reply to an earlier, timed out request must not be taken for this one
+    uart_flush_input(CONFIG_MB_GATEWAY_UART_NUM);
+    uart_write_bytes(CONFIG_MB_GATEWAY_UART_NUM, (const char *)frame, length);
+    uart_wait_tx_done(CONFIG_MB_GATEWAY_UART_NUM, pdMS_TO_TICKS(100));
+    s_stats.forwarded++;
+
+    length = read_reply(frame, timing.timeout_ms);
+    s_bus_free_at = esp_timer_get_time() + timing.turnaround_us;
+
+    if (length == 0) {
+        ESP_LOGW(TAG, "Unit %d did not respond", req->unit_id);
+        s_stats.timeouts++;
+        req->exception = 0x0B;  // Gateway target device failed to respond
+    } else if (!mb_rtu_frame_valid(frame, length) || frame[0] != req->unit_id || (frame[1] & 0x7F) != req->pdu[0]) {
+        ESP_LOGW(TAG, "Bad reply from unit %d (%d bytes)", req->unit_id, length);
+        s_stats.bad_frames++;
+        req->exception = 0x0B;
+    } else {
+        s_stats.responses++;
+        req->pdu_length = length - 3;
+        memcpy(req->pdu, frame + 1, req->pdu_length);
+    }
+}
+
+static void mb_gateway_task(void *pvParameters)
+{
+    while (1) {
+        int index = next_request();
+        if (index == GW_NONE) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+        transact(&s_pool[index]);
+
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_pool[index].next = GW_NONE;
+        if (s_done_tail == GW_NONE) {
+            s_done_head = index;
+        } else {
+            s_pool[s_done_tail].next = index;
+        }
+        s_done_tail = index;
+        xSemaphoreGive(s_lock);
+    }
+}
+
+bool mb_gateway_peek_response(int after, int *response, int *conn, uint32_t *conn_id)
+{
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int index = after == MB_GATEWAY_OLDEST ? s_done_head : s_pool[after].next;
+    if (index != GW_NONE) {
+        *response = index;
+        *conn = s_pool[index].conn;
+        *conn_id = s_pool[index].conn_id;
+    }
+    xSemaphoreGive(s_lock);
+    return index != GW_NONE;
+}
+
+int mb_gateway_take_response(int response, uint8_t *adu)
+{
+    int index = response;
+    gw_request_t *req = &s_pool[index];
+    int pdu_length = req->exception ? 2 : req->pdu_length;
+
+    // No buffer when the client is gone: the response is dropped
+    if (adu != NULL) {
+        adu[0] = req->transaction_id >> 8;
+        adu[1] = req->transaction_id & 0xFF;
+        adu[2] = 0;
+        adu[3] = 0;
+        adu[4] = (pdu_length + 1) >> 8;
+        adu[5] = (pdu_length + 1) & 0xFF;
+        adu[6] = req->unit_id;
+        if (req->exception) {
+            adu[7] = req->pdu[0] | 0x80;
+            adu[8] = req->exception;
+        } else {
+            memcpy(adu + MB_TCP_MBAP_SIZE, req->pdu, pdu_length);
+        }
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    int prev = GW_NONE;
+    for (int i = s_done_head; i != index; i = s_pool[i].next) {
+        prev = i;
+    }
+    if (prev == GW_NONE) {
+        s_done_head = req->next;
+    } else {
+        s_pool[prev].next = req->next;
+    }
+    if (s_done_tail == index) {
+        s_done_tail = prev;
+    }
+    s_depth[req->unit_id]--;
+    s_pending--;
+    req->next = s_free;
+    s_free = index;
+    xSemaphoreGive(s_lock);
+
+    return MB_TCP_MBAP_SIZE + pdu_length;
+}
+
+int mb_gateway_pending(void)
+{
+    return s_pending;
+}
+
+uint8_t mb_gateway_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_GATEWAY_REG_END - MB_GATEWAY_REG_BASE];
+    const uint32_t counters[] = {
+        s_stats.forwarded, s_stats.responses, s_stats.timeouts, s_stats.bad_frames, s_stats.rejected,
+    };
+
+    if (quantity == 0 || start < MB_GATEWAY_REG_BASE || start + quantity > MB_GATEWAY_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        regs[2 * i] = counters[i] >> 16;
+        regs[2 * i + 1] = counters[i] & 0xFFFF;
+    }
+    regs[MB_GATEWAY_REG_PENDING - MB_GATEWAY_REG_BASE] = s_pending;
+
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start - MB_GATEWAY_REG_BASE + i] >> 8;
+        out[2 * i + 1] = regs[start - MB_GATEWAY_REG_BASE + i] & 0xFF;
+    }
+    return 0;
+}
+
+// CONFIG_MB_GATEWAY_UNIT_TIMING: "unit:timeout_ms[:turnaround_us],..."
+static void parse_timings(void)
+{
+    char timings[] = CONFIG_MB_GATEWAY_UNIT_TIMING;
+    char *save = NULL;
+
+    for (char *item = strtok_r(timings, ", ", &save); item && s_timing_count < GW_MAX_TIMINGS;
+         item = strtok_r(NULL, ", ", &save)) {
+        char *end;
+        long unit = strtol(item, &end, 10);
+        long timeout_ms = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+        long turnaround_us = *end == ':' ? strtol(end + 1, &end, 10) : 0;
+        if (*end != '\0' || unit < 1 || unit > GW_MAX_UNIT || timeout_ms < 1 || timeout_ms > 60000 ||
+            turnaround_us < 0 || turnaround_us > GW_MAX_TURNAROUND_US) {
+            ESP_LOGE(TAG, "Invalid unit timing \"%s\"", item);
+            continue;
+        }
+        gw_timing_t *timing = &s_timings[s_timing_count++];
+        timing->unit_id = unit;
+        timing->timeout_ms = timeout_ms;
+        timing->turnaround_us = turnaround_us > s_frame_gap_us ? turnaround_us : s_frame_gap_us;
+        ESP_LOGI(TAG, "Unit %d: %d ms timeout, %d us turnaround", timing->unit_id, timing->timeout_ms,
+                 (int)timing->turnaround_us);
+    }
+}
+
+void mb_gateway_init(void)
+{
+    uart_config_t uart_config = {
+        .baud_rate = CONFIG_MB_GATEWAY_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity    = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .source_clk = UART_SCLK_APB,
+    };
+
+    ESP_ERROR_CHECK(uart_driver_install(CONFIG_MB_GATEWAY_UART_NUM, GW_UART_BUF_SIZE, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(CONFIG_MB_GATEWAY_UART_NUM, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(CONFIG_MB_GATEWAY_UART_NUM, CONFIG_MB_GATEWAY_TXD_PIN, CONFIG_MB_GATEWAY_RXD_PIN,
+                                 CONFIG_MB_GATEWAY_RTS_PIN, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_set_mode(CONFIG_MB_GATEWAY_UART_NUM, UART_MODE_RS485_HALF_DUPLEX));
+
+    // 3.5 characters of 11 bits, fixed at 1750 us above 19200 baud as the spec allows
+    s_frame_gap_us = CONFIG_MB_GATEWAY_BAUD_RATE > 19200 ? 1750 : 38500000 / CONFIG_MB_GATEWAY_BAUD_RATE;
+    parse_timings();
+
+    s_free = 0;
+    for (int i = 0; i < CONFIG_MB_GATEWAY_MAX_PENDING; i++) {
+        s_pool[i].next = i + 1 < CONFIG_MB_GATEWAY_MAX_PENDING ? i + 1 : GW_NONE;
+    }
+    for (int unit = 0; unit <= GW_MAX_UNIT; unit++) {
+        s_head[unit] = GW_NONE;
+        s_tail[unit] = GW_NONE;
+    }
+    s_done_head = GW_NONE;
+    s_done_tail = GW_NONE;
+
+    s_lock = xSemaphoreCreateMutex();
+    xTaskCreate(mb_gateway_task, "mb_gateway_task", 3072, NULL, 6, &s_bus_task);
+    ESP_LOGI(TAG, "Forwarding to RS-485 on UART%d at %d baud", CONFIG_MB_GATEWAY_UART_NUM, CONFIG_MB_GATEWAY_BAUD_RATE);
+}
+
+#endif // CONFIG_MB_GATEWAY_ENABLE
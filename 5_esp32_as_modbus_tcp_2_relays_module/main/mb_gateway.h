@@ -0,0 +1,47 @@
+#ifndef MB_GATEWAY_H
+#define MB_GATEWAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Modbus TCP to RTU gateway (CONFIG_MB_GATEWAY_ENABLE). Requests for unit IDs
+// other than this module's own address are queued per downstream slave and sent
+// on the RS-485 port by one bus task, which serves the slaves round robin. The
+// answer goes back to the connection the request came from with the original
+// transaction ID; a timeout or a corrupt reply becomes exception 0x0B, a full
+// queue exception 0x0A. Slow slaves can get their own response timeout and bus
+// turnaround time (CONFIG_MB_GATEWAY_UNIT_TIMING).
+
+// Gateway statistics as input registers (FC 0x04), 32-bit counters high word first
+#define MB_GATEWAY_REG_BASE         0x0020
+#define MB_GATEWAY_REG_FORWARDED    0x0020
+#define MB_GATEWAY_REG_RESPONSES    0x0022
+#define MB_GATEWAY_REG_TIMEOUTS     0x0024
+#define MB_GATEWAY_REG_BAD_FRAMES   0x0026  // CRC, address or function code mismatch
+#define MB_GATEWAY_REG_REJECTED     0x0028  // queue full
+#define MB_GATEWAY_REG_PENDING      0x002A  // 16 bit, requests queued or on the bus
+#define MB_GATEWAY_REG_END          0x002B
+
+void mb_gateway_init(void);
+
+// True if requests for this unit ID go to the RS-485 port.
+bool mb_gateway_forwards(uint8_t unit_id);
+
+// Queues a request ADU for its slave. `conn` and `conn_id` identify the client
+// connection. Returns 0 or a Modbus exception code to answer with right away.
+uint8_t mb_gateway_submit(int conn, uint32_t conn_id, const uint8_t *adu, int adu_length);
+
+#define MB_GATEWAY_OLDEST           -1
+
+// Completed transactions, oldest first. Peek at the one after `after` (the oldest
+// for MB_GATEWAY_OLDEST) to learn the connection it is for, then take its response
+// ADU (returns the length; NULL drops it) or leave it and peek past it.
+bool mb_gateway_peek_response(int after, int *response, int *conn, uint32_t *conn_id);
+int mb_gateway_take_response(int response, uint8_t *adu);
+
+int mb_gateway_pending(void);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_gateway_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+#endif // MB_GATEWAY_H
@@ -0,0 +1,168 @@
+#include "sdkconfig.h"
+
+#if CONFIG_MB_LATENCY_ENABLE
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "mb_latency.h"
+
+#define HIST_COUNT      (MB_LATENCY_FC_SLOTS + CONFIG_MB_TCP_MAX_CONNECTIONS)
+
+static const char *TAG = "mb_latency";
+
+typedef struct {
+    uint32_t buckets[MB_LATENCY_BUCKETS];
+    uint32_t max_us;
+} latency_hist_t;
+
+static const uint8_t s_function_codes[] = MB_LATENCY_FC_LIST;
+static const char *const s_stage_names[MB_LATENCY_STAGES] = { "queue", "handler", "send", "total" };
+
+// Function code slots first, then one per client slot. Only the server task
+// writes; the HTTP task reads 32-bit words, which cannot tear.
+static latency_hist_t s_hists[HIST_COUNT][MB_LATENCY_STAGES];
+static char s_client_addr[CONFIG_MB_TCP_MAX_CONNECTIONS][16];
+
+static int fc_slot(uint8_t function_code)
+{
+    for (int i = 0; i < sizeof(s_function_codes); i++) {
+        if (s_function_codes[i] == function_code) {
+            return i;
+        }
+    }
+    return MB_LATENCY_FC_SLOTS - 1;
+}
+
+static void add(latency_hist_t *hist, int bucket, uint32_t us)
+{
+    hist->buckets[bucket]++;
+    if (us > hist->max_us) {
+        hist->max_us = us;
+    }
+}
+
+void mb_latency_record(int client, uint8_t function_code, int stage, uint32_t cycles)
+{
+    uint32_t us = cycles / CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+    int bucket = 0;
+
+    if (us >= 16) {
+        bucket = 32 - __builtin_clz(us >> 4);
+        if (bucket >= MB_LATENCY_BUCKETS) {
+            bucket = MB_LATENCY_BUCKETS - 1;
+        }
+    }
+    add(&s_hists[fc_slot(function_code & 0x7F)][stage], bucket, us);
+    add(&s_hists[MB_LATENCY_FC_SLOTS + client][stage], bucket, us);
+}
+
+void mb_latency_client_reset(int client, const char *addr)
+{
+    memset(s_hists[MB_LATENCY_FC_SLOTS + client], 0, sizeof(s_hists[0]));
+    strncpy(s_client_addr[client], addr, sizeof(s_client_addr[0]) - 1);
+}
+
+uint8_t mb_latency_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    if (quantity == 0 || start < MB_LATENCY_REG_BASE || start + quantity > MB_LATENCY_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < quantity; i++) {
+        int offset = start + i - MB_LATENCY_REG_BASE;
+        const latency_hist_t *hist = &s_hists[offset / MB_LATENCY_REG_HIST_STRIDE]
+                                              [offset % MB_LATENCY_REG_HIST_STRIDE / MB_LATENCY_REG_STAGE_STRIDE];
+        int reg = offset % MB_LATENCY_REG_STAGE_STRIDE;
+        uint32_t value = 0;
+        if (reg < 2 * MB_LATENCY_BUCKETS) {
+            value = hist->buckets[reg / 2];
+        } else if (reg < MB_LATENCY_REG_MAX_US + 2) {
+            value = hist->max_us;
+        }
+        uint16_t word = reg % 2 ? value & 0xFFFF : value >> 16;
+        out[2 * i] = word >> 8;
+        out[2 * i + 1] = word & 0xFF;
+    }
+    return 0;
+}
+
+static bool hist_empty(int h)
+{
+    // Every span lands in the total, or in the queue for gateway requests
+    for (int b = 0; b < MB_LATENCY_BUCKETS; b++) {
+        if (s_hists[h][MB_LATENCY_STAGE_QUEUE].buckets[b] || s_hists[h][MB_LATENCY_STAGE_TOTAL].buckets[b]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One chunk per histogram, so the page never needs more than a small buffer
+static esp_err_t latency_get_handler(httpd_req_t *req)
+{
+    char buf[1024];     // one histogram with every counter at 10 digits fits
+    int len;
+    bool first = true;
+
+    httpd_resp_set_type(req, "application/json");
+    len = snprintf(buf, sizeof(buf), "{\"bucket_us\":[");
+    for (int b = 0; b < MB_LATENCY_BUCKETS - 1; b++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%d", b ? "," : "", 16 << b);
+    }
+    len += snprintf(buf + len, sizeof(buf) - len, ",null],\"histograms\":[");
+    httpd_resp_send_chunk(req, buf, len);
+
+    for (int h = 0; h < HIST_COUNT; h++) {
+        if (hist_empty(h)) {
+            continue;
+        }
+        if (h < MB_LATENCY_FC_SLOTS) {
+            len = snprintf(buf, sizeof(buf), "%s{\"function_code\":%d", first ? "" : ",",
+                           h < sizeof(s_function_codes) ? s_function_codes[h] : -1);
+        } else {
+            len = snprintf(buf, sizeof(buf), "%s{\"client\":%d,\"addr\":\"%s\"", first ? "" : ",",
+                           h - MB_LATENCY_FC_SLOTS, s_client_addr[h - MB_LATENCY_FC_SLOTS]);
+        }
+        for (int s = 0; s < MB_LATENCY_STAGES; s++) {
+            const latency_hist_t *hist = &s_hists[h][s];
+            len += snprintf(buf + len, sizeof(buf) - len, ",\"%s\":{\"max_us\":%u,\"counts\":[",
+                            s_stage_names[s], (unsigned)hist->max_us);
+            for (int b = 0; b < MB_LATENCY_BUCKETS; b++) {
+                len += snprintf(buf + len, sizeof(buf) - len, "%s%u", b ? "," : "", (unsigned)hist->buckets[b]);
+            }
+            len += snprintf(buf + len, sizeof(buf) - len, "]}");
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "}");
+        httpd_resp_send_chunk(req, buf, len);
+        first = false;
+    }
+    httpd_resp_send_chunk(req, "]}", 2);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+void mb_latency_http_start(void)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    httpd_handle_t server = NULL;
+
+    // The Modbus clients need the lwIP sockets more than this page does
+    config.server_port = CONFIG_MB_LATENCY_HTTP_PORT;
+    config.max_open_sockets = 1;
+    config.max_uri_handlers = 1;
+
+    if (httpd_start(&server, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Unable to start the HTTP server on port %d", CONFIG_MB_LATENCY_HTTP_PORT);
+        return;
+    }
+    httpd_uri_t latency = {
+        .uri = "/latency",
+        .method = HTTP_GET,
+        .handler = latency_get_handler,
+        .user_ctx = NULL,
+    };
+    httpd_register_uri_handler(server, &latency);
+    ESP_LOGI(TAG, "Latency histograms on http://<module>:%d/latency", CONFIG_MB_LATENCY_HTTP_PORT);
+}
+
+#endif // CONFIG_MB_LATENCY_ENABLE
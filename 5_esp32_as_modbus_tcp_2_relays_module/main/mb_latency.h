@@ -0,0 +1,67 @@
+#ifndef MB_LATENCY_H
+#define MB_LATENCY_H
+
+#include <stdint.h>
+#include "hal/cpu_hal.h"
+
+// Transaction latency histograms of the TCP server (CONFIG_MB_LATENCY_ENABLE).
+// Every ADU is stamped with the CPU cycle counter when the recv() that completed
+// it returned, when it is dispatched, when its response is built and when the
+// last byte of that response has been handed to lwIP. The spans between the
+// stamps go into fixed log2 buckets, kept per function code and per client slot:
+//
+//   queue     receive -> dispatch: waiting behind other clients, writes or TX space
+//   handler   dispatch -> response built
+//   send      response built -> send() took its last byte
+//   total     receive -> send() took its last byte
+//
+// Requests forwarded by the gateway only have a queue span. Client histograms
+// start over when a new client takes the slot.
+
+#define MB_LATENCY_STAGE_QUEUE      0
+#define MB_LATENCY_STAGE_HANDLER    1
+#define MB_LATENCY_STAGE_SEND       2
+#define MB_LATENCY_STAGE_TOTAL      3
+#define MB_LATENCY_STAGES           4
+
+// Bucket 0 is under 16 us, bucket n covers 16 << (n - 1) up to 16 << n us,
+// the last one is everything from 16.4 ms
+#define MB_LATENCY_BUCKETS          12
+
+// Function codes with a histogram of their own, in register order; the rest share the last
+#define MB_LATENCY_FC_LIST          { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x0F, 0x10 }
+#define MB_LATENCY_FC_SLOTS         9
+
+// Histograms as input registers (FC 0x04), from MB_LATENCY_REG_BASE:
+//   histogram h * 0x80 (function code slots, then client slots)
+//   + stage * 0x20
+//   + bucket * 2      count, 32 bit high word first
+//   + 0x18            largest span in us, 32 bit
+// Registers in the gaps read as 0.
+#define MB_LATENCY_REG_BASE         0x0100
+#define MB_LATENCY_REG_HIST_STRIDE  0x80
+#define MB_LATENCY_REG_STAGE_STRIDE 0x20
+#define MB_LATENCY_REG_MAX_US       0x18
+#define MB_LATENCY_REG_END          (MB_LATENCY_REG_BASE + \
+                                     (MB_LATENCY_FC_SLOTS + CONFIG_MB_TCP_MAX_CONNECTIONS) * MB_LATENCY_REG_HIST_STRIDE)
+
+// One read of the cycle counter, cheap enough for every stage of every request.
+// The counter is per core: stamps are only comparable within the pinned server task.
+static inline uint32_t mb_latency_stamp(void)
+{
+    return cpu_hal_get_cycle_count();
+}
+
+// Adds the span `cycles` of `stage` to the histograms of the function code and the client slot.
+void mb_latency_record(int client, uint8_t function_code, int stage, uint32_t cycles);
+
+// Clears the histograms of a client slot for the client at `addr`.
+void mb_latency_client_reset(int client, const char *addr);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_latency_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+// Serves the histograms as JSON on GET /latency, port CONFIG_MB_LATENCY_HTTP_PORT.
+void mb_latency_http_start(void);
+
+#endif // MB_LATENCY_H
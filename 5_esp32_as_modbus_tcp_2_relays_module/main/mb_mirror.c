@@ -0,0 +1,299 @@
+#include "sdkconfig.h"
+
+#if CONFIG_MB_MIRROR_ENABLE
+
+#include <string.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "modbus_tcp.h"
+#include "mb_mirror.h"
+
+#define MIRROR_MAX_PEERS        4
+#define MIRROR_RETRY_MS         2000    // between connection attempts to an unreachable peer
+
+#if CONFIG_MB_MIRROR_SOURCE_INPUTS
+#define MIRROR_SOURCE_NAME      "inputs"
+#else
+#define MIRROR_SOURCE_NAME      "relays"
+#endif
+
+static const char *TAG = "mb_mirror";
+
+typedef struct {
+    struct sockaddr_in addr;
+    int sock;                       // -1 while not connected
+    TickType_t retry_at;
+    TickType_t written_at;
+    uint16_t transaction_id;
+    int sent_state;                 // state the peer acknowledged, -1 = unknown
+} mb_peer_t;
+
+static mb_peer_t s_peers[MIRROR_MAX_PEERS];
+static int s_peer_count;
+static TaskHandle_t s_task;
+static volatile int64_t s_changed_at;   // first change not written yet, 0 = none
+
+static struct {
+    uint32_t writes;
+    uint32_t failures;
+    uint32_t connects;
+    uint32_t last_us;
+    uint32_t max_us;
+} s_stats;
+
+static uint8_t mirrored_state(void)
+{
+#if CONFIG_MB_MIRROR_SOURCE_INPUTS
+    return read_optocoupler_status();
+#else
+    return read_relay_status(0) | (read_relay_status(1) << 1);
+#endif
+}
+
+void mb_mirror_notify(void)
+{
+    if (s_task == NULL) {
+        return;
+    }
+    if (s_changed_at == 0) {
+        s_changed_at = esp_timer_get_time();
+    }
+    xTaskNotifyGive(s_task);
+}
+
+void IRAM_ATTR mb_mirror_input_isr(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+
+    if (s_task == NULL) {
+        return;
+    }
+    if (s_changed_at == 0) {
+        s_changed_at = esp_timer_get_time();
+    }
+    vTaskNotifyGiveFromISR(s_task, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void peer_close(mb_peer_t *peer)
+{
+    close(peer->sock);
+    peer->sock = -1;
+    peer->sent_state = -1;
+    peer->retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(MIRROR_RETRY_MS);
+}
+
+// Connects within the write timeout, so an unreachable peer cannot hold up the others.
+static bool peer_connect(mb_peer_t *peer)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        return false;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(sock, (struct sockaddr *)&peer->addr, sizeof(peer->addr)) != 0 && errno != EINPROGRESS) {
+        close(sock);
+        return false;
+    }
+
+    fd_set write_set;
+    FD_ZERO(&write_set);
+    FD_SET(sock, &write_set);
+    struct timeval timeout = {
+        .tv_sec = CONFIG_MB_MIRROR_TIMEOUT_MS / 1000,
+        .tv_usec = (CONFIG_MB_MIRROR_TIMEOUT_MS % 1000) * 1000,
+    };
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (select(sock + 1, NULL, &write_set, NULL, &timeout) != 1 ||
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+        close(sock);
+        return false;
+    }
+
+    // Blocking from here, bounded by the timeouts
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    peer->sock = sock;
+    s_stats.connects++;
+    ESP_LOGI(TAG, "Connected to peer %s:%d", inet_ntoa(peer->addr.sin_addr), ntohs(peer->addr.sin_port));
+    return true;
+}
+
+static bool recv_exact(int sock, uint8_t *buf, int length)
+{
+    for (int got = 0; got < length; ) {
+        int len = recv(sock, buf + got, length - got, 0);
+        if (len <= 0) {
+            return false;
+        }
+        got += len;
+    }
+    return true;
+}
+
+// Writes `state` to coils 0-7 of the peer and waits for the acknowledgement.
+static bool peer_write(mb_peer_t *peer, uint8_t state)
+{
+    uint8_t adu[14];
+    uint8_t response[16];   // the echo of a write is 12 bytes
+
+    peer->transaction_id++;
+    adu[0] = peer->transaction_id >> 8;
+    adu[1] = peer->transaction_id & 0xFF;
+    adu[2] = 0;
+    adu[3] = 0;
+    adu[4] = 0;
+    adu[5] = 8;
+    adu[6] = CONFIG_MB_MIRROR_UNIT_ID;
+    adu[7] = 0x0F;      // Write Multiple Coils
+    adu[8] = 0;
+    adu[9] = 0;         // Start address
+    adu[10] = 0;
+    adu[11] = 8;        // Quantity
+    adu[12] = 1;        // Byte count
+    adu[13] = state;
+
+    if (send(peer->sock, adu, sizeof(adu), 0) != sizeof(adu) || !recv_exact(peer->sock, response, 7)) {
+        return false;
+    }
+    int length = (response[4] << 8) | response[5];
+    if (length < 2 || length > (int)sizeof(response) - 6 || !recv_exact(peer->sock, response + 7, length - 1)) {
+        return false;
+    }
+    if (memcmp(response, adu, 2) != 0) {
+        return false;
+    }
+    if (response[7] != 0x0F) {
+        ESP_LOGW(TAG, "Peer %s answered exception 0x%02X", inet_ntoa(peer->addr.sin_addr), response[8]);
+        return false;
+    }
+    return true;
+}
+
+static void mb_mirror_task(void *pvParameters)
+{
+    TickType_t wait = 0;    // bring the peers in line at once after boot
+
+    while (1) {
+        // Wake on a change, or to reconnect and refresh the peers
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = pdMS_TO_TICKS(CONFIG_MB_MIRROR_REFRESH_MS);
+        int64_t changed_at = s_changed_at;
+        s_changed_at = 0;
+        uint8_t state = mirrored_state();
+        TickType_t now = xTaskGetTickCount();
+
+        for (int i = 0; i < s_peer_count; i++) {
+            mb_peer_t *peer = &s_peers[i];
+            // The refresh also keeps the connection inside the peer's idle timeout
+            bool refresh = now - peer->written_at >= pdMS_TO_TICKS(CONFIG_MB_MIRROR_REFRESH_MS);
+            if (peer->sent_state == state && !refresh) {
+                continue;
+            }
+            if (peer->sock < 0) {
+                if ((int32_t)(now - peer->retry_at) < 0 || !peer_connect(peer)) {
+                    if ((int32_t)(now - peer->retry_at) >= 0) {
+                        peer->retry_at = now + pdMS_TO_TICKS(MIRROR_RETRY_MS);
+                    }
+                    // Come back for this peer without waiting for another change
+                    wait = pdMS_TO_TICKS(MIRROR_RETRY_MS);
+                    continue;
+                }
+            }
+
+            if (!peer_write(peer, state)) {
+                s_stats.failures++;
+                ESP_LOGW(TAG, "Write to peer %s failed, reconnecting", inet_ntoa(peer->addr.sin_addr));
+                peer_close(peer);
+                wait = pdMS_TO_TICKS(MIRROR_RETRY_MS);
+                continue;
+            }
+            peer->sent_state = state;
+            peer->written_at = now;
+            s_stats.writes++;
+            if (changed_at) {
+                s_stats.last_us = esp_timer_get_time() - changed_at;
+                if (s_stats.last_us > s_stats.max_us) {
+                    s_stats.max_us = s_stats.last_us;
+                }
+            }
+        }
+    }
+}
+
+// CONFIG_MB_MIRROR_PEERS: "ip[:port],ip[:port],..."
+static void parse_peers(void)
+{
+    char peers[] = CONFIG_MB_MIRROR_PEERS;
+    char *save = NULL;
+
+    for (char *item = strtok_r(peers, ", ", &save); item && s_peer_count < MIRROR_MAX_PEERS;
+         item = strtok_r(NULL, ", ", &save)) {
+        mb_peer_t *peer = &s_peers[s_peer_count];
+        char *port = strchr(item, ':');
+        if (port) {
+            *port++ = '\0';
+        }
+        memset(peer, 0, sizeof(*peer));
+        peer->addr.sin_family = AF_INET;
+        peer->addr.sin_port = htons(port ? atoi(port) : 502);
+        if (inet_pton(AF_INET, item, &peer->addr.sin_addr) != 1) {
+            ESP_LOGE(TAG, "Invalid peer address \"%s\"", item);
+            continue;
+        }
+        peer->sock = -1;
+        peer->sent_state = -1;
+        s_peer_count++;
+    }
+}
+
+uint8_t mb_mirror_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_MIRROR_REG_END - MB_MIRROR_REG_BASE];
+    const uint32_t values[] = {
+        s_stats.writes, s_stats.failures, s_stats.connects, s_stats.last_us, s_stats.max_us,
+    };
+
+    if (quantity == 0 || start < MB_MIRROR_REG_BASE || start + quantity > MB_MIRROR_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        regs[2 * i] = values[i] >> 16;
+        regs[2 * i + 1] = values[i] & 0xFFFF;
+    }
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start - MB_MIRROR_REG_BASE + i] >> 8;
+        out[2 * i + 1] = regs[start - MB_MIRROR_REG_BASE + i] & 0xFF;
+    }
+    return 0;
+}
+
+bool mb_mirror_init(void)
+{
+    parse_peers();
+    if (s_peer_count == 0) {
+        ESP_LOGW(TAG, "No peers configured, mirroring disabled");
+        return false;
+    }
+    // Above the server task: a change should reach the peers before more polls are answered
+    if (xTaskCreate(mb_mirror_task, "mb_mirror_task", 3072, NULL, 6, &s_task) != pdPASS) {
+        ESP_LOGE(TAG, "Unable to create the mirror task");
+        s_task = NULL;
+        return false;
+    }
+    ESP_LOGI(TAG, "Mirroring %s to %d peer(s)", MIRROR_SOURCE_NAME, s_peer_count);
+    return true;
+}
+
+#endif // CONFIG_MB_MIRROR_ENABLE
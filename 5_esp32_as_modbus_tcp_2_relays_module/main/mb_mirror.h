@@ -0,0 +1,32 @@
+#ifndef MB_MIRROR_H
+#define MB_MIRROR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Peer-to-peer mirroring (CONFIG_MB_MIRROR_ENABLE): a Modbus TCP client task keeps
+// a connection to each peer in CONFIG_MB_MIRROR_PEERS and writes this module's
+// optocoupler inputs or relay states to the peer's relays (FC 0x0F, coils 0-7) as
+// soon as they change. Changes that come in while a write is on the way are
+// coalesced into the next one, which always carries the latest state.
+
+// Mirror statistics as input registers (FC 0x04), 32-bit values high word first
+#define MB_MIRROR_REG_BASE          0x0040
+#define MB_MIRROR_REG_WRITES        0x0040  // writes acknowledged by a peer
+#define MB_MIRROR_REG_FAILURES      0x0042  // timeouts, exceptions, lost connections
+#define MB_MIRROR_REG_CONNECTS      0x0044
+#define MB_MIRROR_REG_LAST_US       0x0046  // change to peer acknowledgement, last write
+#define MB_MIRROR_REG_MAX_US        0x0048  // the same, worst case
+#define MB_MIRROR_REG_END           0x004A
+
+// Starts the mirror task; false when there is nothing to mirror to.
+bool mb_mirror_init(void);
+
+// Wakes the mirror task after a relay change; the ISR variant for input edges.
+void mb_mirror_notify(void);
+void mb_mirror_input_isr(void *arg);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_mirror_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+#endif // MB_MIRROR_H
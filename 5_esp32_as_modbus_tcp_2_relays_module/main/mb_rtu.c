@@ -0,0 +1,76 @@
+#include "mb_rtu.h"
+
+uint16_t mb_rtu_crc16(const uint8_t *data, int length)
+{
+    uint16_t crc = 0xFFFF;
+
+    for (int pos = 0; pos < length; pos++) {
+        crc ^= (uint16_t)data[pos];
+
+        for (int i = 8; i != 0; i--) {
+            if ((crc & 0x0001) != 0) {
+                crc >>= 1;
+                crc ^= 0xA001;
+            }
+            else
+                crc >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+int mb_rtu_build_frame(uint8_t unit_id, const uint8_t *pdu, int pdu_length, uint8_t *frame)
+{
+    frame[0] = unit_id;
+    for (int i = 0; i < pdu_length; i++) {
+        frame[1 + i] = pdu[i];
+    }
+    uint16_t crc = mb_rtu_crc16(frame, 1 + pdu_length);
+    frame[1 + pdu_length] = crc & 0xFF;
+    frame[2 + pdu_length] = crc >> 8;
+    return 3 + pdu_length;
+}
+
+bool mb_rtu_frame_valid(const uint8_t *frame, int length)
+{
+    if (length < 4) {
+        return false;
+    }
+    uint16_t crc = mb_rtu_crc16(frame, length - 2);
+    return frame[length - 2] == (crc & 0xFF) && frame[length - 1] == (crc >> 8);
+}
+
+int mb_rtu_response_length(const uint8_t *frame, int length)
+{
+    if (length < 2) {
+        return 0;
+    }
+    if (frame[1] & 0x80) {
+        return 5;  // address, function code, exception code, CRC
+    }
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04:
+        case 0x14: case 0x15: case 0x17:
+            return length < 3 ? 0 : 5 + frame[2];
+        case 0x05: case 0x06: case 0x0F: case 0x10:
+            return 8;
+        default:
+            return -1;
+    }
+}
+
+int mb_rtu_request_length(const uint8_t *frame, int length)
+{
+    if (length < 2) {
+        return 0;
+    }
+    switch (frame[1]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05: case 0x06:
+            return 8;
+        case 0x0F: case 0x10:
+            return length < 7 ? 0 : 9 + frame[6];
+        default:
+            return -1;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef MB_RTU_H
+#define MB_RTU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MB_RTU_FRAME_MAX    256     // address + PDU (253) + CRC
+
+// Modbus CRC-16, the low byte goes on the wire first.
+uint16_t mb_rtu_crc16(const uint8_t *data, int length);
+
+// Builds address + PDU + CRC into `frame`, returns the frame length.
+int mb_rtu_build_frame(uint8_t unit_id, const uint8_t *pdu, int pdu_length, uint8_t *frame);
+
+// Checks the length and CRC of a complete frame.
+bool mb_rtu_frame_valid(const uint8_t *frame, int length);
+
+// Length of a slave response from its first bytes: 0 if more bytes are needed to
+// tell, -1 for function codes whose length is not known in advance.
+int mb_rtu_response_length(const uint8_t *frame, int length);
+
+// The same for a master request.
+int mb_rtu_request_length(const uint8_t *frame, int length);
+
+#endif // MB_RTU_H
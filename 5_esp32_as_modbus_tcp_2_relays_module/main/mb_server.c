@@ -0,0 +1,1117 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+#include "modbus_tcp.h"
+#include "mb_server.h"
+#include "mb_gateway.h"
+#include "mb_rtu.h"
+#include "mb_latency.h"
+#include "mb_tls.h"
+
+#define MB_UDP_BATCH        8       // datagrams answered per wakeup before the TCP clients get a turn
+#define MB_LATENCY_PENDING  8       // responses per connection timed until sent
+#define MB_ACCEPT_PAUSE_MS  100     // listeners left alone after an accept() refused for lack of sockets
+
+static const char *TAG = "mb_server";
+
+// lwIP sockets of the server: the listeners, every client slot and one more, so a
+// client can still be accepted at the limit and take the least active one's slot.
+// TLS handshakes in progress hold a socket of their own until they are adopted.
+#define MB_SERVER_LISTENERS (1 + MB_RTU_TCP_SOCKETS + MB_UDP_SOCKETS + MB_TLS_SOCKETS)
+#define MB_SERVER_SOCKETS   (MB_SERVER_LISTENERS + CONFIG_MB_TCP_MAX_CONNECTIONS + 1)
+#if CONFIG_MB_RTU_TCP_ENABLE
+#define MB_RTU_TCP_SOCKETS  1
+#else
+#define MB_RTU_TCP_SOCKETS  0
+#endif
+#if CONFIG_MB_UDP_ENABLE
+#define MB_UDP_SOCKETS      1
+#else
+#define MB_UDP_SOCKETS      0
+#endif
+#if CONFIG_MB_TLS_ENABLE
+#define MB_TLS_SOCKETS      (1 + CONFIG_MB_TLS_MAX_HANDSHAKES)
+#else
+#define MB_TLS_SOCKETS      0
+#endif
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+_Static_assert(MB_SERVER_SOCKETS <= CONFIG_LWIP_MAX_SOCKETS,
+               "raise LWIP_MAX_SOCKETS or lower MB_TCP_MAX_CONNECTIONS");
+#endif
+
+// Token bucket, in thousandths of a request so slow rates refill smoothly
+typedef struct {
+    uint32_t tokens;
+    TickType_t refilled;
+} mb_bucket_t;
+
+#if CONFIG_MB_LATENCY_ENABLE
+// A response in the TX buffer whose send is still to be timed
+typedef struct {
+    uint16_t end;                   // tx_buf offset just past the response
+    uint8_t function_code;
+    uint32_t received;              // cycle counter stamps
+    uint32_t handled;
+} mb_timed_t;
+
+// Data of one recv() still in the RX buffer, so each request is timed from the
+// segment that completed it rather than from the connection's last recv()
+typedef struct {
+    uint16_t end;                   // rx_buf offset just past the segment
+    uint32_t stamp;
+} mb_segment_t;
+#endif
+
+typedef struct {
+    int sock;                       // -1 = free slot
+    uint32_t id;                    // tells gateway replies for an earlier client of the slot apart
+    bool rtu;                       // RTU frames with CRC instead of MBAP (CONFIG_MB_RTU_TCP_ENABLE)
+    uint8_t iface;                  // MB_IFACE_ETH or MB_IFACE_WIFI
+#if CONFIG_MB_TLS_ENABLE
+    mb_tls_session_t *tls;          // Modbus/TCP Security client, NULL for plain TCP
+#endif
+    char addr[16];
+    uint8_t *rx_buf;                // MB_TCP_BUF_SIZE, bound from the pool on accept
+    int rx_len;                     // bytes of ADUs not answered yet
+    uint8_t *tx_buf;                // MB_TCP_BUF_SIZE
+    int tx_len;                     // responses waiting to be sent
+    int tx_sent;                    // part of tx_buf already handed to the stack
+    TickType_t last_active;         // last request received
+    mb_bucket_t read_bucket;
+    mb_bucket_t write_bucket;
+    uint32_t requests;
+    uint32_t recvs;
+    uint32_t sends;
+#if CONFIG_MB_LATENCY_ENABLE
+    mb_segment_t segments[MB_LATENCY_PENDING];
+    int segment_count;
+    mb_timed_t timed[MB_LATENCY_PENDING];
+    int timed_count;
+#endif
+} mb_conn_t;
+
+// RX and TX buffers of one connection
+typedef struct {
+    uint8_t rx[MB_TCP_BUF_SIZE];
+    uint8_t tx[MB_TCP_BUF_SIZE];
+} mb_buffers_t;
+
+static mb_conn_t s_conns[CONFIG_MB_TCP_MAX_CONNECTIONS];
+// Allocated once when the server starts, so the memory cost is fixed by the
+// connection limit and no buffer lives on the task stack
+static mb_buffers_t *s_pool;
+static bool s_pool_used[CONFIG_MB_TCP_MAX_CONNECTIONS];
+static int s_pool_in_use;
+static mb_server_stats_t s_stats;
+// RTU requests are rewritten as MBAP ADUs for the handler
+static uint8_t s_rtu_adu[MB_TCP_ADU_MAX];
+static uint32_t s_next_conn_id;
+static bool s_accept_paused;
+static TickType_t s_accept_paused_at;
+
+void mb_server_get_stats(mb_server_stats_t *stats)
+{
+    *stats = s_stats;
+}
+
+uint8_t mb_server_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_SERVER_REG_COUNT];
+    const uint32_t counters[] = {
+        s_stats.accepted, s_stats.evicted, s_stats.timed_out, s_stats.peer_closed, s_stats.errors,
+        s_stats.transactions, s_stats.recvs, s_stats.sends, s_stats.tx_bytes,
+    };
+    // Counters added after the 16-bit registers
+    const uint32_t more_counters[] = { s_stats.udp_requests, s_stats.udp_dropped, s_stats.throttled };
+
+    if (quantity == 0 || start + quantity > MB_SERVER_REG_COUNT) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        regs[2 * i] = counters[i] >> 16;
+        regs[2 * i + 1] = counters[i] & 0xFFFF;
+    }
+    regs[MB_SERVER_REG_ACTIVE] = s_stats.active;
+    regs[MB_SERVER_REG_MAX_CONN] = CONFIG_MB_TCP_MAX_CONNECTIONS;
+    for (int i = 0; i < sizeof(more_counters) / sizeof(more_counters[0]); i++) {
+        regs[MB_SERVER_REG_UDP_REQUESTS + 2 * i] = more_counters[i] >> 16;
+        regs[MB_SERVER_REG_UDP_REQUESTS + 2 * i + 1] = more_counters[i] & 0xFFFF;
+    }
+    regs[MB_SERVER_REG_POOL_PEAK] = s_stats.pool_peak;
+    regs[MB_SERVER_REG_RX_PEAK] = s_stats.rx_peak;
+    regs[MB_SERVER_REG_TX_PEAK] = s_stats.tx_peak;
+    regs[MB_SERVER_REG_STACK_FREE] = s_stats.stack_free;
+
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start + i] >> 8;
+        out[2 * i + 1] = regs[start + i] & 0xFF;
+    }
+    return 0;
+}
+
+uint8_t mb_server_read_iface_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_SERVER_IFACE_REG_END - MB_SERVER_IFACE_REG_BASE];
+
+    if (quantity == 0 || start < MB_SERVER_IFACE_REG_BASE || start + quantity > MB_SERVER_IFACE_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < MB_IFACE_COUNT; i++) {
+        const mb_iface_stats_t *iface = &s_stats.iface[i];
+        uint16_t *block = &regs[i * MB_SERVER_IFACE_REG_STRIDE];
+        block[MB_SERVER_IFACE_ACCEPTED] = iface->accepted >> 16;
+        block[MB_SERVER_IFACE_ACCEPTED + 1] = iface->accepted & 0xFFFF;
+        block[MB_SERVER_IFACE_TRANSACTIONS] = iface->transactions >> 16;
+        block[MB_SERVER_IFACE_TRANSACTIONS + 1] = iface->transactions & 0xFFFF;
+        block[MB_SERVER_IFACE_TX_BYTES] = iface->tx_bytes >> 16;
+        block[MB_SERVER_IFACE_TX_BYTES + 1] = iface->tx_bytes & 0xFFFF;
+        block[MB_SERVER_IFACE_EVICTED] = iface->evicted;
+        block[MB_SERVER_IFACE_ACTIVE] = iface->active;
+    }
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start - MB_SERVER_IFACE_REG_BASE + i] >> 8;
+        out[2 * i + 1] = regs[start - MB_SERVER_IFACE_REG_BASE + i] & 0xFF;
+    }
+    return 0;
+}
+
+static void bind_buffers(mb_conn_t *conn)
+{
+    for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+        if (!s_pool_used[i]) {
+            s_pool_used[i] = true;
+            conn->rx_buf = s_pool[i].rx;
+            conn->tx_buf = s_pool[i].tx;
+            break;
+        }
+    }
+    if (++s_pool_in_use > s_stats.pool_peak) {
+        s_stats.pool_peak = s_pool_in_use;
+    }
+}
+
+static void release_buffers(mb_conn_t *conn)
+{
+    s_pool_used[(mb_buffers_t *)conn->rx_buf - s_pool] = false;
+    s_pool_in_use--;
+    conn->rx_buf = NULL;
+    conn->tx_buf = NULL;
+}
+
+static void conn_close(mb_conn_t *conn)
+{
+    ESP_LOGI(TAG, "Connection from %s closed: %u requests, %u recv, %u send (%.2f segments per transaction)",
+             conn->addr, conn->requests, conn->recvs, conn->sends,
+             conn->requests ? (float)conn->sends / conn->requests : 0.0f);
+#if CONFIG_MB_TLS_ENABLE
+    if (conn->tls) {
+        mb_tls_close(conn->tls);
+        conn->tls = NULL;
+    }
+#endif
+    shutdown(conn->sock, 0);
+    close(conn->sock);
+    conn->sock = -1;
+    release_buffers(conn);
+    s_stats.active--;
+    s_stats.iface[conn->iface].active--;
+}
+
+// The interface a client came in on, told by the local address it connected to:
+// the server listens on INADDR_ANY, so one socket serves both interfaces
+static uint8_t client_iface(int sock)
+{
+#if CONFIG_MB_NET_WIFI
+    struct sockaddr_in local;
+    socklen_t len = sizeof(local);
+    esp_netif_ip_info_t ip_info;
+    esp_netif_t *wifi = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+
+    if (wifi != NULL && esp_netif_get_ip_info(wifi, &ip_info) == ESP_OK &&
+            getsockname(sock, (struct sockaddr *)&local, &len) == 0 &&
+            local.sin_addr.s_addr == ip_info.ip.addr) {
+        return MB_IFACE_WIFI;
+    }
+#endif
+    return MB_IFACE_ETH;
+}
+
+// Least recently active connection on `iface`, or on any interface for MB_IFACE_COUNT
+static mb_conn_t *least_active(int iface)
+{
+    mb_conn_t *oldest = NULL;
+    for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+        mb_conn_t *conn = &s_conns[i];
+        if (conn->sock < 0 || (iface != MB_IFACE_COUNT && conn->iface != iface)) {
+            continue;
+        }
+        if (oldest == NULL || (int32_t)(conn->last_active - oldest->last_active) < 0) {
+            oldest = conn;
+        }
+    }
+    return oldest;
+}
+
+static void evict_client(mb_conn_t *victim, const char *reason)
+{
+    ESP_LOGW(TAG, "%s, evicting %s", reason, victim->addr);
+    s_stats.evicted++;
+    s_stats.iface[victim->iface].evicted++;
+    conn_close(victim);
+}
+
+// Gives a connected socket a slot, or the least recently active connection's at the
+// limit: a client that crashed without closing its socket is the likely victim.
+// Wi-Fi clients make room before wired ones and never take a wired client's slot;
+// NULL when there is no slot for the client, the caller then closes the socket.
+static mb_conn_t *add_client(int sock, const char *addr, bool rtu)
+{
+    uint8_t iface = client_iface(sock);
+    mb_conn_t *conn = NULL;
+    mb_conn_t *victim = NULL;
+
+    for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+        if (s_conns[i].sock < 0) {
+            conn = &s_conns[i];
+            break;
+        }
+    }
+#if CONFIG_MB_NET_WIFI
+    if (iface == MB_IFACE_WIFI && s_stats.iface[MB_IFACE_WIFI].active >= CONFIG_MB_WIFI_MAX_CONNECTIONS) {
+        victim = least_active(MB_IFACE_WIFI);
+    } else
+#endif
+    if (conn == NULL) {
+        victim = least_active(MB_IFACE_WIFI);
+        if (victim == NULL && iface == MB_IFACE_ETH) {
+            victim = least_active(MB_IFACE_COUNT);
+        }
+    }
+    if (victim != NULL) {
+        evict_client(victim, "Connection limit reached");
+        conn = victim;
+    }
+    if (conn == NULL) {
+        ESP_LOGW(TAG, "Connection limit reached by wired clients, refusing %s", addr);
+        return NULL;
+    }
+
+    // Responses leave in one send() per batch, so Nagle only adds latency
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    // Detect peers that vanished without closing the connection
+    int keep_alive = 1;
+    int keep_idle = CONFIG_MB_TCP_KEEPALIVE_IDLE;
+    int keep_interval = CONFIG_MB_TCP_KEEPALIVE_INTERVAL;
+    int keep_count = CONFIG_MB_TCP_KEEPALIVE_COUNT;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &keep_alive, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &keep_idle, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &keep_interval, sizeof(int));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &keep_count, sizeof(int));
+
+    memset(conn, 0, sizeof(*conn));
+    conn->sock = sock;
+    conn->id = ++s_next_conn_id;
+    conn->rtu = rtu;
+    conn->iface = iface;
+    bind_buffers(conn);
+    conn->last_active = xTaskGetTickCount();
+    conn->read_bucket.tokens = CONFIG_MB_TCP_READ_BURST * 1000;
+    conn->read_bucket.refilled = conn->last_active;
+    conn->write_bucket.tokens = CONFIG_MB_TCP_WRITE_BURST * 1000;
+    conn->write_bucket.refilled = conn->last_active;
+    s_stats.accepted++;
+    s_stats.active++;
+    s_stats.iface[iface].accepted++;
+    s_stats.iface[iface].active++;
+    snprintf(conn->addr, sizeof(conn->addr), "%s", addr);
+#if CONFIG_MB_LATENCY_ENABLE
+    mb_latency_client_reset(conn - s_conns, conn->addr);
+#endif
+    return conn;
+}
+
+static void accept_client(int listen_sock, bool rtu)
+{
+    struct sockaddr_storage source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    char addr[16] = "";
+    int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+    if (sock < 0) {
+        int accept_errno = errno;
+        ESP_LOGE(TAG, "Unable to accept connection: errno %d", accept_errno);
+        // Out of sockets: the client is already gone. The socket budget covers this
+        // server's own connections, so only at the connection limit, where a new
+        // client would displace one anyway, does the least active one give up its
+        // socket for the retry. Below it the mirror, the HTTP server or other tasks
+        // hold the sockets, and healthy clients are not disconnected for them.
+        if ((accept_errno == ENFILE || accept_errno == EMFILE) && s_stats.active >= CONFIG_MB_TCP_MAX_CONNECTIONS) {
+            mb_conn_t *victim = least_active(MB_IFACE_WIFI);
+            if (victim == NULL) {
+                victim = least_active(MB_IFACE_COUNT);
+            }
+            if (victim != NULL) {
+                evict_client(victim, "Out of sockets");
+            }
+        } else if (accept_errno == ENFILE || accept_errno == EMFILE) {
+            // Where the stack keeps the refused connection queued, retrying at once
+            // would only spin
+            s_accept_paused = true;
+            s_accept_paused_at = xTaskGetTickCount();
+        }
+        return;
+    }
+    if (source_addr.ss_family == PF_INET) {
+        inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr, sizeof(addr) - 1);
+    }
+    mb_conn_t *conn = add_client(sock, addr, rtu);
+    if (conn == NULL) {
+        shutdown(sock, 0);
+        close(sock);
+        return;
+    }
+    ESP_LOGI(TAG, "Socket accepted ip address: %s%s%s", addr, rtu ? " (RTU over TCP)" : "",
+             conn->iface == MB_IFACE_WIFI ? " on Wi-Fi" : "");
+}
+
+#if CONFIG_MB_TLS_ENABLE
+// Takes over the clients whose TLS handshake completed. Each session holds its
+// record buffers, so past CONFIG_MB_TLS_MAX_CONNECTIONS the least recently
+// active TLS client makes room.
+static void adopt_tls_clients(void)
+{
+    int sock;
+    mb_tls_session_t *session;
+    char addr[16] = "";
+
+    while (mb_tls_take_client(&sock, &session, addr, sizeof(addr))) {
+        mb_conn_t *oldest = NULL;
+        int count = 0;
+        for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+            if (s_conns[i].sock >= 0 && s_conns[i].tls) {
+                count++;
+                if (oldest == NULL || (int32_t)(s_conns[i].last_active - oldest->last_active) < 0) {
+                    oldest = &s_conns[i];
+                }
+            }
+        }
+        if (count >= CONFIG_MB_TLS_MAX_CONNECTIONS) {
+            evict_client(oldest, "TLS connection limit reached");
+        }
+        mb_conn_t *conn = add_client(sock, addr, false);
+        if (conn == NULL) {
+            mb_tls_close(session);
+            shutdown(sock, 0);
+            close(sock);
+            continue;
+        }
+        conn->tls = session;
+        ESP_LOGI(TAG, "TLS client %s ready", addr);
+    }
+}
+#endif
+
+static int conn_recv(mb_conn_t *conn, uint8_t *buf, int len)
+{
+#if CONFIG_MB_TLS_ENABLE
+    if (conn->tls) {
+        return mb_tls_recv(conn->tls, buf, len);
+    }
+#endif
+    return recv(conn->sock, buf, len, 0);
+}
+
+static int conn_send(mb_conn_t *conn, const uint8_t *buf, int len)
+{
+#if CONFIG_MB_TLS_ENABLE
+    if (conn->tls) {
+        return mb_tls_send(conn->tls, buf, len);
+    }
+#endif
+    return send(conn->sock, buf, len, 0);
+}
+
+// Received data select() cannot report: what mbedTLS decrypted but not yet handed over
+static bool conn_buffered(const mb_conn_t *conn)
+{
+#if CONFIG_MB_TLS_ENABLE
+    return conn->tls && conn->tx_len == 0 && mb_tls_bytes_available(conn->tls) > 0;
+#else
+    return false;
+#endif
+}
+
+static bool is_write(uint8_t function_code)
+{
+    return function_code == 0x05 || function_code == 0x06 || function_code == 0x0F || function_code == 0x10;
+}
+
+// Takes one request from the bucket, refilled at `rate` per second up to `burst`.
+// A rate of 0 means no limit.
+static bool take_token(mb_bucket_t *bucket, uint32_t rate, uint32_t burst)
+{
+    if (rate == 0) {
+        return true;
+    }
+    TickType_t now = xTaskGetTickCount();
+    uint64_t tokens = bucket->tokens + (uint64_t)(now - bucket->refilled) * portTICK_PERIOD_MS * rate;
+    bucket->tokens = tokens < burst * 1000 ? tokens : burst * 1000;
+    bucket->refilled = now;
+
+    if (bucket->tokens < 1000) {
+        return false;
+    }
+    bucket->tokens -= 1000;
+    return true;
+}
+
+static void append_exception(mb_conn_t *conn, const uint8_t *adu, uint8_t exception)
+{
+    uint8_t *response = conn->tx_buf + conn->tx_len;
+
+    memcpy(response, adu, MB_TCP_MBAP_SIZE);
+    response[4] = 0;
+    response[5] = 3;
+    response[7] = adu[7] | 0x80;
+    response[8] = exception;
+    conn->tx_len += 9;
+}
+
+// Length of the request at `offset` of the receive buffer, 0 while it is
+// incomplete, -1 if the stream cannot be cut into requests.
+static int next_request_length(const mb_conn_t *conn, int offset)
+{
+    const uint8_t *frame = conn->rx_buf + offset;
+    int available = conn->rx_len - offset;
+
+    if (conn->rtu) {
+        // Function codes of unknown request length: whatever has arrived, up to
+        // one frame; process_requests() answers it without checking the CRC
+        int length = mb_rtu_request_length(frame, available);
+        if (length < 0) {
+            return available < MB_RTU_FRAME_MAX ? available : MB_RTU_FRAME_MAX;
+        }
+        return length > MB_RTU_FRAME_MAX ? -1 : length <= available ? length : 0;
+    }
+
+    if (available < MB_TCP_MBAP_SIZE) {
+        return 0;
+    }
+    uint16_t protocol_id = (frame[2] << 8) | frame[3];
+    uint16_t length = (frame[4] << 8) | frame[5];   // unit ID + PDU
+    if (protocol_id != 0 || length < 2 || MB_TCP_MBAP_SIZE - 1 + length > MB_TCP_ADU_MAX) {
+        return -1;
+    }
+    return MB_TCP_MBAP_SIZE - 1 + length <= available ? MB_TCP_MBAP_SIZE - 1 + length : 0;
+}
+
+#if CONFIG_MB_LATENCY_ENABLE
+// Stamp of the recv() that completed the request ending at `end` of the RX buffer
+static uint32_t request_received(const mb_conn_t *conn, int end)
+{
+    int i = 0;
+    while (i < conn->segment_count - 1 && conn->segments[i].end < end) {
+        i++;
+    }
+    return conn->segments[i].stamp;
+}
+#endif
+
+// Rewrites the MBAP response ADU at `adu` in place as an RTU frame with CRC,
+// returns the frame length.
+static int mbap_to_rtu(uint8_t *adu, int adu_length)
+{
+    int frame_length = adu_length - (MB_TCP_MBAP_SIZE - 1);
+
+    memmove(adu, adu + MB_TCP_MBAP_SIZE - 1, frame_length);
+    uint16_t crc = mb_rtu_crc16(adu, frame_length);
+    adu[frame_length] = crc & 0xFF;
+    adu[frame_length + 1] = crc >> 8;
+    return frame_length + 2;
+}
+
+// Answers the complete requests in the receive buffer into the TX buffer. The
+// stream is cut by the MBAP length field, or for RTU over TCP by the length the
+// function code implies; a partial request waits for the next segment, and
+// requests whose response would not fit wait for the TX buffer to drain. Requests
+// are always answered in the order they arrived; with `writes_only` this stops at
+// the first read, so a connection whose next request is a relay command gets its
+// turn before other clients' polls. Over its budget a request gets exception 0x06.
+// Returns false if the connection was closed.
+static bool process_requests(mb_conn_t *conn, bool writes_only)
+{
+    int offset = 0;
+
+    while (MB_TCP_BUF_SIZE - conn->tx_len >= MB_TCP_ADU_MAX) {
+        int frame_length = next_request_length(conn, offset);
+        if (frame_length == 0) {
+            break;
+        }
+        // No way to find the next request boundary after a bad header
+        if (frame_length < 0) {
+            ESP_LOGW(TAG, "Invalid request framing from %s, dropping connection", conn->addr);
+            s_stats.errors++;
+            conn_close(conn);
+            return false;
+        }
+        const uint8_t *frame = conn->rx_buf + offset;
+        uint8_t function_code = conn->rtu ? frame[1] : frame[7];
+
+        if (writes_only && !is_write(function_code)) {
+            break;
+        }
+        offset += frame_length;
+
+        const uint8_t *adu = frame;
+        int adu_length = frame_length;
+        bool unsupported = conn->rtu && mb_rtu_request_length(frame, frame_length) < 0;
+        if (conn->rtu) {
+            // Like a slave on the bus, ignore a corrupt frame; what follows it in
+            // the buffer cannot be trusted either. A frame of unknown length was
+            // cut at a guess, so its CRC says nothing.
+            if (!unsupported && !mb_rtu_frame_valid(frame, frame_length)) {
+                ESP_LOGW(TAG, "CRC error in RTU frame from %s", conn->addr);
+                s_stats.errors++;
+                offset = conn->rx_len;
+                break;
+            }
+            adu_length = frame_length - 3 + MB_TCP_MBAP_SIZE;
+            memset(s_rtu_adu, 0, 4);
+            s_rtu_adu[4] = (frame_length - 2) >> 8;
+            s_rtu_adu[5] = (frame_length - 2) & 0xFF;
+            memcpy(s_rtu_adu + MB_TCP_MBAP_SIZE - 1, frame, frame_length - 2);
+            s_rtu_adu[6] = frame[0];
+            s_rtu_adu[7] = frame[1];
+            adu = s_rtu_adu;
+        }
+        int response_start = conn->tx_len;
+#if CONFIG_MB_LATENCY_ENABLE
+        uint32_t dispatched = mb_latency_stamp();
+        uint32_t received = request_received(conn, offset);
+        mb_latency_record(conn - s_conns, adu[7], MB_LATENCY_STAGE_QUEUE, dispatched - received);
+#endif
+
+        conn->requests++;
+        s_stats.transactions++;
+        s_stats.iface[conn->iface].transactions++;
+        bool allowed = is_write(adu[7])
+            ? take_token(&conn->write_bucket, CONFIG_MB_TCP_WRITE_RATE, CONFIG_MB_TCP_WRITE_BURST)
+            : take_token(&conn->read_bucket, CONFIG_MB_TCP_READ_RATE, CONFIG_MB_TCP_READ_BURST);
+        if (unsupported) {
+            append_exception(conn, adu, 0x01);  // Illegal function
+        } else if (!allowed) {
+            s_stats.throttled++;
+            append_exception(conn, adu, 0x06);  // Slave device busy
+#if CONFIG_MB_GATEWAY_ENABLE
+        } else if (mb_gateway_forwards(adu[6]) && conn->rtu) {
+            // Replies to later local requests would go out before the bus answers,
+            // and an RTU stream has no transaction ID to pair them by
+            append_exception(conn, adu, 0x0A);  // Gateway path unavailable
+        } else if (mb_gateway_forwards(adu[6])) {
+            // Other unit IDs are slaves on the RS-485 port; their reply arrives later
+            uint8_t exception = mb_gateway_submit(conn - s_conns, conn->id, adu, adu_length);
+            if (exception) {
+                append_exception(conn, adu, exception);
+            }
+#endif
+        } else {
+            conn->tx_len += handle_modbus_request(adu, adu_length, conn->tx_buf + conn->tx_len);
+        }
+
+        if (conn->rtu && conn->tx_len > response_start) {
+            if (adu[6] == 0x00) {
+                conn->tx_len = response_start;  // No reply to broadcasts on RTU
+            } else {
+                conn->tx_len = response_start + mbap_to_rtu(conn->tx_buf + response_start, conn->tx_len - response_start);
+            }
+        }
+#if CONFIG_MB_LATENCY_ENABLE
+        if (conn->tx_len > response_start) {
+            uint32_t handled = mb_latency_stamp();
+            mb_latency_record(conn - s_conns, adu[7], MB_LATENCY_STAGE_HANDLER, handled - dispatched);
+            // With the list full the response goes out untimed
+            if (conn->timed_count < MB_LATENCY_PENDING) {
+                mb_timed_t *timed = &conn->timed[conn->timed_count++];
+                timed->end = conn->tx_len;
+                timed->function_code = adu[7];
+                timed->received = received;
+                timed->handled = handled;
+            }
+        }
+#endif
+    }
+
+    if (offset > 0) {
+        conn->rx_len -= offset;
+        memmove(conn->rx_buf, conn->rx_buf + offset, conn->rx_len);
+#if CONFIG_MB_LATENCY_ENABLE
+        int kept = 0;
+        for (int i = 0; i < conn->segment_count; i++) {
+            if (conn->segments[i].end > offset) {
+                conn->segments[kept] = conn->segments[i];
+                conn->segments[kept++].end -= offset;
+            }
+        }
+        conn->segment_count = kept;
+#endif
+    }
+    return true;
+}
+
+#if CONFIG_MB_LATENCY_ENABLE
+// Closes the timing of the responses send() has taken completely
+static void record_sent(mb_conn_t *conn)
+{
+    uint32_t now = mb_latency_stamp();
+    int done = 0;
+
+    while (done < conn->timed_count && conn->timed[done].end <= conn->tx_sent) {
+        const mb_timed_t *timed = &conn->timed[done++];
+        mb_latency_record(conn - s_conns, timed->function_code, MB_LATENCY_STAGE_SEND, now - timed->handled);
+        mb_latency_record(conn - s_conns, timed->function_code, MB_LATENCY_STAGE_TOTAL, now - timed->received);
+    }
+    conn->timed_count -= done;
+    memmove(conn->timed, conn->timed + done, conn->timed_count * sizeof(mb_timed_t));
+}
+#endif
+
+// Hands the pending responses to the stack in one send(). Whatever the socket does
+// not take now stays queued; the connection is then polled for writability and
+// not read until the queue drains. Returns false if the connection was closed.
+static bool flush_responses(mb_conn_t *conn)
+{
+    if (conn->tx_len > s_stats.tx_peak) {
+        s_stats.tx_peak = conn->tx_len;
+    }
+    while (conn->tx_sent < conn->tx_len) {
+        int len = conn_send(conn, conn->tx_buf + conn->tx_sent, conn->tx_len - conn->tx_sent);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            ESP_LOGE(TAG, "send failed: errno %d", errno);
+            s_stats.errors++;
+            conn_close(conn);
+            return false;
+        }
+        conn->sends++;
+        s_stats.sends++;
+        s_stats.tx_bytes += len;
+        s_stats.iface[conn->iface].tx_bytes += len;
+        conn->tx_sent += len;
+#if CONFIG_MB_LATENCY_ENABLE
+        record_sent(conn);
+#endif
+
+        if (conn->tx_sent == conn->tx_len) {
+            conn->tx_len = 0;
+            conn->tx_sent = 0;
+            // ADUs held back for lack of TX space
+            if (!process_requests(conn, false)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#if CONFIG_MB_GATEWAY_ENABLE
+// Moves the replies of the RS-485 bus task to their connections, in completion order.
+// A reply for a connection that is gone is dropped; one for a connection without TX
+// space waits, with those behind it, until that connection drains.
+static void deliver_gateway_responses(void)
+{
+    int after = MB_GATEWAY_OLDEST;      // last response left for a later pass
+    int response;
+    int slot;
+    uint32_t id;
+    uint32_t blocked = 0;               // slots out of TX space, kept in completion order
+
+    while (mb_gateway_peek_response(after, &response, &slot, &id)) {
+        mb_conn_t *conn = &s_conns[slot];
+        if (conn->sock < 0 || conn->id != id) {
+            mb_gateway_take_response(response, NULL);
+            continue;
+        }
+        if ((blocked & (1u << slot)) || MB_TCP_BUF_SIZE - conn->tx_len < MB_TCP_ADU_MAX) {
+            blocked |= 1u << slot;
+            after = response;
+            continue;
+        }
+        int length = mb_gateway_take_response(response, conn->tx_buf + conn->tx_len);
+        conn->tx_len += conn->rtu ? mbap_to_rtu(conn->tx_buf + conn->tx_len, length) : length;
+        flush_responses(conn);
+    }
+}
+#endif
+
+// Fills `order` with the open connections, wired clients ahead of Wi-Fi ones so
+// SCADA polls are not queued behind maintenance traffic; each group starts at the
+// rotating slot `first` so no client is always served first
+static int service_order(int first, mb_conn_t **order)
+{
+    int count = 0;
+    for (int iface = 0; iface < MB_IFACE_COUNT; iface++) {
+        for (int n = 0; n < CONFIG_MB_TCP_MAX_CONNECTIONS; n++) {
+            mb_conn_t *conn = &s_conns[(first + n) % CONFIG_MB_TCP_MAX_CONNECTIONS];
+            if (conn->sock >= 0 && conn->iface == iface) {
+                order[count++] = conn;
+            }
+        }
+    }
+    return count;
+}
+
+// One recv() per readiness event, so a busy client cannot starve the others.
+// The requests are answered once every ready client has been read.
+static void service_client(mb_conn_t *conn)
+{
+    int len = conn_recv(conn, conn->rx_buf + conn->rx_len, MB_TCP_BUF_SIZE - conn->rx_len);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        ESP_LOGE(TAG, "recv failed: errno %d", errno);
+        s_stats.errors++;
+        conn_close(conn);
+        return;
+    } else if (len == 0) {
+        s_stats.peer_closed++;
+        conn_close(conn);
+        return;
+    }
+    ESP_LOGD(TAG, "Received %d bytes from %s", len, conn->addr);
+    conn->rx_len += len;
+    if (conn->rx_len > s_stats.rx_peak) {
+        s_stats.rx_peak = conn->rx_len;
+    }
+    conn->last_active = xTaskGetTickCount();
+#if CONFIG_MB_LATENCY_ENABLE
+    // With the list full the segment joins the previous one and its requests
+    // count from that earlier stamp
+    if (conn->segment_count == MB_LATENCY_PENDING) {
+        conn->segments[MB_LATENCY_PENDING - 1].end = conn->rx_len;
+    } else {
+        conn->segments[conn->segment_count++] = (mb_segment_t) {
+            .end = conn->rx_len,
+            .stamp = mb_latency_stamp(),
+        };
+    }
+#endif
+    conn->recvs++;
+    s_stats.recvs++;
+}
+
+#if CONFIG_MB_RTU_TCP_ENABLE
+// Second listening port for clients that send RTU frames over TCP
+static int rtu_listen(void)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(CONFIG_MB_RTU_TCP_PORT),
+    };
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create RTU over TCP socket: errno %d", errno);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0 ||
+        listen(sock, CONFIG_MB_TCP_MAX_CONNECTIONS) != 0) {
+        ESP_LOGE(TAG, "RTU over TCP socket unable to listen: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+    ESP_LOGI(TAG, "Listening for RTU over TCP on port %d", CONFIG_MB_RTU_TCP_PORT);
+    return sock;
+}
+#endif
+
+#if CONFIG_MB_UDP_ENABLE
+static int udp_open(void)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(CONFIG_MB_UDP_PORT),
+    };
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create UDP socket: errno %d", errno);
+        return -1;
+    }
+    if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0) {
+        ESP_LOGE(TAG, "UDP socket unable to bind: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    ESP_LOGI(TAG, "Listening on UDP port %d", CONFIG_MB_UDP_PORT);
+    return sock;
+}
+
+// One ADU per datagram and no connection state: the handler decodes the request
+// in the receive buffer and builds the response in the buffer that is sent back.
+static void service_udp(int sock)
+{
+    static uint8_t request[MB_TCP_ADU_MAX];
+    static uint8_t response[MB_TCP_ADU_MAX];
+
+    for (int n = 0; n < MB_UDP_BATCH; n++) {
+        struct sockaddr_storage source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+        int len = recvfrom(sock, request, sizeof(request), 0, (struct sockaddr *)&source_addr, &addr_len);
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                s_stats.errors++;
+            }
+            return;
+        }
+
+        // The MBAP length must account for the whole datagram
+        if (len < MB_TCP_MBAP_SIZE + 1 || request[2] != 0 || request[3] != 0 ||
+            ((request[4] << 8) | request[5]) != len - (MB_TCP_MBAP_SIZE - 1)) {
+            s_stats.udp_dropped++;
+            continue;
+        }
+        s_stats.udp_requests++;
+        int response_length = 0;
+#if CONFIG_MB_GATEWAY_ENABLE
+        // A gateway reply arrives later, with no connection to deliver it on
+        if (mb_gateway_forwards(request[6])) {
+            memcpy(response, request, MB_TCP_MBAP_SIZE);
+            response[4] = 0;
+            response[5] = 3;
+            response[7] = request[7] | 0x80;
+            response[8] = 0x0A;  // Gateway path unavailable
+            response_length = 9;
+        }
+#endif
+        if (response_length == 0) {
+            response_length = handle_modbus_request(request, len, response);
+        }
+        if (response_length > 0) {
+            sendto(sock, response, response_length, 0, (struct sockaddr *)&source_addr, addr_len);
+        }
+    }
+}
+#endif
+
+void mb_server_task(void *pvParameters)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(CONFIG_MB_TCP_PORT),
+    };
+    int first = 0;
+    mb_conn_t *order[CONFIG_MB_TCP_MAX_CONNECTIONS];
+    TickType_t stack_sampled = xTaskGetTickCount() - pdMS_TO_TICKS(1000);  // first pass samples
+
+    for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+        s_conns[i].sock = -1;
+    }
+    s_pool = calloc(CONFIG_MB_TCP_MAX_CONNECTIONS, sizeof(mb_buffers_t));
+    if (s_pool == NULL) {
+        ESP_LOGE(TAG, "No memory for %d connection buffers", CONFIG_MB_TCP_MAX_CONNECTIONS);
+        vTaskDelete(NULL);
+        return;
+    }
+    ESP_LOGI(TAG, "Buffer pool: %d connections x %d bytes = %d bytes", CONFIG_MB_TCP_MAX_CONNECTIONS,
+             (int)sizeof(mb_buffers_t), CONFIG_MB_TCP_MAX_CONNECTIONS * (int)sizeof(mb_buffers_t));
+
+    int listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        vTaskDelete(NULL);
+        return;
+    }
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err != 0) {
+        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
+        goto CLEAN_UP;
+    }
+
+    err = listen(listen_sock, CONFIG_MB_TCP_MAX_CONNECTIONS);
+    if (err != 0) {
+        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
+        goto CLEAN_UP;
+    }
+    ESP_LOGI(TAG, "Listening on port %d, up to %d clients", CONFIG_MB_TCP_PORT, CONFIG_MB_TCP_MAX_CONNECTIONS);
+
+#if CONFIG_MB_RTU_TCP_ENABLE
+    int rtu_listen_sock = rtu_listen();
+#endif
+#if CONFIG_MB_UDP_ENABLE
+    int udp_sock = udp_open();
+#endif
+
+    while (1) {
+        fd_set read_set, write_set;
+        int max_fd = listen_sock;
+
+        if (s_accept_paused && xTaskGetTickCount() - s_accept_paused_at >= pdMS_TO_TICKS(MB_ACCEPT_PAUSE_MS)) {
+            s_accept_paused = false;
+        }
+        FD_ZERO(&read_set);
+        FD_ZERO(&write_set);
+        if (!s_accept_paused) {
+            FD_SET(listen_sock, &read_set);
+        }
+#if CONFIG_MB_RTU_TCP_ENABLE
+        if (rtu_listen_sock >= 0 && !s_accept_paused) {
+            FD_SET(rtu_listen_sock, &read_set);
+            if (rtu_listen_sock > max_fd) {
+                max_fd = rtu_listen_sock;
+            }
+        }
+#endif
+#if CONFIG_MB_UDP_ENABLE
+        if (udp_sock >= 0) {
+            FD_SET(udp_sock, &read_set);
+            if (udp_sock > max_fd) {
+                max_fd = udp_sock;
+            }
+        }
+#endif
+        for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+            mb_conn_t *conn = &s_conns[i];
+            if (conn->sock < 0) {
+                continue;
+            }
+            // A client that does not read its responses is not read from either
+            FD_SET(conn->sock, conn->tx_len > 0 ? &write_set : &read_set);
+            if (conn->sock > max_fd) {
+                max_fd = conn->sock;
+            }
+        }
+
+        // Wake up once a second while clients are connected to expire idle ones
+        struct timeval timeout = { .tv_sec = 1 };
+        bool use_timeout = CONFIG_MB_TCP_IDLE_TIMEOUT && s_stats.active;
+#if CONFIG_MB_GATEWAY_ENABLE
+        // and every 10 ms while the RS-485 bus works on requests
+        if (mb_gateway_pending() > 0) {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 10000;
+            use_timeout = true;
+        }
+#endif
+#if CONFIG_MB_TLS_ENABLE
+        // and while TLS handshakes run, to take over their clients
+        if (mb_tls_pending() > 0) {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = 10000;
+            use_timeout = true;
+        }
+#endif
+        // and when accepting resumes
+        if (s_accept_paused && (!use_timeout || timeout.tv_sec > 0)) {
+            timeout.tv_sec = 0;
+            timeout.tv_usec = MB_ACCEPT_PAUSE_MS * 1000;
+            use_timeout = true;
+        }
+        for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+            if (s_conns[i].sock >= 0 && conn_buffered(&s_conns[i])) {
+                timeout.tv_sec = 0;
+                timeout.tv_usec = 0;
+                use_timeout = true;
+            }
+        }
+        int ready = select(max_fd + 1, &read_set, &write_set, NULL, use_timeout ? &timeout : NULL);
+        if (ready < 0) {
+            ESP_LOGE(TAG, "select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+#if CONFIG_MB_UDP_ENABLE
+        if (udp_sock >= 0 && FD_ISSET(udp_sock, &read_set)) {
+            service_udp(udp_sock);
+        }
+#endif
+
+        // Clients are only added after these passes; ones closed during them are skipped
+        int count = service_order(first, order);
+        for (int n = 0; n < count; n++) {
+            mb_conn_t *conn = order[n];
+            if (conn->sock >= 0 && FD_ISSET(conn->sock, &write_set)) {
+                flush_responses(conn);
+            } else if (conn->sock >= 0 && (FD_ISSET(conn->sock, &read_set) || conn_buffered(conn))) {
+                service_client(conn);
+            }
+        }
+
+        // Clients whose next requests are writes first, so a client polling in a
+        // tight loop does not delay another client's relay commands. RTU frames
+        // carry no transaction ID to match replies by, so RTU over TCP clients are
+        // left out and answered in arrival order in the pass below.
+        for (int n = 0; n < count; n++) {
+            mb_conn_t *conn = order[n];
+            if (conn->sock >= 0 && !conn->rtu && conn->rx_len > 0) {
+                process_requests(conn, true);
+            }
+        }
+        for (int n = 0; n < count; n++) {
+            mb_conn_t *conn = order[n];
+            if (conn->sock >= 0 && process_requests(conn, false)) {
+                flush_responses(conn);
+            }
+        }
+        first = (first + 1) % CONFIG_MB_TCP_MAX_CONNECTIONS;
+
+#if CONFIG_MB_GATEWAY_ENABLE
+        deliver_gateway_responses();
+#endif
+
+        if (CONFIG_MB_TCP_IDLE_TIMEOUT) {
+            TickType_t now = xTaskGetTickCount();
+            for (int i = 0; i < CONFIG_MB_TCP_MAX_CONNECTIONS; i++) {
+                mb_conn_t *conn = &s_conns[i];
+                if (conn->sock >= 0 && now - conn->last_active >= pdMS_TO_TICKS(CONFIG_MB_TCP_IDLE_TIMEOUT * 1000)) {
+                    ESP_LOGW(TAG, "Closing idle connection from %s", conn->addr);
+                    s_stats.timed_out++;
+                    conn_close(conn);
+                }
+            }
+        }
+
+        if (FD_ISSET(listen_sock, &read_set)) {
+            accept_client(listen_sock, false);
+        }
+#if CONFIG_MB_RTU_TCP_ENABLE
+        if (rtu_listen_sock >= 0 && FD_ISSET(rtu_listen_sock, &read_set)) {
+            accept_client(rtu_listen_sock, true);
+        }
+#endif
+#if CONFIG_MB_TLS_ENABLE
+        adopt_tls_clients();
+#endif
+
+        // After every pass has run, so the mark covers the deepest calls (handlers,
+        // logging from conn_close). Walking the unused stack is cheap but not free.
+        if (xTaskGetTickCount() - stack_sampled >= pdMS_TO_TICKS(1000)) {
+            stack_sampled = xTaskGetTickCount();
+            s_stats.stack_free = uxTaskGetStackHighWaterMark(NULL);
+        }
+    }
+
+CLEAN_UP:
+    close(listen_sock);
+    vTaskDelete(NULL);
+}
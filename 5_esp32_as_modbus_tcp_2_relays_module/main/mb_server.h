@@ -0,0 +1,91 @@
+#ifndef MB_SERVER_H
+#define MB_SERVER_H
+
+#include <stdint.h>
+
+#define MB_TCP_MBAP_SIZE    7       // transaction ID, protocol ID, length, unit ID
+#define MB_TCP_ADU_MAX      260     // MBAP header (7) + PDU (253)
+// Per direction and connection. RX holds a complete largest request plus the
+// start of the next, anything beyond waits in the socket. TX is only filled
+// while a largest response still fits, so it never holds more than this either;
+// small poll replies still batch about 20 to a send.
+#define MB_TCP_BUF_SIZE     (2 * MB_TCP_ADU_MAX)
+
+// Network interface a client came in on
+#define MB_IFACE_ETH        0       // wired LAN, for SCADA traffic; also any unknown interface
+#define MB_IFACE_WIFI       1       // Wi-Fi station, for maintenance clients
+#define MB_IFACE_COUNT      2
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t transactions;
+    uint32_t tx_bytes;
+    uint16_t evicted;
+    uint16_t active;
+} mb_iface_stats_t;
+
+typedef struct {
+    uint32_t accepted;
+    uint32_t evicted;               // closed to make room for a new client
+    uint32_t timed_out;             // closed after CONFIG_MB_TCP_IDLE_TIMEOUT without a request
+    uint32_t peer_closed;
+    uint32_t errors;                // recv/send failures and invalid MBAP headers
+    uint32_t transactions;          // requests decoded
+    uint32_t recvs;                 // recv() calls that returned data
+    uint32_t sends;                 // send() calls, about one TCP segment each with TCP_NODELAY
+    uint32_t tx_bytes;
+    uint16_t active;
+    uint32_t udp_requests;          // datagrams answered (CONFIG_MB_UDP_ENABLE)
+    uint32_t udp_dropped;           // datagrams without a valid MBAP header
+    uint32_t throttled;             // requests over their connection's rate limit
+    uint16_t pool_peak;             // most connection buffers bound at once
+    uint16_t rx_peak;               // most bytes waiting in one RX buffer
+    uint16_t tx_peak;               // most bytes queued in one TX buffer
+    uint16_t stack_free;            // server task stack never used, sampled after each loop pass
+    mb_iface_stats_t iface[MB_IFACE_COUNT];
+} mb_server_stats_t;
+
+// Server statistics as input registers (FC 0x04), 32-bit counters high word first
+#define MB_SERVER_REG_ACCEPTED      0x0000
+#define MB_SERVER_REG_EVICTED       0x0002
+#define MB_SERVER_REG_TIMED_OUT     0x0004
+#define MB_SERVER_REG_PEER_CLOSED   0x0006
+#define MB_SERVER_REG_ERRORS        0x0008
+#define MB_SERVER_REG_TRANSACTIONS  0x000A
+#define MB_SERVER_REG_RECVS         0x000C
+#define MB_SERVER_REG_SENDS         0x000E
+#define MB_SERVER_REG_TX_BYTES      0x0010
+#define MB_SERVER_REG_ACTIVE        0x0012  // 16 bit
+#define MB_SERVER_REG_MAX_CONN      0x0013  // 16 bit, CONFIG_MB_TCP_MAX_CONNECTIONS
+#define MB_SERVER_REG_UDP_REQUESTS  0x0014
+#define MB_SERVER_REG_UDP_DROPPED   0x0016
+#define MB_SERVER_REG_THROTTLED     0x0018
+#define MB_SERVER_REG_POOL_PEAK     0x001A  // 16 bit watermarks from here
+#define MB_SERVER_REG_RX_PEAK       0x001B
+#define MB_SERVER_REG_TX_PEAK       0x001C
+#define MB_SERVER_REG_STACK_FREE    0x001D  // bytes
+#define MB_SERVER_REG_COUNT         0x001E
+
+// Per-interface statistics, one block of MB_SERVER_IFACE_REG_STRIDE per interface
+#define MB_SERVER_IFACE_REG_BASE    0x0060
+#define MB_SERVER_IFACE_REG_STRIDE  0x0008
+#define MB_SERVER_IFACE_ACCEPTED    0x0000  // offsets within a block
+#define MB_SERVER_IFACE_TRANSACTIONS 0x0002
+#define MB_SERVER_IFACE_TX_BYTES    0x0004
+#define MB_SERVER_IFACE_EVICTED     0x0006  // 16 bit
+#define MB_SERVER_IFACE_ACTIVE      0x0007  // 16 bit
+#define MB_SERVER_IFACE_REG_END     (MB_SERVER_IFACE_REG_BASE + MB_IFACE_COUNT * MB_SERVER_IFACE_REG_STRIDE)
+
+void mb_server_get_stats(mb_server_stats_t *stats);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_server_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+uint8_t mb_server_read_iface_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+// Serves up to CONFIG_MB_TCP_MAX_CONNECTIONS Modbus TCP clients on every interface,
+// wired clients ahead of Wi-Fi ones (CONFIG_MB_WIFI_MAX_CONNECTIONS), RTU over TCP
+// clients on a second port with CONFIG_MB_RTU_TCP_ENABLE and Modbus UDP datagrams
+// with CONFIG_MB_UDP_ENABLE, from one task with a select() loop.
+void mb_server_task(void *pvParameters);
+
+#endif // MB_SERVER_H
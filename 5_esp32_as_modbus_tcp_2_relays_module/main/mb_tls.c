@@ -0,0 +1,383 @@
+#include "sdkconfig.h"
+
+#if CONFIG_MB_TLS_ENABLE
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+#include "mb_tls.h"
+
+#define MB_TLS_PORT     802     // IANA port of Modbus/TCP Security
+
+static const char *TAG = "mb_tls";
+
+struct mb_tls_session {
+    mbedtls_ssl_context ssl;
+    mbedtls_net_context net;
+    int write_len;              // length of a write that would block, repeated as it was
+};
+
+// A client whose handshake completed, on its way to the server task
+typedef struct {
+    int sock;
+    mb_tls_session_t *session;
+    char addr[16];
+} tls_client_t;
+
+// This module's key and certificate and the client CA, issued into main/certs at
+// provisioning time by tools/mb_tls_certs.sh and embedded by the build
+extern const uint8_t ca_crt_start[] asm("_binary_ca_crt_start");
+extern const uint8_t ca_crt_end[] asm("_binary_ca_crt_end");
+extern const uint8_t server_crt_start[] asm("_binary_server_crt_start");
+extern const uint8_t server_crt_end[] asm("_binary_server_crt_end");
+extern const uint8_t server_key_start[] asm("_binary_server_key_start");
+extern const uint8_t server_key_end[] asm("_binary_server_key_end");
+
+// AEAD suites only: their records need no random numbers, so the server task can
+// encrypt without taking s_crypto_lock
+static const int s_ciphersuites[] = {
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_128_GCM_SHA256,
+    MBEDTLS_TLS_ECDHE_RSA_WITH_AES_256_GCM_SHA384,
+    0
+};
+
+static mbedtls_entropy_context s_entropy;
+static mbedtls_ctr_drbg_context s_ctr_drbg;
+static mbedtls_x509_crt s_ca;
+static mbedtls_x509_crt s_cert;
+static mbedtls_pk_context s_key;
+static mbedtls_ssl_config s_conf;
+static mbedtls_ssl_cache_context s_cache;
+static mbedtls_ssl_ticket_context s_ticket;
+
+// mbedTLS is built without MBEDTLS_THREADING_C: the RNG, cache and ticket keys are
+// shared, so handshake steps run one at a time. A worker waiting for its client's
+// next flight does not hold the lock.
+static SemaphoreHandle_t s_crypto_lock;
+static SemaphoreHandle_t s_accept_lock;
+static QueueHandle_t s_ready;
+static int s_listen_sock = -1;
+static int s_handshaking;
+static portMUX_TYPE s_count_lock = portMUX_INITIALIZER_UNLOCKED;
+static bool s_resumed;          // set by the cache and ticket lookups, under s_crypto_lock
+
+static struct {
+    uint32_t full;
+    uint32_t resumed;
+    uint32_t failed;
+    uint32_t full_us;
+    uint32_t resumed_us;
+} s_stats;
+
+static int cache_get(void *data, mbedtls_ssl_session *session)
+{
+    int ret = mbedtls_ssl_cache_get(data, session);
+    if (ret == 0) {
+        s_resumed = true;
+    }
+    return ret;
+}
+
+static int ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+{
+    int ret = mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+    if (ret == 0) {
+        s_resumed = true;
+    }
+    return ret;
+}
+
+static void session_free(mb_tls_session_t *session)
+{
+    mbedtls_ssl_free(&session->ssl);
+    free(session);
+}
+
+// Runs the handshake of `sock` to completion or CONFIG_MB_TLS_HANDSHAKE_TIMEOUT_MS.
+// Returns the session, or NULL with the socket still open.
+static mb_tls_session_t *handshake(int sock, const char *addr)
+{
+    mb_tls_session_t *session = calloc(1, sizeof(mb_tls_session_t));
+    if (session == NULL) {
+        return NULL;
+    }
+    mbedtls_ssl_init(&session->ssl);
+    // Allocates the record buffers, the bulk of the heap a session costs
+    int ret = mbedtls_ssl_setup(&session->ssl, &s_conf);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "mbedtls_ssl_setup failed: -0x%04X", -ret);
+        session_free(session);
+        return NULL;
+    }
+    session->net.fd = sock;
+    mbedtls_net_set_nonblock(&session->net);
+    mbedtls_ssl_set_bio(&session->ssl, &session->net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+    int64_t deadline = esp_timer_get_time() + CONFIG_MB_TLS_HANDSHAKE_TIMEOUT_MS * 1000LL;
+    int64_t cpu_us = 0;
+    bool resumed = false;
+    while (1) {
+        xSemaphoreTake(s_crypto_lock, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+        s_resumed = false;
+        ret = mbedtls_ssl_handshake(&session->ssl);
+        resumed |= s_resumed;
+        cpu_us += esp_timer_get_time() - start;
+        xSemaphoreGive(s_crypto_lock);
+
+        if (ret == 0) {
+            break;
+        }
+        int64_t remaining = deadline - esp_timer_get_time();
+        if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) || remaining <= 0) {
+            ESP_LOGW(TAG, "Handshake with %s failed: -0x%04X", addr, remaining > 0 ? -ret : 0);
+            s_stats.failed++;
+            session_free(session);
+            return NULL;
+        }
+
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(sock, &set);
+        struct timeval timeout = { .tv_sec = remaining / 1000000, .tv_usec = remaining % 1000000 };
+        select(sock + 1, ret == MBEDTLS_ERR_SSL_WANT_READ ? &set : NULL,
+               ret == MBEDTLS_ERR_SSL_WANT_WRITE ? &set : NULL, NULL, &timeout);
+    }
+
+    if (resumed) {
+        s_stats.resumed++;
+        s_stats.resumed_us = cpu_us;
+    } else {
+        s_stats.full++;
+        s_stats.full_us = cpu_us;
+    }
+    ESP_LOGI(TAG, "%s handshake with %s, %s, %lld us CPU", resumed ? "Resumed" : "Full", addr,
+             mbedtls_ssl_get_ciphersuite(&session->ssl), (long long)cpu_us);
+    return session;
+}
+
+static void mb_tls_worker(void *pvParameters)
+{
+    while (1) {
+        struct sockaddr_in source_addr;
+        socklen_t addr_len = sizeof(source_addr);
+        tls_client_t client = { 0 };
+
+        // One worker at a time waits in accept(); the others wait for it
+        xSemaphoreTake(s_accept_lock, portMAX_DELAY);
+        client.sock = accept(s_listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+        xSemaphoreGive(s_accept_lock);
+        if (client.sock < 0) {
+            ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        inet_ntoa_r(source_addr.sin_addr, client.addr, sizeof(client.addr) - 1);
+
+        portENTER_CRITICAL(&s_count_lock);
+        s_handshaking++;
+        portEXIT_CRITICAL(&s_count_lock);
+        client.session = handshake(client.sock, client.addr);
+        if (client.session == NULL) {
+            close(client.sock);
+        } else {
+            xQueueSend(s_ready, &client, portMAX_DELAY);
+        }
+        portENTER_CRITICAL(&s_count_lock);
+        s_handshaking--;
+        portEXIT_CRITICAL(&s_count_lock);
+    }
+}
+
+static int tls_listen(void)
+{
+    struct sockaddr_in dest_addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+        .sin_port = htons(MB_TLS_PORT),
+    };
+
+    int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) != 0 ||
+        listen(sock, CONFIG_MB_TLS_MAX_HANDSHAKES) != 0) {
+        ESP_LOGE(TAG, "Socket unable to listen: errno %d", errno);
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+static int load_config(void)
+{
+    int ret;
+
+    mbedtls_entropy_init(&s_entropy);
+    mbedtls_ctr_drbg_init(&s_ctr_drbg);
+    mbedtls_x509_crt_init(&s_ca);
+    mbedtls_x509_crt_init(&s_cert);
+    mbedtls_pk_init(&s_key);
+    mbedtls_ssl_config_init(&s_conf);
+    mbedtls_ssl_cache_init(&s_cache);
+    mbedtls_ssl_ticket_init(&s_ticket);
+
+    if ((ret = mbedtls_ctr_drbg_seed(&s_ctr_drbg, mbedtls_entropy_func, &s_entropy,
+                                     (const unsigned char *)TAG, strlen(TAG))) != 0 ||
+        (ret = mbedtls_x509_crt_parse(&s_ca, ca_crt_start, ca_crt_end - ca_crt_start)) != 0 ||
+        (ret = mbedtls_x509_crt_parse(&s_cert, server_crt_start, server_crt_end - server_crt_start)) != 0 ||
+        (ret = mbedtls_pk_parse_key(&s_key, server_key_start, server_key_end - server_key_start, NULL, 0)) != 0 ||
+        (ret = mbedtls_ssl_config_defaults(&s_conf, MBEDTLS_SSL_IS_SERVER, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+        (ret = mbedtls_ssl_conf_own_cert(&s_conf, &s_cert, &s_key)) != 0 ||
+        (ret = mbedtls_ssl_ticket_setup(&s_ticket, mbedtls_ctr_drbg_random, &s_ctr_drbg,
+                                        MBEDTLS_CIPHER_AES_128_GCM, CONFIG_MB_TLS_SESSION_LIFETIME)) != 0) {
+        return ret;
+    }
+
+    mbedtls_ssl_conf_rng(&s_conf, mbedtls_ctr_drbg_random, &s_ctr_drbg);
+    // The specification asks for TLS 1.2 or later and a certificate from the client
+    mbedtls_ssl_conf_min_version(&s_conf, MBEDTLS_SSL_MAJOR_VERSION_3, MBEDTLS_SSL_MINOR_VERSION_3);
+    mbedtls_ssl_conf_ciphersuites(&s_conf, s_ciphersuites);
+    mbedtls_ssl_conf_ca_chain(&s_conf, &s_ca, NULL);
+    mbedtls_ssl_conf_authmode(&s_conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_renegotiation(&s_conf, MBEDTLS_SSL_RENEGOTIATION_DISABLED);
+
+    mbedtls_ssl_cache_set_max_entries(&s_cache, CONFIG_MB_TLS_CACHE_ENTRIES);
+    mbedtls_ssl_cache_set_timeout(&s_cache, CONFIG_MB_TLS_SESSION_LIFETIME);
+    mbedtls_ssl_conf_session_cache(&s_conf, &s_cache, cache_get, mbedtls_ssl_cache_set);
+    mbedtls_ssl_conf_session_tickets_cb(&s_conf, mbedtls_ssl_ticket_write, ticket_parse, &s_ticket);
+    return 0;
+}
+
+void mb_tls_init(void)
+{
+    int ret = load_config();
+    if (ret != 0) {
+        ESP_LOGE(TAG, "TLS setup failed: -0x%04X", -ret);
+        return;
+    }
+    s_listen_sock = tls_listen();
+    if (s_listen_sock < 0) {
+        return;
+    }
+    s_crypto_lock = xSemaphoreCreateMutex();
+    s_accept_lock = xSemaphoreCreateMutex();
+    s_ready = xQueueCreate(CONFIG_MB_TLS_MAX_HANDSHAKES, sizeof(tls_client_t));
+    for (int i = 0; i < CONFIG_MB_TLS_MAX_HANDSHAKES; i++) {
+        // ECDHE and ECDSA in mbedTLS want a deep stack
+        xTaskCreate(mb_tls_worker, "mb_tls_worker", 8192, NULL, 4, NULL);
+    }
+    ESP_LOGI(TAG, "Listening for Modbus/TCP Security on port %d, %d handshake(s) at a time",
+             MB_TLS_PORT, CONFIG_MB_TLS_MAX_HANDSHAKES);
+}
+
+bool mb_tls_take_client(int *sock, mb_tls_session_t **session, char *addr, size_t addr_len)
+{
+    tls_client_t client;
+
+    if (s_ready == NULL || xQueueReceive(s_ready, &client, 0) != pdTRUE) {
+        return false;
+    }
+    *sock = client.sock;
+    *session = client.session;
+    strncpy(addr, client.addr, addr_len - 1);
+    return true;
+}
+
+int mb_tls_pending(void)
+{
+    return s_ready ? s_handshaking + uxQueueMessagesWaiting(s_ready) : 0;
+}
+
+int mb_tls_recv(mb_tls_session_t *session, uint8_t *buf, int len)
+{
+    int ret = mbedtls_ssl_read(&session->ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+    if (ret < 0) {
+        ESP_LOGW(TAG, "mbedtls_ssl_read failed: -0x%04X", -ret);
+        errno = EIO;
+        return -1;
+    }
+    return ret;
+}
+
+int mb_tls_send(mb_tls_session_t *session, const uint8_t *buf, int len)
+{
+    if (session->write_len) {
+        len = session->write_len;
+    }
+    int ret = mbedtls_ssl_write(&session->ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        session->write_len = len;
+        errno = EAGAIN;
+        return -1;
+    }
+    session->write_len = 0;
+    if (ret < 0) {
+        ESP_LOGW(TAG, "mbedtls_ssl_write failed: -0x%04X", -ret);
+        errno = EIO;
+        return -1;
+    }
+    return ret;
+}
+
+size_t mb_tls_bytes_available(mb_tls_session_t *session)
+{
+    return mbedtls_ssl_get_bytes_avail(&session->ssl);
+}
+
+void mb_tls_close(mb_tls_session_t *session)
+{
+    // Best effort on a non-blocking socket
+    mbedtls_ssl_close_notify(&session->ssl);
+    session_free(session);
+}
+
+uint8_t mb_tls_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out)
+{
+    uint16_t regs[MB_TLS_REG_END - MB_TLS_REG_BASE];
+    const uint32_t values[] = {
+        s_stats.full, s_stats.resumed, s_stats.failed, s_stats.full_us, s_stats.resumed_us,
+    };
+
+    if (quantity == 0 || start < MB_TLS_REG_BASE || start + quantity > MB_TLS_REG_END) {
+        return 0x02;  // Illegal data address
+    }
+    for (int i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        regs[2 * i] = values[i] >> 16;
+        regs[2 * i + 1] = values[i] & 0xFFFF;
+    }
+    for (int i = 0; i < quantity; i++) {
+        out[2 * i] = regs[start - MB_TLS_REG_BASE + i] >> 8;
+        out[2 * i + 1] = regs[start - MB_TLS_REG_BASE + i] & 0xFF;
+    }
+    return 0;
+}
+
+#endif // CONFIG_MB_TLS_ENABLE
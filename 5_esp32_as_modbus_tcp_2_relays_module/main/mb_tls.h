@@ -0,0 +1,53 @@
+#ifndef MB_TLS_H
+#define MB_TLS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Modbus/TCP Security (CONFIG_MB_TLS_ENABLE): MBAP over TLS 1.2 on port 802 with
+// mutual X.509 authentication. Handshakes run in CONFIG_MB_TLS_MAX_HANDSHAKES
+// worker tasks, so a full handshake (hundreds of ms of ECDHE and ECDSA) never
+// stalls the server loop, and the workers bound how many handshake contexts can
+// be alive at once; further clients wait in the listen backlog. An established
+// session is handed to the server task, which reads and writes it from its
+// select() loop like a plain connection.
+//
+// Returning clients resume without the public key operations, either from the
+// server-side session cache or from a session ticket they kept.
+
+// TLS statistics as input registers (FC 0x04), 32-bit values high word first
+#define MB_TLS_REG_BASE             0x0050
+#define MB_TLS_REG_FULL             0x0050  // full handshakes completed
+#define MB_TLS_REG_RESUMED          0x0052  // handshakes resumed from the cache or a ticket
+#define MB_TLS_REG_FAILED           0x0054  // handshakes failed or timed out
+#define MB_TLS_REG_FULL_US          0x0056  // CPU time of the last full handshake
+#define MB_TLS_REG_RESUMED_US       0x0058  // CPU time of the last resumed handshake
+#define MB_TLS_REG_END              0x005A
+
+typedef struct mb_tls_session mb_tls_session_t;
+
+// Loads the certificates, opens port 802 and starts the handshake workers.
+void mb_tls_init(void);
+
+// Takes a client whose handshake completed, without waiting; false if there is none.
+bool mb_tls_take_client(int *sock, mb_tls_session_t **session, char *addr, size_t addr_len);
+
+// Handshakes in progress or waiting to be taken; the server polls while there are any.
+int mb_tls_pending(void);
+
+// recv()/send() on the session: -1 with errno EAGAIN when the socket would block,
+// 0 from recv once the peer closed the session.
+int mb_tls_recv(mb_tls_session_t *session, uint8_t *buf, int len);
+int mb_tls_send(mb_tls_session_t *session, const uint8_t *buf, int len);
+
+// Decrypted bytes held by mbedTLS, which select() cannot see.
+size_t mb_tls_bytes_available(mb_tls_session_t *session);
+
+// Sends close_notify and frees the session; the caller closes the socket.
+void mb_tls_close(mb_tls_session_t *session);
+
+// Fills `out` with `quantity` big-endian registers; returns 0 or a Modbus exception code.
+uint8_t mb_tls_read_input_registers(uint16_t start, uint16_t quantity, uint8_t *out);
+
+#endif // MB_TLS_H
@@ -16,8 +16,14 @@
 #include <lwip/netdb.h>
 #include "connect.h"
 #include "lan8720.h"
+#include "modbus_tcp.h"
+#include "mb_server.h"
+#include "mb_gateway.h"
+#include "mb_cache.h"
+#include "mb_mirror.h"
+#include "mb_latency.h"
+#include "mb_tls.h"
 
-#define MODBUS_TCP_PORT 502
 #define MODBUS_SLAVE_ADDRESS 0x01  // Default address, changed to 0xFF
 
 #define RELAY_1_PIN 4
@@ -26,20 +32,8 @@
 #define OPTOCOUPLER_1_PIN 12
 #define OPTOCOUPLER_2_PIN 13
 
-#define TCP_BUF_SIZE 1024
-
 static const char *TAG = "modbus_slave";
 
-// Function prototypes
-void modbus_tcp_task(void *pvParameters);
-void handle_modbus_request(uint8_t *request, int request_length, int sock);
-void set_relay(int relay_num, bool state);
-uint8_t read_relay_status(int relay_num);
-void set_device_address(uint8_t new_address);
-uint8_t get_device_address(void);
-uint8_t read_optocoupler_status(void);
-void set_relay_flashing_mode(uint8_t relay_num, uint16_t mode, uint16_t delay_time);
-
 // Global variables
 static uint8_t g_device_address = MODBUS_SLAVE_ADDRESS;
 static TimerHandle_t relay_timers[4] = {NULL};
@@ -88,96 +82,76 @@ void app_main(void)
     gpio_set_direction(OPTOCOUPLER_2_PIN, GPIO_MODE_INPUT);
     ESP_LOGI(TAG, "GPIO pins initialized for relays and optocouplers");
 
-    // Initialize WiFi or Ethernet here
+    // Bring up Ethernet and/or Wi-Fi; the server listens on both. With the wired
+    // link up, Wi-Fi is only for maintenance clients and failing to join is not fatal.
+#if CONFIG_MB_NET_ETHERNET
+    ESP_ERROR_CHECK(ethernet(10000));
+#endif
+#if CONFIG_MB_NET_WIFI
     wifi_init();
+#if CONFIG_MB_NET_ETHERNET
+    ret = wifi_connect_sta("ssid", "pass", 10000);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Wi-Fi not connected (%s), serving Ethernet clients only", esp_err_to_name(ret));
+    }
+#else
     ESP_ERROR_CHECK(wifi_connect_sta("ssid", "pass", 10000));
-    //ESP_ERROR_CHECK(ethernet(10000));
+#endif
+#endif
 
-    // Create Modbus TCP task
-    xTaskCreate(modbus_tcp_task, "modbus_tcp_task", 4096, NULL, 5, NULL);
-}
+#if CONFIG_MB_GATEWAY_ENABLE
+    mb_gateway_init();
+#endif
 
-void modbus_tcp_task(void *pvParameters)
-{
-    char addr_str[128];
-    int addr_family = AF_INET;
-    int ip_protocol = 0;
-    struct sockaddr_storage dest_addr;
-
-    struct sockaddr_in *dest_addr_ip4 = (struct sockaddr_in *)&dest_addr;
-    dest_addr_ip4->sin_addr.s_addr = htonl(INADDR_ANY);
-    dest_addr_ip4->sin_family = AF_INET;
-    dest_addr_ip4->sin_port = htons(MODBUS_TCP_PORT);
-    ip_protocol = IPPROTO_IP;
-
-    int listen_sock = socket(addr_family, SOCK_STREAM, ip_protocol);
-    if (listen_sock < 0) {
-        ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
-        vTaskDelete(NULL);
-        return;
-    }
+#if CONFIG_MB_TLS_ENABLE
+    mb_tls_init();
+#endif
 
-    int err = bind(listen_sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    if (err != 0) {
-        ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
-        goto CLEAN_UP;
+#if CONFIG_MB_LATENCY_ENABLE
+    if (CONFIG_MB_LATENCY_HTTP_PORT) {
+        mb_latency_http_start();
     }
-
-    err = listen(listen_sock, 1);
-    if (err != 0) {
-        ESP_LOGE(TAG, "Error occurred during listen: errno %d", errno);
-        goto CLEAN_UP;
+#endif
+
+#if CONFIG_MB_MIRROR_ENABLE
+    if (mb_mirror_init()) {
+#if CONFIG_MB_MIRROR_SOURCE_INPUTS
+        // Input edges wake the mirror task directly instead of waiting for a poll
+        gpio_set_intr_type(OPTOCOUPLER_1_PIN, GPIO_INTR_ANYEDGE);
+        gpio_set_intr_type(OPTOCOUPLER_2_PIN, GPIO_INTR_ANYEDGE);
+        gpio_install_isr_service(0);
+        gpio_isr_handler_add(OPTOCOUPLER_1_PIN, mb_mirror_input_isr, NULL);
+        gpio_isr_handler_add(OPTOCOUPLER_2_PIN, mb_mirror_input_isr, NULL);
+#endif
     }
+#endif
+
+    // Create Modbus TCP server task. Pinned, because the latency stamps are reads
+    // of the per-core cycle counter; the last core keeps it away from Wi-Fi on core 0.
+    // mbedTLS record I/O and float logging also run on it; check the stack_free
+    // input register on target, with TLS enabled, before making this smaller.
+    xTaskCreatePinnedToCore(mb_server_task, "mb_server_task", 4096, NULL, 5, NULL,
+                            portNUM_PROCESSORS - 1);
+}
 
-    while (1) {
-        ESP_LOGI(TAG, "Socket listening");
-
-        struct sockaddr_storage source_addr;
-        socklen_t addr_len = sizeof(source_addr);
-        int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
-        if (sock < 0) {
-            ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
-            break;
-        }
-
-        // Convert ip address to string
-        if (source_addr.ss_family == PF_INET) {
-            inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
-        }
-        ESP_LOGI(TAG, "Socket accepted ip address: %s", addr_str);
-
-        uint8_t rx_buffer[TCP_BUF_SIZE];
-        int len;
-
-        do {
-            len = recv(sock, rx_buffer, sizeof(rx_buffer) - 1, 0);
-            if (len < 0) {
-                ESP_LOGE(TAG, "recv failed: errno %d", errno);
-                break;
-            } else if (len == 0) {
-                ESP_LOGI(TAG, "Connection closed");
-                break;
-            } else {
-                ESP_LOGI(TAG, "Received %d bytes", len);
-                ESP_LOG_BUFFER_HEX(TAG, rx_buffer, len);
-                handle_modbus_request(rx_buffer, len, sock);
-            }
-        } while (len > 0);
-
-        shutdown(sock, 0);
-        close(sock);
+// Fixed part of the request ADU for each function code
+static int request_min_length(const uint8_t *request, int request_length)
+{
+    switch (request[7]) {
+        case 0x01: case 0x02: case 0x03: case 0x04: case 0x05:
+            return 12;
+        case 0x0F: case 0x10:
+            return request_length < 13 ? 13 : 13 + request[12];
+        default:
+            return 8;
     }
-
-CLEAN_UP:
-    close(listen_sock);
-    vTaskDelete(NULL);
 }
 
-void handle_modbus_request(uint8_t *request, int request_length, int sock)
+int handle_modbus_request(const uint8_t *request, int request_length, uint8_t *response)
 {
     if (request_length < 8) {
         ESP_LOGW(TAG, "Received frame too short");
-        return;
+        return 0;
     }
 
     uint16_t transaction_id = (request[0] << 8) | request[1];
@@ -185,23 +159,40 @@ void handle_modbus_request(uint8_t *request, int request_length, int sock)
     uint16_t length = (request[4] << 8) | request[5];
     uint8_t unit_id = request[6];
     uint8_t function_code = request[7];
-    uint16_t start_address = (request[8] << 8) | request[9];
 
-    ESP_LOGI(TAG, "Transaction ID: %d, Protocol ID: %d, Length: %d, Unit ID: %d, Function Code: 0x%02X, Start Address: %d",
-             transaction_id, protocol_id, length, unit_id, function_code, start_address);
+    ESP_LOGD(TAG, "Transaction ID: %d, Protocol ID: %d, Length: %d, Unit ID: %d, Function Code: 0x%02X",
+             transaction_id, protocol_id, length, unit_id, function_code);
 
     // Allow broadcast address (0x00) and the specific device address
     if (unit_id != 0x00 && unit_id != g_device_address) {
         ESP_LOGW(TAG, "Wrong unit ID");
-        return;
+        return 0;
     }
 
-    uint8_t response[256];
     int response_length = 0;
 
     // Set Modbus TCP header
     memcpy(response, request, 7);
 
+    // The ADU is cut from the stream by its MBAP length, which may be shorter than
+    // the function code needs
+    if (request_length < request_min_length(request, request_length)) {
+        response[7] = function_code | 0x80;
+        response[8] = 0x03;  // Illegal data value
+        response[4] = 0;
+        response[5] = 3;
+        return 9;
+    }
+    uint16_t start_address = (request[8] << 8) | request[9];
+
+#if CONFIG_MB_CACHE_ENABLE
+    uint32_t cache_generation = mb_cache_generation();
+    response_length = mb_cache_lookup(request, response);
+    if (response_length) {
+        return response_length;
+    }
+#endif
+
     switch (function_code) {
         case 0x01:  // Read Coils (Read relay status)
             {
@@ -254,6 +245,49 @@ void handle_modbus_request(uint8_t *request, int request_length, int sock)
             }
             break;
 
+        case 0x04:  // Read Input Registers (Server, gateway, cache, mirror, TLS, interface and latency statistics)
+            {
+                uint16_t quantity = (request[10] << 8) | request[11];
+                uint8_t exception;
+                if (quantity > 125) {
+                    exception = 0x03;
+#if CONFIG_MB_LATENCY_ENABLE
+                } else if (start_address >= MB_LATENCY_REG_BASE) {
+                    exception = mb_latency_read_input_registers(start_address, quantity, response + 9);
+#endif
+                } else if (start_address >= MB_SERVER_IFACE_REG_BASE) {
+                    exception = mb_server_read_iface_registers(start_address, quantity, response + 9);
+#if CONFIG_MB_TLS_ENABLE
+                } else if (start_address >= MB_TLS_REG_BASE) {
+                    exception = mb_tls_read_input_registers(start_address, quantity, response + 9);
+#endif
+#if CONFIG_MB_MIRROR_ENABLE
+                } else if (start_address >= MB_MIRROR_REG_BASE) {
+                    exception = mb_mirror_read_input_registers(start_address, quantity, response + 9);
+#endif
+#if CONFIG_MB_CACHE_ENABLE
+                } else if (start_address >= MB_CACHE_REG_BASE) {
+                    exception = mb_cache_read_input_registers(start_address, quantity, response + 9);
+#endif
+#if CONFIG_MB_GATEWAY_ENABLE
+                } else if (start_address >= MB_GATEWAY_REG_BASE) {
+                    exception = mb_gateway_read_input_registers(start_address, quantity, response + 9);
+#endif
+                } else {
+                    exception = mb_server_read_input_registers(start_address, quantity, response + 9);
+                }
+                if (exception) {
+                    response[7] = function_code | 0x80;
+                    response[8] = exception;
+                    response_length = 9;
+                } else {
+                    response[7] = function_code;
+                    response[8] = quantity * 2;  // Byte count
+                    response_length = 9 + quantity * 2;
+                }
+            }
+            break;
+
         case 0x05:  // Write Single Coil (Control single relay)
             {
                 uint16_t coil_value = (request[10] << 8) | request[11];
@@ -289,6 +323,7 @@ void handle_modbus_request(uint8_t *request, int request_length, int sock)
                     for (int i = 0; i < 2; i++) {
                         set_relay(i + 1, coil_value & (1 << i));
                     }
+                    response[7] = function_code;
                     memcpy(response + 8, request + 8, 4);  // Echo back start address and quantity
                     response_length = 12;
                 } else {
@@ -319,6 +354,7 @@ void handle_modbus_request(uint8_t *request, int request_length, int sock)
                     uint16_t mode = (request[13] << 8) | request[14];
                     uint16_t delay_time = (request[15] << 8) | request[16];
                     set_relay_flashing_mode(relay_num, mode, delay_time);                    
+                    response[7] = function_code;
                     memcpy(response + 8, request + 8, 4);  // Echo back start address and quantity
                     response_length = 12;
                 } else {
@@ -341,9 +377,28 @@ void handle_modbus_request(uint8_t *request, int request_length, int sock)
     response[4] = ((response_length - 6) >> 8) & 0xFF;
     response[5] = (response_length - 6) & 0xFF;
 
-    ESP_LOGI(TAG, "Sending response");
-    ESP_LOG_BUFFER_HEX(TAG, response, response_length);
-    send(sock, response, response_length, 0);
+#if CONFIG_MB_CACHE_ENABLE
+    if (response[7] == function_code) {
+        switch (function_code) {
+            case 0x05:
+                mb_cache_invalidate(0x01, start_address, 1);
+                break;
+            case 0x0F:
+                mb_cache_invalidate(0x01, start_address, (request[10] << 8) | request[11]);
+                break;
+            case 0x10:
+                mb_cache_invalidate(0x03, start_address, (request[10] << 8) | request[11]);
+                break;
+            default:
+                mb_cache_store(request, response, response_length, cache_generation);
+                break;
+        }
+    }
+#endif
+
+    ESP_LOGD(TAG, "Sending response");
+    ESP_LOG_BUFFER_HEX_LEVEL(TAG, response, response_length, ESP_LOG_DEBUG);
+    return response_length;
 }
 
 // The rest of the functions (set_relay, read_relay_status, set_device_address, 
@@ -366,6 +421,15 @@ void set_relay(int relay_num, bool state)
     }
     gpio_set_level(relay_pin, state ? 1 : 0);
     ESP_LOGI(TAG, "Relay %d set to %s", relay_num, state ? "ON" : "OFF");
+#if CONFIG_MB_CACHE_ENABLE
+    // Every relay change, whether from a write, flash mode or its timer, makes the
+    // cached coil reads stale; the inputs too, as they often sense the contacts
+    mb_cache_invalidate(0x01, relay_num - 1, 1);
+    mb_cache_invalidate(0x02, 0, 8);
+#endif
+#if CONFIG_MB_MIRROR_ENABLE
+    mb_mirror_notify();
+#endif
 }
 
 uint8_t read_relay_status(int relay_num)
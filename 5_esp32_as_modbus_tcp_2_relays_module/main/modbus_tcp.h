@@ -0,0 +1,19 @@
+#ifndef MODBUS_TCP_H
+#define MODBUS_TCP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Functions implemented in modbus_tcp.c and shared with the other modules of the slave.
+
+// Decodes one Modbus TCP ADU (MBAP header + PDU) and builds the response ADU.
+// Returns the response length, 0 when there is nothing to send back.
+int handle_modbus_request(const uint8_t *request, int request_length, uint8_t *response);
+void set_relay(int relay_num, bool state);
+uint8_t read_relay_status(int relay_num);
+void set_device_address(uint8_t new_address);
+uint8_t get_device_address(void);
+uint8_t read_optocoupler_status(void);
+void set_relay_flashing_mode(uint8_t relay_num, uint16_t mode, uint16_t delay_time);
+
+#endif // MODBUS_TCP_H
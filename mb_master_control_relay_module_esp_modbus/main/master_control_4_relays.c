@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "esp_log.h"
-#include "modbus_params.h"  // for modbus parameters structures
+#include "relay_regmap.h"    // register map shared with the relay module
 #include "mbcontroller.h"
 #include "esp_modbus_master.h"
 #include "sdkconfig.h"
@@ -11,9 +11,6 @@
 
 #define MB_SLAVE_ADDR   (0x01)
 
-#define MB_READ_HOLD_OFFSET(field) ((uint16_t)(offsetof(holding_reg_params_t, field) + 1))
-#define MB_WRITE_COIL_OFFSET(field) ((uint16_t)(offsetof(coil_reg_params_t, field) + 1))
-
 static const char *TAG = "MODBUS_MASTER";
 
 // Enumeration of modbus device addresses accessed by master device
@@ -21,66 +18,25 @@ enum {
     MB_DEVICE_ADDR1 = 1
 };
 
-// Enumeration of all supported CIDs for device
-enum {
-    CID_HOLD_DEV_ADDR = 0,
-    CID_HOLD_SOFTWARE_VER,
-    CID_HOLD_HARDWARE_VER,
-    CID_COIL_RELAY0,
-    CID_COIL_RELAY1,
-    CID_COIL_RELAY2,
-    CID_COIL_RELAY3,
-    CID_DISC_INPUT1,
-    CID_DISC_INPUT2,
-    CID_DISC_INPUT3,
-    CID_DISC_INPUT4
-};
-
-// Example Data (Object) Dictionary for Modbus parameters:
+// Data (Object) Dictionary generated from the register map shared with the slave
+// (4_ESP32_as_modbus_4_relay_module/components/relay_regmap). CIDs are RELAY_CID_*.
+#define DEVICE_PARAMETER(...) RELAY_REGMAP_DESCRIPTOR(MB_DEVICE_ADDR1, __VA_ARGS__)
 const mb_parameter_descriptor_t device_parameters[] = {
-    // CID, Name, Units, Modbus Slave Addr, Modbus Reg Type, Reg Start, Reg Size, Instance Offset, Data Type, Data Size, Parameter Options, Access Mode
-    { CID_HOLD_DEV_ADDR, "DEV_ADDR", "ADDR", MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 0x4000, 1,
-      MB_READ_HOLD_OFFSET(dev_addr), PARAM_TYPE_U16, 2, OPTS(0, 255, 1), PAR_PERMS_READ_WRITE_TRIGGER },
-    
-    { CID_HOLD_SOFTWARE_VER, "SOFTWARE_VER", "VER", MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 0x0002, 4,
-      MB_READ_HOLD_OFFSET(software_ver), PARAM_TYPE_ASCII, 8, OPTS(0, 0, 0), PAR_PERMS_READ },
-    
-    { CID_HOLD_HARDWARE_VER, "HARDWARE_VER", "VER", MB_DEVICE_ADDR1, MB_PARAM_HOLDING, 0x0020, 1,
-      MB_READ_HOLD_OFFSET(hardware_ver), PARAM_TYPE_U16, 2, OPTS(0, 0, 0), PAR_PERMS_READ },
-    
-    { CID_COIL_RELAY0, "RELAY0", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_COIL, 0x0000, 1,
-      MB_WRITE_COIL_OFFSET(relay0), PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ_WRITE_TRIGGER },
-    
-    { CID_COIL_RELAY1, "RELAY1", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_COIL, 0x0001, 1,
-      MB_WRITE_COIL_OFFSET(relay1), PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ_WRITE_TRIGGER },
-    
-    { CID_COIL_RELAY2, "RELAY2", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_COIL, 0x0002, 1,
-      MB_WRITE_COIL_OFFSET(relay2), PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ_WRITE_TRIGGER },
-    
-    { CID_COIL_RELAY3, "RELAY3", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_COIL, 0x0003, 1,
-      MB_WRITE_COIL_OFFSET(relay3), PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ_WRITE_TRIGGER },
-    
-    { CID_DISC_INPUT1, "INPUT1", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_DISCRETE, 0x0000, 1,
-      0, PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ },
-    
-    { CID_DISC_INPUT2, "INPUT2", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_DISCRETE, 0x0001, 1,
-      0, PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ },
-    
-    { CID_DISC_INPUT3, "INPUT3", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_DISCRETE, 0x0002, 1,
-      0, PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ },
-    
-    { CID_DISC_INPUT4, "INPUT4", "ON/OFF", MB_DEVICE_ADDR1, MB_PARAM_DISCRETE, 0x0003, 1,
-      0, PARAM_TYPE_U8, 1, OPTS(0, 1, 0), PAR_PERMS_READ }
+    RELAY_REGMAP(DEVICE_PARAMETER)
 };
 
 // Calculate number of parameters in the table
 const uint16_t num_device_parameters = (sizeof(device_parameters) / sizeof(device_parameters[0]));
 
+// Descriptors are indexed by CID, so the key is a table read rather than a name search
+#define PARAM_KEY(cid) (device_parameters[(cid)].param_key)
+
 // Function to set device address
 esp_err_t set_device_address(uint8_t new_address)
 {
     uint8_t type = 0;
-    esp_err_t err = mbc_master_set_parameter(CID_HOLD_DEV_ADDR, "DEV_ADDR", (uint8_t*)&new_address, &type);
+    uint16_t address_data = new_address;  // DEV_ADDR is a U16 parameter
+    esp_err_t err = mbc_master_set_parameter(RELAY_CID_DEV_ADDR, PARAM_KEY(RELAY_CID_DEV_ADDR), (uint8_t*)&address_data, &type);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Device address set to: %d", new_address);
     } else {
@@ -94,7 +50,7 @@ esp_err_t read_device_address()
 {
     uint8_t type = 0;
     uint16_t address_data;
-    esp_err_t err = mbc_master_get_parameter(CID_HOLD_DEV_ADDR, "DEV_ADDR", (uint8_t*)&address_data, &type);
+    esp_err_t err = mbc_master_get_parameter(RELAY_CID_DEV_ADDR, PARAM_KEY(RELAY_CID_DEV_ADDR), (uint8_t*)&address_data, &type);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Device address: %d", address_data);
     } else {
@@ -108,7 +64,7 @@ esp_err_t read_software_version()
 {
     uint8_t type = 0;
     char version_data[8];
-    esp_err_t err = mbc_master_get_parameter(CID_HOLD_SOFTWARE_VER, "SOFTWARE_VER", (uint8_t*)version_data, &type);
+    esp_err_t err = mbc_master_get_parameter(RELAY_CID_SOFTWARE_VER, PARAM_KEY(RELAY_CID_SOFTWARE_VER), (uint8_t*)version_data, &type);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Software version: %s", version_data);
     } else {
@@ -122,7 +78,7 @@ esp_err_t read_hardware_version()
 {
     uint8_t type = 0;
     uint16_t version_data;
-    esp_err_t err = mbc_master_get_parameter(CID_HOLD_HARDWARE_VER, "HARDWARE_VER", (uint8_t*)&version_data, &type);
+    esp_err_t err = mbc_master_get_parameter(RELAY_CID_HARDWARE_VER, PARAM_KEY(RELAY_CID_HARDWARE_VER), (uint8_t*)&version_data, &type);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Hardware version: V%d.%02d", version_data / 100, version_data % 100);
     } else {
@@ -136,7 +92,6 @@ esp_err_t control_relay(uint8_t relay_num, bool state)
 {
     uint8_t type = 0;
     uint16_t coil_data = state ? 0xFF00 : 0x0000;
-    const char* relay_names[] = {"RELAY0", "RELAY1", "RELAY2", "RELAY3"};
     
     mb_param_request_t request = {
         .slave_addr = MB_SLAVE_ADDR,
@@ -159,8 +114,8 @@ esp_err_t read_relay_status(uint8_t relay_num)
 {
     uint8_t type = 0;
     uint8_t coil_data;
-    const char* relay_names[] = {"RELAY0", "RELAY1", "RELAY2", "RELAY3"};
-    esp_err_t err = mbc_master_get_parameter(CID_COIL_RELAY0 + relay_num, relay_names[relay_num], &coil_data, &type);
+    uint16_t cid = RELAY_CID_RELAY0 + relay_num;
+    esp_err_t err = mbc_master_get_parameter(cid, PARAM_KEY(cid), &coil_data, &type);
     if (err == ESP_OK) {
         ESP_LOGI(TAG, "Relay %d status: %s", relay_num, coil_data ? "ON" : "OFF");
     } else {
@@ -174,9 +129,9 @@ esp_err_t read_all_inputs()
 {
     uint8_t type = 0;
     uint8_t input_data;
-    const char* input_names[] = {"INPUT1", "INPUT2", "INPUT3", "INPUT4"};
     for (int i = 0; i < 4; i++) {
-        esp_err_t err = mbc_master_get_parameter(CID_DISC_INPUT1 + i, input_names[i], &input_data, &type);
+        uint16_t cid = RELAY_CID_INPUT1 + i;
+        esp_err_t err = mbc_master_get_parameter(cid, PARAM_KEY(cid), &input_data, &type);
         if (err == ESP_OK) {
             ESP_LOGI(TAG, "Input %d status: %s", i+1, input_data ? "PRESSED" : "RELEASED");
         } else {
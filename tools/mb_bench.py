@@ -0,0 +1,165 @@
+#!/usr/bin/env python3
+# Modbus TCP throughput benchmark for the 5_ relay module.
+#
+#   mb_bench.py 192.168.1.50 --clients 1,2,4,8 --duration 5
+#   mb_bench.py 192.168.1.50 --clients 1 --pipeline 1,4,16
+#   mb_bench.py 192.168.1.50 --clients 1,4 --transport tcp,udp
+#
+# Every client opens its own connection and runs Read Coils (FC 0x01)
+# request/response loops; the table shows how total throughput scales with
+# the number of concurrent clients. With --pipeline N each client sends N
+# requests in one write before reading the N responses. --transport udp sends
+# the same MBAP frames as datagrams (CONFIG_MB_UDP_ENABLE); a datagram without a
+# reply within the timeout counts as an error and the client carries on.
+
+from __future__ import print_function
+
+import argparse
+import socket
+import struct
+import sys
+import threading
+import time
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def recv_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise IOError('connection closed by slave')
+        data += chunk
+    return data
+
+
+class Client(threading.Thread):
+    def __init__(self, address, unit_id, deadline, pipeline, transport):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.address = address
+        self.unit_id = unit_id
+        self.deadline = deadline
+        self.pipeline = pipeline
+        self.transport = transport
+        self.latencies = []
+        self.errors = 0
+
+    def run(self):
+        if self.transport == 'udp':
+            self.run_udp()
+            return
+        try:
+            sock = socket.create_connection(self.address, timeout=2)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        except (IOError, OSError):
+            self.errors += 1
+            return
+        tid = 0
+        while time.time() < self.deadline:
+            tids = []
+            requests = b''
+            for _ in range(self.pipeline):
+                tid = (tid + 1) & 0xFFFF
+                tids.append(tid)
+                requests += struct.pack('>HHHBBHH', tid, 0, 6, self.unit_id, 0x01, 0, 2)
+            t0 = time.time()
+            try:
+                sock.sendall(requests)
+                for expected in tids:
+                    header = recv_exact(sock, 7)
+                    rx_tid, _, length, _ = struct.unpack('>HHHB', header)
+                    recv_exact(sock, length - 1)
+                    if rx_tid != expected:
+                        raise IOError('transaction ID mismatch')
+            except (IOError, OSError):
+                self.errors += 1
+                break
+            elapsed_ms = (time.time() - t0) * 1000.0
+            self.latencies.extend([elapsed_ms] * self.pipeline)
+        sock.close()
+
+    def run_udp(self):
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.connect(self.address)
+        sock.settimeout(0.5)
+        tid = 0
+        while time.time() < self.deadline:
+            tids = []
+            t0 = time.time()
+            for _ in range(self.pipeline):
+                tid = (tid + 1) & 0xFFFF
+                tids.append(tid)
+                sock.send(struct.pack('>HHHBBHH', tid, 0, 6, self.unit_id, 0x01, 0, 2))
+            # Datagrams may be lost or reordered, so match replies by transaction ID
+            answered = 0
+            try:
+                while answered < len(tids):
+                    rx_tid = struct.unpack('>H', sock.recv(260)[:2])[0]
+                    if rx_tid in tids:
+                        answered += 1
+            except socket.timeout:
+                self.errors += len(tids) - answered
+            except (IOError, OSError):
+                self.errors += 1
+                break
+            elapsed_ms = (time.time() - t0) * 1000.0
+            self.latencies.extend([elapsed_ms] * answered)
+        sock.close()
+
+
+def run(address, unit_id, clients, duration, pipeline, transport):
+    deadline = time.time() + duration
+    threads = [Client(address, unit_id, deadline, pipeline, transport) for _ in range(clients)]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+    latencies = sorted(l for t in threads for l in t.latencies)
+    served = sum(1 for t in threads if t.latencies)
+    return {
+        'requests': len(latencies),
+        'rate': len(latencies) / elapsed,
+        'served': served,
+        'errors': sum(t.errors for t in threads),
+        'p50': percentile(latencies, 50),
+        'p99': percentile(latencies, 99),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Modbus TCP/UDP throughput benchmark')
+    parser.add_argument('host', help='host[:port] of the Modbus slave')
+    parser.add_argument('--clients', default='1,2,4,8', help='comma-separated client counts')
+    parser.add_argument('--duration', type=float, default=5.0, help='seconds per client count')
+    parser.add_argument('--pipeline', default='1',
+                        help='comma-separated numbers of requests in flight per client')
+    parser.add_argument('--transport', default='tcp', help='comma-separated transports: tcp, udp')
+    parser.add_argument('--unit', type=int, default=1)
+    args = parser.parse_args()
+
+    host, _, port = args.host.partition(':')
+    address = (host, int(port or 502))
+
+    print('transport  clients  pipeline  served   requests     req/s   p50 ms   p99 ms  errors')
+    for transport in args.transport.split(','):
+        for clients in [int(c) for c in args.clients.split(',')]:
+            for pipeline in [int(p) for p in args.pipeline.split(',')]:
+                r = run(address, args.unit, clients, args.duration, pipeline, transport)
+                print('%-9s  %7d  %8d  %6d  %9d  %8.0f  %7.2f  %7.2f  %6d' %
+                      (transport, clients, pipeline, r['served'], r['requests'], r['rate'],
+                       r['p50'], r['p99'], r['errors']))
+                time.sleep(0.5)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Pulls the event log of a 4_ relay module with Read File Record (FC 0x14) and
+# acknowledges what was read with Write File Record (FC 0x15).
+# Register layout: 4_ESP32_as_modbus_4_relay_module/main/event_log.h
+#
+#   mb_events.py --port /dev/ttyUSB0 --unit 1 [--ack] [--clear]
+
+from __future__ import print_function
+
+import argparse
+import struct
+import sys
+
+import mbcap
+
+FILE_EVENTS = 1
+FILE_CONTROL = 2
+RECORD_REGS = 5
+MAX_READ_REGS = 120     # fits one FC 0x14 response (0xF5 data bytes)
+
+EVENT_NAMES = {1: 'BOOT', 2: 'RELAY', 3: 'RELAY_FLASH', 4: 'INPUT', 5: 'ERROR'}
+
+
+class Link(object):
+    def __init__(self, port, baud, unit_id):
+        import serial
+        self.port = serial.Serial(port, baud, timeout=1.0,
+                                  inter_byte_timeout=max(0.002, 35.0 / baud))
+        self.unit_id = unit_id
+
+    def transact(self, pdu):
+        self.port.reset_input_buffer()
+        self.port.write(mbcap.rtu_frame(self.unit_id, pdu))
+        reply = self.port.read(256)
+        if len(reply) < 5 or mbcap.crc16(reply[:-2]) != struct.unpack('<H', reply[-2:])[0]:
+            raise IOError('no valid reply')
+        pdu = reply[1:-2]
+        if bytearray(pdu)[0] & 0x80:
+            raise IOError('exception 0x%02X' % bytearray(pdu)[1])
+        return pdu
+
+    def read_file(self, file_number, record, length):
+        sub = struct.pack('>BHHH', 6, file_number, record, length)
+        pdu = self.transact(struct.pack('>BB', 0x14, len(sub)) + sub)
+        # fc, resp data len, file resp len, ref type, data
+        return struct.unpack('>%dH' % length, pdu[4:4 + 2 * length])
+
+    def write_file(self, file_number, record, values):
+        sub = struct.pack('>BHHH', 6, file_number, record, len(values)) + \
+            struct.pack('>%dH' % len(values), *values)
+        self.transact(struct.pack('>BB', 0x15, len(sub)) + sub)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Read the event log of a relay module')
+    parser.add_argument('--port', required=True)
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--unit', type=int, default=1)
+    parser.add_argument('--ack', action='store_true', help='acknowledge the events that were read')
+    parser.add_argument('--clear', action='store_true', help='clear the log without reading it')
+    args = parser.parse_args()
+
+    link = Link(args.port, args.baud, args.unit)
+    if args.clear:
+        link.write_file(FILE_CONTROL, 0, [0xFFFF])
+        return 0
+
+    count, oldest_seq, lost, capacity = link.read_file(FILE_CONTROL, 0, 4)
+    print('%d events retained (capacity %d), %d lost to overwrite' % (count, capacity, lost))
+
+    regs = []
+    total = count * RECORD_REGS
+    while len(regs) < total:
+        length = min(MAX_READ_REGS, total - len(regs))
+        regs.extend(link.read_file(FILE_EVENTS, len(regs), length))
+
+    last_seq = None
+    for i in range(0, len(regs), RECORD_REGS):
+        seq, kind, value, ts_hi, ts_lo = regs[i:i + RECORD_REGS]
+        print('#%-5d %10.3f s  %-11s source=%-3d value=%d' %
+              (seq, ((ts_hi << 16) | ts_lo) / 1000.0, EVENT_NAMES.get(kind >> 8, hex(kind >> 8)),
+               kind & 0xFF, value))
+        last_seq = seq
+
+    if args.ack and last_seq is not None:
+        link.write_file(FILE_CONTROL, 0, [last_seq])
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
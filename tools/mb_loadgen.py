@@ -0,0 +1,248 @@
+#!/usr/bin/env python3
+# Scripted load generator and latency benchmark for the 5_ Modbus TCP slave.
+#
+#   mb_loadgen.py 192.168.1.50                                  built-in scenarios against a module
+#   mb_loadgen.py --spawn 5_esp32_as_modbus_tcp_2_relays_module/host/slave --save base.json
+#   mb_loadgen.py --spawn .../host/slave --baseline base.json   regression gate, exit 1 on regression
+#   mb_loadgen.py 127.0.0.1:1502 --scenario my.json --only mixed
+#
+# A scenario runs N clients, each on its own connection, sending a weighted mix of
+# function codes with a pipelining depth and a think time between batches:
+#
+#   {"name": "mixed", "clients": 4, "pipeline": 1, "think_ms": 0,
+#    "mix": {"0x01": 40, "0x02": 40, "0x05": 10, "0x0F": 5, "0x10": 5}}
+#
+# Latency runs from the send of a batch to the arrival of each response. With
+# --spawn the host build of the slave (host/build.sh) is started and stopped
+# afterwards, so the numbers measure the server logic, not WiFi.
+# Python threads cap the offered load at a few 10k requests/s: compare runs made
+# on the same machine only; the default tolerances absorb the run-to-run noise
+# of a loaded desktop, tighten them on a quiet CI runner.
+
+from __future__ import print_function
+
+import argparse
+import json
+import random
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+SCENARIOS = [
+    {'name': 'poll', 'clients': 8, 'pipeline': 1, 'think_ms': 0,
+     'mix': {'0x01': 50, '0x02': 50}},
+    {'name': 'mixed', 'clients': 4, 'pipeline': 1, 'think_ms': 0,
+     'mix': {'0x01': 40, '0x02': 40, '0x05': 10, '0x0F': 5, '0x10': 5}},
+    {'name': 'pipelined', 'clients': 2, 'pipeline': 16, 'think_ms': 0,
+     'mix': {'0x01': 50, '0x02': 50}},
+    {'name': 'scada', 'clients': 8, 'pipeline': 1, 'think_ms': 10,
+     'mix': {'0x01': 45, '0x02': 45, '0x05': 10}},
+]
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def recv_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise IOError('connection closed by slave')
+        data += chunk
+    return data
+
+
+def build_pdu(fc, rng):
+    """A request the 2-relay module answers without an exception."""
+    if fc == 0x01 or fc == 0x02:
+        return struct.pack('>BHH', fc, 0, 2)
+    if fc == 0x05:
+        return struct.pack('>BHH', fc, rng.randint(0, 1), rng.choice((0xFF00, 0x0000)))
+    if fc == 0x0F:
+        return struct.pack('>BHHBB', fc, 0, 8, 1, rng.randint(0, 3))
+    if fc == 0x10:
+        # Relay mode without flashing (delay 0); register 0 would change the unit ID
+        return struct.pack('>BHHBHH', fc, rng.choice((0x0003, 0x0008)), 2, 4, rng.randint(0, 1), 0)
+    raise ValueError('unsupported function code 0x%02X' % fc)
+
+
+class Client(threading.Thread):
+    def __init__(self, address, unit_id, deadline, scenario, seed):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.address = address
+        self.unit_id = unit_id
+        self.deadline = deadline
+        self.pipeline = scenario['pipeline']
+        self.think = scenario['think_ms'] / 1000.0
+        self.codes = [int(fc, 0) for fc in scenario['mix']]
+        self.weights = [scenario['mix'][fc] for fc in scenario['mix']]
+        self.rng = random.Random(seed)
+        self.latencies = []
+        self.exceptions = 0
+        self.errors = 0
+
+    def run(self):
+        try:
+            sock = socket.create_connection(self.address, timeout=2)
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        except (IOError, OSError):
+            self.errors += 1
+            return
+        tid = 0
+        while time.time() < self.deadline:
+            tids = []
+            requests = b''
+            for fc in self.rng.choices(self.codes, self.weights, k=self.pipeline):
+                tid = (tid + 1) & 0xFFFF
+                tids.append(tid)
+                pdu = build_pdu(fc, self.rng)
+                requests += struct.pack('>HHHB', tid, 0, len(pdu) + 1, self.unit_id) + pdu
+            t0 = time.time()
+            try:
+                sock.sendall(requests)
+                for expected in tids:
+                    rx_tid, _, length, _ = struct.unpack('>HHHB', recv_exact(sock, 7))
+                    pdu = recv_exact(sock, length - 1)
+                    self.latencies.append((time.time() - t0) * 1000.0)
+                    if rx_tid != expected:
+                        raise IOError('transaction ID mismatch')
+                    if bytearray(pdu)[0] & 0x80:
+                        self.exceptions += 1
+            except (IOError, OSError):
+                self.errors += 1
+                break
+            if self.think:
+                time.sleep(self.think)
+        sock.close()
+
+
+def run_scenario(address, unit_id, scenario, duration):
+    deadline = time.time() + duration
+    threads = [Client(address, unit_id, deadline, scenario, seed=i) for i in range(scenario['clients'])]
+    start = time.time()
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    elapsed = time.time() - start
+    latencies = sorted(l for t in threads for l in t.latencies)
+    return {
+        'requests': len(latencies),
+        'rate': len(latencies) / elapsed,
+        'p50': percentile(latencies, 50),
+        'p99': percentile(latencies, 99),
+        'p999': percentile(latencies, 99.9),
+        'max': latencies[-1] if latencies else 0.0,
+        'exceptions': sum(t.exceptions for t in threads),
+        'errors': sum(t.errors for t in threads),
+    }
+
+
+def spawn_slave(binary, port):
+    """Starts the host build and waits until it accepts connections. The port is
+    fixed when the binary is built (MB_TCP_PORT for host/build.sh)."""
+    process = subprocess.Popen([binary, '1'], stdout=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=0.1).close()
+            return process
+        except (IOError, OSError):
+            time.sleep(0.1)
+    process.kill()
+    raise IOError('host slave did not start listening on port %d' % port)
+
+
+def check_regressions(results, baseline, rate_tolerance, latency_tolerance):
+    failures = []
+    for name, r in sorted(results.items()):
+        if r['errors'] or r['exceptions']:
+            failures.append('%s: %d errors, %d exceptions' % (name, r['errors'], r['exceptions']))
+        base = baseline.get(name)
+        if base is None:
+            continue
+        if r['rate'] < base['rate'] * (1.0 - rate_tolerance):
+            failures.append('%s: %.0f req/s, baseline %.0f' % (name, r['rate'], base['rate']))
+        if r['p99'] > base['p99'] * (1.0 + latency_tolerance):
+            failures.append('%s: p99 %.2f ms, baseline %.2f' % (name, r['p99'], base['p99']))
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Modbus TCP load generator and latency benchmark')
+    parser.add_argument('host', nargs='?', help='host[:port] of the Modbus TCP slave')
+    parser.add_argument('--spawn', metavar='BINARY', help='start this host build of the slave and test it')
+    parser.add_argument('--spawn-port', type=int, default=1502, help='port the host build listens on')
+    parser.add_argument('--scenario', help='JSON file with a list of scenarios to run instead of the built-in ones')
+    parser.add_argument('--only', help='comma-separated scenario names to run')
+    parser.add_argument('--duration', type=float, default=5.0, help='seconds per scenario')
+    parser.add_argument('--unit', type=int, default=1)
+    parser.add_argument('--save', help='write the results to this JSON file')
+    parser.add_argument('--baseline', help='JSON results to compare with; exit 1 on regression')
+    parser.add_argument('--rate-tolerance', type=float, default=0.25,
+                        help='allowed drop in req/s against the baseline (fraction)')
+    parser.add_argument('--latency-tolerance', type=float, default=1.0,
+                        help='allowed rise in p99 latency against the baseline (fraction)')
+    args = parser.parse_args()
+
+    if not args.host and not args.spawn:
+        parser.error('give a host or --spawn')
+
+    scenarios = SCENARIOS
+    if args.scenario:
+        with open(args.scenario) as f:
+            scenarios = json.load(f)
+    if args.only:
+        names = args.only.split(',')
+        scenarios = [s for s in scenarios if s['name'] in names]
+
+    process = None
+    if args.spawn:
+        process = spawn_slave(args.spawn, args.spawn_port)
+        address = ('127.0.0.1', args.spawn_port)
+    else:
+        host, _, port = args.host.partition(':')
+        address = (host, int(port or 502))
+
+    results = {}
+    try:
+        print('scenario    clients  pipeline  think ms   requests     req/s   p50 ms   p99 ms  p999 ms   max ms  exc  err')
+        for scenario in scenarios:
+            r = run_scenario(address, args.unit, scenario, args.duration)
+            results[scenario['name']] = r
+            print('%-10s  %7d  %8d  %8d  %9d  %8.0f  %7.2f  %7.2f  %7.2f  %7.2f  %3d  %3d' %
+                  (scenario['name'], scenario['clients'], scenario['pipeline'], scenario['think_ms'],
+                   r['requests'], r['rate'], r['p50'], r['p99'], r['p999'], r['max'],
+                   r['exceptions'], r['errors']))
+            time.sleep(0.5)
+    finally:
+        if process is not None:
+            process.terminate()
+            process.wait()
+
+    if args.save:
+        with open(args.save, 'w') as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        failures = check_regressions(results, baseline, args.rate_tolerance, args.latency_tolerance)
+        for failure in failures:
+            print('REGRESSION ' + failure)
+        if failures:
+            return 1
+        print('no regression against %s' % args.baseline)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
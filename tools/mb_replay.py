@@ -0,0 +1,269 @@
+#!/usr/bin/env python3
+# Replays the requests of a capture file against a running slave and diffs the
+# responses against the recorded ones.
+#
+#   mb_replay.py capture.mbcap --serial /dev/ttyUSB0 --baud 9600     4_ relay module (RTU)
+#   mb_replay.py capture.mbcap --tcp 192.168.1.50 --speed 10         5_ relay module (Modbus TCP)
+#   mb_replay.py capture.mbcap --spawn 5_esp32_as_modbus_tcp_2_relays_module/host/slave --speed 0
+#
+# RTU requests are converted to MBAP for TCP targets and vice versa, so a field
+# capture from the RS-485 bus can be replayed against either firmware. With --spawn
+# the host build of the 5_ slave (host/build.sh) is started and stopped afterwards.
+#
+# Requests keep their recorded offsets from the first one (--pace offset), or wait
+# for the recorded bus silence before them once the previous exchange is done
+# (--pace gap), which keeps the master's think time on a slave of other speed.
+# Per-function code times are round trips, request sent to reply received; for
+# RTU targets the wire time of both frames is subtracted, leaving the slave's
+# turnaround.
+
+from __future__ import print_function
+
+import argparse
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+import mbcap
+
+
+class RtuTarget(object):
+    def __init__(self, port, baud):
+        import serial
+        self.char_time = 10.0 / baud
+        self.port = serial.Serial(port, baud, timeout=0.5,
+                                  inter_byte_timeout=max(0.002, 3.5 * self.char_time))
+
+    def transact(self, unit_id, pdu, expect_reply, timeout):
+        self.port.reset_input_buffer()
+        self.port.timeout = timeout
+        self.port.write(mbcap.rtu_frame(unit_id, pdu))
+        if not expect_reply:
+            return None
+        reply = self.port.read(256)
+        if len(reply) < 4 or mbcap.crc16(reply[:-2]) != struct.unpack('<H', reply[-2:])[0]:
+            return None if not reply else b''
+        return reply[1:-2]
+
+    def record_flags(self):
+        return 0
+
+    def frame(self, unit_id, pdu, tid):
+        return mbcap.rtu_frame(unit_id, pdu)
+
+    def wire_time(self, pdu, reply):
+        """Seconds both frames spend on the wire, address and CRC included."""
+        return (len(pdu) + 3 + (len(reply) + 3 if reply else 0)) * self.char_time
+
+
+class TcpTarget(object):
+    def __init__(self, address):
+        host, _, port = address.partition(':')
+        self.sock = socket.create_connection((host, int(port or 502)), timeout=2)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.tid = 0
+
+    def _recv_exact(self, n):
+        data = b''
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise IOError('connection closed by slave')
+            data += chunk
+        return data
+
+    def transact(self, unit_id, pdu, expect_reply, timeout):
+        self.tid = (self.tid + 1) & 0xFFFF
+        self.sock.settimeout(timeout)
+        self.sock.sendall(self.frame(unit_id, pdu, self.tid))
+        if not expect_reply:
+            return None
+        try:
+            header = self._recv_exact(7)
+            tid, _, length, _ = struct.unpack('>HHHB', header)
+            body = self._recv_exact(length - 1)
+        except socket.timeout:
+            return None
+        if tid != self.tid:
+            return b''
+        return body
+
+    def record_flags(self):
+        return mbcap.FLAG_TCP
+
+    def frame(self, unit_id, pdu, tid):
+        return struct.pack('>HHHB', tid, 0, len(pdu) + 1, unit_id) + pdu
+
+    def wire_time(self, pdu, reply):
+        return 0.0
+
+
+def spawn_slave(binary, port):
+    """Starts the host build and waits until it accepts connections. The port is
+    fixed when the binary is built (MB_TCP_PORT for host/build.sh)."""
+    process = subprocess.Popen([binary, '1'], stdout=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection(('127.0.0.1', port), timeout=0.1).close()
+            return process
+        except (IOError, OSError):
+            time.sleep(0.1)
+    process.kill()
+    raise IOError('host slave did not start listening on port %d' % port)
+
+
+def unwrapped_times(records):
+    """Microseconds since the first record. The recorded stamps are 32 bit and wrap
+    every 71.6 minutes; the sniffer's stats records every few seconds keep the step
+    between neighbouring records far below that."""
+    times = []
+    elapsed = 0
+    for i, r in enumerate(records):
+        if i > 0:
+            elapsed += (r.timestamp_us - records[i - 1].timestamp_us) & 0xFFFFFFFF
+        times.append(elapsed)
+    return times
+
+
+def transactions(records, unit_override):
+    """Pair every clean request with the recorded reply that followed it, if any."""
+    times = unwrapped_times(records)
+    frames = [(r, t) for r, t in zip(records, times) if r.type == mbcap.TYPE_FRAME]
+    for i, (r, t) in enumerate(frames):
+        if r.is_response or r.flags & (mbcap.FLAG_CRC_ERROR | mbcap.FLAG_TRUNCATED):
+            continue
+        reply = frames[i + 1][0] if i + 1 < len(frames) and frames[i + 1][0].is_response else None
+        unit_id = r.unit_id if unit_override is None else unit_override
+        yield r, t, unit_id, r.pdu(), reply.pdu() if reply is not None else None
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Replay a Modbus capture against a slave')
+    parser.add_argument('capture')
+    target = parser.add_mutually_exclusive_group(required=True)
+    target.add_argument('--serial', help='RS-485 port of an RTU slave')
+    target.add_argument('--tcp', help='host[:port] of a Modbus TCP slave')
+    target.add_argument('--spawn', metavar='BINARY', help='start this host build of the 5_ slave and replay against it')
+    parser.add_argument('--spawn-port', type=int, default=1502, help='port the host build listens on')
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--unit', type=int, help='send every request to this unit ID instead')
+    parser.add_argument('--speed', type=float, default=1.0,
+                        help='time scale for the recorded gaps, 0 = back to back')
+    parser.add_argument('--pace', choices=('offset', 'gap'), default='offset',
+                        help='keep each request\'s offset from the first, or the bus silence before it')
+    parser.add_argument('--timeout', type=float, default=1.0, help='reply timeout in seconds')
+    parser.add_argument('--record', help='append the replayed exchange to this capture file')
+    parser.add_argument('--max-diffs', type=int, default=20, help='mismatches to print')
+    args = parser.parse_args()
+
+    records = mbcap.read_file(args.capture)
+    process = spawn_slave(args.spawn, args.spawn_port) if args.spawn else None
+    try:
+        return replay(args, records)
+    finally:
+        if process is not None:
+            process.terminate()
+            process.wait()
+
+
+def replay(args, records):
+    if args.serial:
+        slave = RtuTarget(args.serial, args.baud)
+    else:
+        slave = TcpTarget(args.tcp or '127.0.0.1:%d' % args.spawn_port)
+    writer = mbcap.Writer(args.record) if args.record else None
+
+    per_fc = {}
+    sent = matched = mismatched = missing = unexpected = 0
+    first_offset = None
+    wall_start = time.time()
+    last_done = wall_start
+
+    for request, offset_us, unit_id, pdu, expected in transactions(records, args.unit):
+        # Keep the recorded pacing, scaled: the request's offset from the first one,
+        # or the bus silence that preceded it, counted from the end of the last exchange.
+        if args.speed > 0:
+            if first_offset is None:
+                first_offset = offset_us
+            if args.pace == 'gap':
+                due = last_done + request.gap_us / 1e6 / args.speed
+            else:
+                due = wall_start + (offset_us - first_offset) / 1e6 / args.speed
+            delay = due - time.time()
+            if delay > 0:
+                time.sleep(delay)
+
+        expect_reply = unit_id != 0
+        t0 = time.time()
+        reply = slave.transact(unit_id, pdu, expect_reply, args.timeout)
+        done = time.time()
+        sent += 1
+
+        fc = bytearray(pdu[:1])[0] if pdu else 0
+        if expect_reply and reply is not None:
+            per_fc.setdefault(fc, []).append((done - t0 - slave.wire_time(pdu, reply)) * 1000.0)
+
+        if writer is not None:
+            ts = int((t0 - wall_start) * 1e6)
+            writer.write(mbcap.Record(mbcap.TYPE_FRAME, slave.record_flags(), unit_id, ts,
+                                      int((t0 - last_done) * 1e6),
+                                      slave.frame(unit_id, pdu, sent & 0xFFFF)))
+            if reply:
+                flags = slave.record_flags() | mbcap.FLAG_RESPONSE
+                if bytearray(reply[:1])[0] & 0x80:
+                    flags |= mbcap.FLAG_EXCEPTION
+                writer.write(mbcap.Record(mbcap.TYPE_FRAME, flags, unit_id, int((done - wall_start) * 1e6), 0,
+                                          slave.frame(unit_id, reply, sent & 0xFFFF)))
+        last_done = done
+
+        if not expect_reply:
+            continue
+        if expected is None:
+            if reply:
+                unexpected += 1
+            continue
+        if not reply:
+            missing += 1
+            result = 'no reply'
+        elif reply == expected:
+            matched += 1
+            continue
+        else:
+            mismatched += 1
+            result = 'got ' + ' '.join('%02X' % b for b in bytearray(reply))
+        if missing + mismatched <= args.max_diffs:
+            print('unit %d req %s: expected %s, %s' %
+                  (unit_id, ' '.join('%02X' % b for b in bytearray(pdu)),
+                   ' '.join('%02X' % b for b in bytearray(expected)), result))
+
+    if writer is not None:
+        writer.close()
+
+    print()
+    print('%d requests replayed in %.1f s: %d matched, %d differed, %d unanswered, %d unexpected replies' %
+          (sent, time.time() - wall_start, matched, mismatched, missing, unexpected))
+    print()
+    if args.serial:
+        print('Slave turnaround per function code: round trip minus the wire time of both frames')
+    else:
+        print('Round trip per function code: request sent to reply received')
+    print('  FC   count    min ms    avg ms    p50 ms    p99 ms    max ms')
+    for fc in sorted(per_fc):
+        times = sorted(per_fc[fc])
+        print('0x%02X  %6d  %8.2f  %8.2f  %8.2f  %8.2f  %8.2f' %
+              (fc, len(times), times[0], sum(times) / len(times),
+               percentile(times, 50), percentile(times, 99), times[-1]))
+    return 0 if mismatched == 0 and missing == 0 else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# Modbus/TCP Security handshake benchmark for the 5_ relay module
+# (CONFIG_MB_TLS_ENABLE): the cost of a full TLS handshake against one resumed
+# from the module's session cache or from a session ticket.
+#
+#   mb_tls_bench.py 192.168.1.50 --count 20
+#   mb_tls_bench.py 192.168.1.50:802 --modes full,ticket --certs path/to/certs
+#
+# Each connection does the handshake and one Read Input Registers of the module's
+# TLS statistics (0x0050), which report the CPU time the module spent on the
+# handshake. "cache" connections refuse session tickets, so the server has to find
+# the session by its ID. --handshake-only skips the Modbus read, for trying the
+# tool against another TLS server such as openssl s_server.
+
+from __future__ import print_function
+
+import argparse
+import os
+import socket
+import ssl
+import struct
+import sys
+import time
+
+TLS_REG_BASE = 0x0050
+TLS_REG_COUNT = 10
+DEFAULT_CERTS = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..',
+                             '5_esp32_as_modbus_tcp_2_relays_module', 'main', 'certs')
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def recv_exact(sock, n):
+    data = b''
+    while len(data) < n:
+        chunk = sock.recv(n - len(data))
+        if not chunk:
+            raise IOError('connection closed by slave')
+        data += chunk
+    return data
+
+
+def make_context(certs, tickets):
+    ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+    # The module runs TLS 1.2, where resumption works from the first handshake
+    ctx.minimum_version = ssl.TLSVersion.TLSv1_2
+    ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+    ctx.load_verify_locations(os.path.join(certs, 'ca.crt'))
+    ctx.load_cert_chain(os.path.join(certs, 'client.crt'), os.path.join(certs, 'client.key'))
+    # The development server certificate names no address
+    ctx.check_hostname = False
+    if not tickets:
+        ctx.options |= ssl.OP_NO_TICKET
+    return ctx
+
+
+def read_tls_stats(sock, unit):
+    request = struct.pack('>HHHBBHH', 1, 0, 6, unit, 0x04, TLS_REG_BASE, TLS_REG_COUNT)
+    sock.sendall(request)
+    header = recv_exact(sock, 7)
+    body = recv_exact(sock, struct.unpack('>H', header[4:6])[0] - 1)
+    if bytearray(body)[0] & 0x80:
+        raise IOError('exception 0x%02X reading the TLS statistics' % bytearray(body)[1])
+    return struct.unpack('>5I', body[2:2 + 2 * TLS_REG_COUNT])
+
+
+def connect(host, port, ctx, session, args):
+    """One connection; returns (handshake ms, reused, server CPU us or None, session)."""
+    raw = socket.create_connection((host, port), timeout=args.timeout)
+    raw.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    sock = ctx.wrap_socket(raw, do_handshake_on_connect=False, session=session)
+    try:
+        t0 = time.time()
+        sock.do_handshake()
+        elapsed_ms = (time.time() - t0) * 1000.0
+        server_us = None
+        if not args.handshake_only:
+            full, resumed, failed, full_us, resumed_us = read_tls_stats(sock, args.unit)
+            server_us = resumed_us if sock.session_reused else full_us
+        return elapsed_ms, sock.session_reused, server_us, sock.session
+    finally:
+        sock.close()
+
+
+def run_mode(mode, host, port, args):
+    ctx = make_context(args.certs, tickets=(mode == 'ticket'))
+    times, server_times = [], []
+    reused = 0
+    session = None
+    if mode != 'full':
+        # Establishes the session the measured connections resume
+        session = connect(host, port, ctx, None, args)[3]
+    for _ in range(args.count):
+        elapsed_ms, was_reused, server_us, new_session = connect(host, port, ctx, session, args)
+        times.append(elapsed_ms)
+        if server_us is not None:
+            server_times.append(server_us / 1000.0)
+        reused += was_reused
+        if mode != 'full':
+            session = new_session
+    return times, server_times, reused
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Modbus/TCP Security handshake benchmark')
+    parser.add_argument('host', help='host[:port] of the module, port 802 by default')
+    parser.add_argument('--modes', default='full,cache,ticket', help='comma-separated: full, cache, ticket')
+    parser.add_argument('--count', type=int, default=10, help='connections per mode')
+    parser.add_argument('--certs', default=DEFAULT_CERTS, help='directory with ca.crt, client.crt, client.key')
+    parser.add_argument('--unit', type=int, default=1)
+    parser.add_argument('--timeout', type=float, default=10.0)
+    parser.add_argument('--handshake-only', action='store_true', help='no Modbus read after the handshake')
+    args = parser.parse_args()
+
+    host, _, port = args.host.partition(':')
+    port = int(port or 802)
+
+    print('mode      count  resumed   p50 ms   max ms   module CPU ms (avg)')
+    for mode in args.modes.split(','):
+        times, server_times, reused = run_mode(mode, host, port, args)
+        times.sort()
+        server = '%.1f' % (sum(server_times) / len(server_times)) if server_times else '-'
+        print('%-8s %6d %8d %8.1f %8.1f   %s' %
+              (mode, len(times), reused, percentile(times, 50), times[-1], server))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
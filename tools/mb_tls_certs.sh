@@ -0,0 +1,67 @@
+#!/bin/sh
+# Issues certificates for Modbus/TCP Security (CONFIG_MB_TLS_ENABLE), all ECDSA
+# P-256, which the ESP32 verifies and signs with far faster than RSA. Client
+# certificates carry the Modbus/TCP Security role extension (OID
+# 1.3.6.1.4.1.50316.802.1).
+#
+#   tools/mb_tls_certs.sh ca CA_DIR                          once: the CA, keep CA_DIR/ca.key offline
+#   tools/mb_tls_certs.sh server CA_DIR NAME [DIR]           per module, before building its image
+#   tools/mb_tls_certs.sh client CA_DIR NAME [ROLE] [DIR]    per master, e.g. for tools/mb_tls_bench.py
+#
+# DIR defaults to the 5_ module's main/certs, where the build embeds ca.crt,
+# server.crt and server.key. Every module gets its own key: build and flash one
+# image per module after issuing its server certificate. Keys are never committed.
+
+set -e
+DAYS=3650
+MODE=$1
+CA_DIR=$2
+[ -n "$MODE" ] && [ -n "$CA_DIR" ] || { sed -n '8,10p' "$0" | sed 's/^# *//'; exit 1; }
+DEFAULT_DIR=$(dirname "$0")/../5_esp32_as_modbus_tcp_2_relays_module/main/certs
+
+ec_key() {
+    (umask 077 && openssl genpkey -algorithm EC -pkeyopt ec_paramgen_curve:P-256 -out "$1" 2>/dev/null)
+}
+
+# issue DIR NAME CN EXTENSIONS...
+issue() {
+    dir=$1
+    name=$2
+    cn=$3
+    shift 3
+    mkdir -p "$dir"
+    ec_key "$dir/$name.key"
+    printf '%s\n' "$@" > "$dir/$name.ext"
+    openssl req -new -key "$dir/$name.key" -subj "/CN=$cn" -out "$dir/$name.csr"
+    openssl x509 -req -in "$dir/$name.csr" -CA "$CA_DIR/ca.crt" -CAkey "$CA_DIR/ca.key" \
+        -CAcreateserial -CAserial "$CA_DIR/ca.srl" -days $DAYS -extfile "$dir/$name.ext" \
+        -out "$dir/$name.crt" 2>/dev/null
+    rm -f "$dir/$name.csr" "$dir/$name.ext"
+    [ "$(cd "$dir" && pwd)" = "$(cd "$CA_DIR" && pwd)" ] || cp "$CA_DIR/ca.crt" "$dir/ca.crt"
+    echo "$dir/$name.crt and $name.key issued for $cn"
+}
+
+case $MODE in
+    ca)
+        mkdir -p "$CA_DIR"
+        [ ! -e "$CA_DIR/ca.key" ] || { echo "$CA_DIR/ca.key exists" >&2; exit 1; }
+        ec_key "$CA_DIR/ca.key"
+        openssl req -x509 -new -key "$CA_DIR/ca.key" -days $DAYS -subj "/CN=Modbus relay module CA" \
+            -out "$CA_DIR/ca.crt"
+        echo "CA in $CA_DIR; keep ca.key out of git and off build machines you do not trust"
+        ;;
+    server)
+        [ -n "$3" ] || { echo "server needs a module name" >&2; exit 1; }
+        issue "${4:-$DEFAULT_DIR}" server "$3" basicConstraints=CA:FALSE keyUsage=digitalSignature \
+            extendedKeyUsage=serverAuth
+        ;;
+    client)
+        [ -n "$3" ] || { echo "client needs a name" >&2; exit 1; }
+        issue "${5:-$DEFAULT_DIR}" client "$3" basicConstraints=CA:FALSE keyUsage=digitalSignature \
+            extendedKeyUsage=clientAuth "1.3.6.1.4.1.50316.802.1=ASN1:UTF8String:${4:-Operator}"
+        ;;
+    *)
+        echo "unknown mode $MODE" >&2
+        exit 1
+        ;;
+esac
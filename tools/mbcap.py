@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+# Reader/writer for the Modbus capture format (see
+# 4_ESP32_as_modbus_4_relay_module/main/mb_capture.h).
+#
+#   mbcap.py record --port /dev/ttyUSB0 out.mbcap   save a live sniffer stream
+#   mbcap.py dump capture.mbcap                     print frames and statistics
+#   mbcap.py stats capture.mbcap                    per-slave summary
+
+from __future__ import print_function
+
+import argparse
+import struct
+import sys
+import time
+
+SYNC = 0xA5
+VERSION = 1
+MAGIC = b'MBCP'
+
+TYPE_FRAME = 0x00
+TYPE_STATS = 0x01
+
+FLAG_RESPONSE = 0x01
+FLAG_CRC_ERROR = 0x02
+FLAG_EXCEPTION = 0x04
+FLAG_TRUNCATED = 0x08
+FLAG_TCP = 0x10
+
+FILE_HEADER = struct.Struct('<4sB3x')
+RECORD_HEADER = struct.Struct('<BBBBHII')
+BUS_STATS = struct.Struct('<IIIIII')
+SLAVE_STATS = struct.Struct('<BIIIIIIII')
+
+
+class Record(object):
+    __slots__ = ('type', 'flags', 'unit_id', 'timestamp_us', 'gap_us', 'payload')
+
+    def __init__(self, type, flags, unit_id, timestamp_us, gap_us, payload):
+        self.type = type
+        self.flags = flags
+        self.unit_id = unit_id
+        self.timestamp_us = timestamp_us
+        self.gap_us = gap_us
+        self.payload = payload
+
+    @property
+    def is_response(self):
+        return bool(self.flags & FLAG_RESPONSE)
+
+    @property
+    def is_tcp(self):
+        return bool(self.flags & FLAG_TCP)
+
+    def pdu(self):
+        """Function code and data, without RTU address/CRC or MBAP header."""
+        if self.is_tcp:
+            return self.payload[7:]
+        return self.payload[1:-2]
+
+    def pack(self):
+        return RECORD_HEADER.pack(SYNC, self.type, self.flags, self.unit_id, len(self.payload),
+                                  self.timestamp_us & 0xFFFFFFFF, self.gap_us & 0xFFFFFFFF) + self.payload
+
+
+def crc16(data):
+    crc = 0xFFFF
+    for b in bytearray(data):
+        crc ^= b
+        for _ in range(8):
+            crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def rtu_frame(unit_id, pdu):
+    adu = bytes(bytearray([unit_id])) + pdu
+    return adu + struct.pack('<H', crc16(adu))
+
+
+def parse_stream(data):
+    """Yield records from raw stream bytes, resynchronising on garbage."""
+    offset = 0
+    while offset + RECORD_HEADER.size <= len(data):
+        if bytearray(data[offset:offset + 1])[0] != SYNC:
+            offset += 1
+            continue
+        sync, rtype, flags, unit_id, length, ts, gap = RECORD_HEADER.unpack_from(data, offset)
+        end = offset + RECORD_HEADER.size + length
+        if rtype not in (TYPE_FRAME, TYPE_STATS) or end > len(data):
+            if end > len(data):
+                break
+            offset += 1
+            continue
+        yield Record(rtype, flags, unit_id, ts, gap, bytes(data[offset + RECORD_HEADER.size:end])), end
+        offset = end
+
+
+def read_file(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < FILE_HEADER.size:
+        raise ValueError('%s: too short for a capture file' % path)
+    magic, version = FILE_HEADER.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('%s: not a capture file' % path)
+    if version != VERSION:
+        raise ValueError('%s: unsupported capture version %d' % (path, version))
+    return [r for r, _ in parse_stream(data[FILE_HEADER.size:])]
+
+
+class Writer(object):
+    """Append-only capture file writer. Existing files are extended in place."""
+
+    def __init__(self, path):
+        self.f = open(path, 'ab')
+        if self.f.tell() == 0:
+            self.f.write(FILE_HEADER.pack(MAGIC, VERSION))
+
+    def write(self, record):
+        self.f.write(record.pack())
+
+    def close(self):
+        self.f.close()
+
+
+def parse_stats(payload):
+    bus = dict(zip(('period_ms', 'frames', 'bytes', 'busy_us', 'crc_errors', 'dropped'),
+                   BUS_STATS.unpack_from(payload, 0)))
+    slaves = []
+    for off in range(BUS_STATS.size, len(payload) - SLAVE_STATS.size + 1, SLAVE_STATS.size):
+        slaves.append(dict(zip(('unit_id', 'requests', 'responses', 'exceptions', 'timeouts',
+                                'crc_errors', 'rt_min_us', 'rt_max_us', 'rt_avg_us'),
+                               SLAVE_STATS.unpack_from(payload, off))))
+    return bus, slaves
+
+
+def cmd_record(args):
+    import serial
+    port = serial.Serial(args.port, args.baud, timeout=0.2)
+    writer = Writer(args.output)
+    pending = b''
+    frames = 0
+    start = time.time()
+    try:
+        while args.duration == 0 or time.time() - start < args.duration:
+            pending += port.read(4096)
+            consumed = 0
+            for record, end in parse_stream(pending):
+                writer.write(record)
+                consumed = end
+                if record.type == TYPE_FRAME:
+                    frames += 1
+            pending = pending[consumed:]
+    except KeyboardInterrupt:
+        pass
+    writer.close()
+    print('%d frames written to %s' % (frames, args.output))
+
+
+def cmd_dump(args):
+    for r in read_file(args.capture):
+        if r.type == TYPE_STATS:
+            bus, slaves = parse_stats(r.payload)
+            load = 100.0 * bus['busy_us'] / (bus['period_ms'] * 1000.0) if bus['period_ms'] else 0
+            print('%10u STATS frames=%d bytes=%d load=%.1f%% dropped=%d' %
+                  (r.timestamp_us, bus['frames'], bus['bytes'], load, bus['dropped']))
+            continue
+        tags = []
+        if r.is_response:
+            tags.append('RSP')
+        if r.flags & FLAG_CRC_ERROR:
+            tags.append('CRC')
+        if r.flags & FLAG_EXCEPTION:
+            tags.append('EXC')
+        if r.is_tcp:
+            tags.append('TCP')
+        print('%10u +%-8u unit=%-3d %-12s %s' % (r.timestamp_us, r.gap_us, r.unit_id, ','.join(tags),
+                                                  ' '.join('%02X' % b for b in bytearray(r.payload))))
+
+
+def cmd_stats(args):
+    last = None
+    for r in read_file(args.capture):
+        if r.type == TYPE_STATS:
+            last = r
+    if last is None:
+        print('no statistics records in capture')
+        return
+    _, slaves = parse_stats(last.payload)
+    print('unit  requests  responses  exceptions  timeouts  crc   rt_min  rt_avg  rt_max (us)')
+    for s in slaves:
+        print('%4d  %8d  %9d  %10d  %8d  %4d  %6d  %6d  %6d' %
+              (s['unit_id'], s['requests'], s['responses'], s['exceptions'], s['timeouts'],
+               s['crc_errors'], s['rt_min_us'], s['rt_avg_us'], s['rt_max_us']))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Modbus capture file tool')
+    sub = parser.add_subparsers(dest='command')
+    p = sub.add_parser('record', help='save the sniffer stream from a serial port')
+    p.add_argument('--port', required=True)
+    p.add_argument('--baud', type=int, default=921600)
+    p.add_argument('--duration', type=float, default=0, help='seconds, 0 = until Ctrl-C')
+    p.add_argument('output')
+    p.set_defaults(func=cmd_record)
+    p = sub.add_parser('dump', help='print every record')
+    p.add_argument('capture')
+    p.set_defaults(func=cmd_dump)
+    p = sub.add_parser('stats', help='print the last per-slave statistics')
+    p.add_argument('capture')
+    p.set_defaults(func=cmd_stats)
+    args = parser.parse_args()
+    if not getattr(args, 'func', None):
+        parser.print_help()
+        return 1
+    args.func(args)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+# Uploads a firmware image to a 4_ relay module over RS-485 with the vendor
+# function code 0x41 (protocol: 4_ESP32_as_modbus_4_relay_module/main/rs485_ota.h).
+#
+#   rs485_ota.py --port /dev/ttyUSB0 --unit 1 build/modbus_slave.bin
+#
+# Chunks are streamed back to back without waiting for replies; after each window
+# the slave's STATUS bitmap says which chunks to resend. Other slaves on the bus see
+# the chunk stream as frames for another address and ignore it.
+
+from __future__ import print_function
+
+import argparse
+import hashlib
+import struct
+import sys
+import time
+
+import mbcap
+
+FC_OTA = 0x41
+BEGIN, DATA, STATUS, END, ABORT = 1, 2, 3, 4, 5
+STATE_NAMES = {0: 'idle', 1: 'receiving', 2: 'done', 3: 'error'}
+RESULT_NAMES = {0: 'ok', 1: 'incomplete', 2: 'SHA-256 mismatch', 3: 'image rejected', 4: 'flash error'}
+
+
+class Link(object):
+    def __init__(self, port, baud, unit_id):
+        import serial
+        self.port = serial.Serial(port, baud, timeout=1.0,
+                                  inter_byte_timeout=max(0.002, 35.0 / baud))
+        self.unit_id = unit_id
+
+    def send(self, pdu):
+        self.port.write(mbcap.rtu_frame(self.unit_id, pdu))
+
+    def transact(self, pdu, timeout=1.0, retries=3):
+        for _ in range(retries):
+            self.port.reset_input_buffer()
+            self.port.timeout = timeout
+            self.send(pdu)
+            reply = self.port.read(256)
+            if len(reply) < 5 or mbcap.crc16(reply[:-2]) != struct.unpack('<H', reply[-2:])[0]:
+                continue
+            pdu_reply = bytearray(reply[1:-2])
+            if pdu_reply[0] & 0x80:
+                raise IOError('exception 0x%02X' % pdu_reply[1])
+            return pdu_reply[1:]
+        raise IOError('no valid reply')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Update a relay module over RS-485')
+    parser.add_argument('image')
+    parser.add_argument('--port', required=True)
+    parser.add_argument('--baud', type=int, default=9600)
+    parser.add_argument('--unit', type=int, default=1)
+    parser.add_argument('--chunk', type=int, default=240, help='bytes per chunk, at most 240')
+    parser.add_argument('--window', type=int, default=32, help='chunks in flight, at most 32')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    link = Link(args.port, args.baud, args.unit)
+
+    # The slave erases flash as the chunks arrive, so BEGIN is answered right away
+    reply = link.transact(struct.pack('>BBIHB', FC_OTA, BEGIN, len(image), args.chunk, args.window))
+    chunk_size, window = struct.unpack('>HB', bytes(reply[1:4]))
+    chunks = [image[i:i + chunk_size] for i in range(0, len(image), chunk_size)]
+    print('%d bytes, %d chunks of %d, window %d' % (len(image), len(chunks), chunk_size, window))
+
+    start = time.time()
+    wire_bytes = 0
+    next_chunk, received = 0, 0
+    while next_chunk < len(chunks):
+        for i in range(next_chunk, min(next_chunk + window, len(chunks))):
+            if received & (1 << (i - next_chunk)):
+                continue
+            pdu = struct.pack('>BBHB', FC_OTA, DATA, i, len(chunks[i])) + chunks[i]
+            link.send(pdu)
+            wire_bytes += len(pdu) + 3
+        # STATUS is handled after every chunk sent before it, so anything still
+        # missing from the bitmap was lost and goes out again next round.
+        reply = link.transact(struct.pack('>BB', FC_OTA, STATUS))
+        state, next_chunk, received, error = struct.unpack('>BHIB', bytes(reply[1:9]))
+        if state != 1:
+            print('slave left the transfer: %s, %s' % (STATE_NAMES.get(state, state),
+                                                       RESULT_NAMES.get(error, error)))
+            return 1
+        sys.stdout.write('\r%5.1f%%' % (100.0 * next_chunk / len(chunks)))
+        sys.stdout.flush()
+
+    elapsed = time.time() - start
+    payload_rate = len(image) / elapsed
+    line_rate = args.baud / 10.0
+    print('\r%d bytes in %.1f s, %.0f B/s (%.0f%% of line rate, %.1f%% protocol overhead)' %
+          (len(image), elapsed, payload_rate, 100.0 * payload_rate / line_rate,
+           100.0 * (wire_bytes - len(image)) / wire_bytes))
+
+    reply = link.transact(struct.pack('>BB', FC_OTA, END) + hashlib.sha256(image).digest(),
+                          timeout=10.0, retries=1)
+    print('result: %s' % RESULT_NAMES.get(reply[1], reply[1]))
+    return 0 if reply[1] == 0 else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())